@@ -36,6 +36,16 @@ enum class CertificateType {
 	Rsa = WSC_CERTIFICATE_RSA
 };
 
+enum class TlsVersion { Tls10 = 0x0301, Tls11 = 0x0302, Tls12 = 0x0303, Tls13 = 0x0304 };
+
+struct TlsPolicy {
+	// For the following settings, not set means default
+	optional<TlsVersion> minVersion;
+	optional<TlsVersion> maxVersion;
+	optional<string> ciphersuites; // TLS 1.3 names by preference, like "TLS_AES_128_GCM_SHA256"
+	optional<string> groups;       // key exchange groups by preference, like "X25519:P-256"
+};
+
 enum class TransportPolicy { All = WSC_TRANSPORT_POLICY_ALL, Relay = WSC_TRANSPORT_POLICY_RELAY };
 
 struct WSC_CPP_EXPORT WebSocketConfiguration {
@@ -50,6 +60,19 @@ struct WSC_CPP_EXPORT WebSocketConfiguration {
 	optional<string> keyPemFile;
 	optional<string> keyPemPass;
 	optional<size_t> maxMessageSize;
+	optional<size_t> maxBufferedAmount; // sendAsync() fails if the buffered amount would exceed it
+	bool offloadTlsProcessing = false;  // if true, process TLS and callbacks on the thread pool
+	bool enableTcpFastOpen = false;     // if true, try to send the first flight in the SYN when
+	                                    // no other address is left to race with
+	optional<size_t> readBudget;        // in bytes read per poll wakeup, zero for unlimited
+	optional<size_t> readMessageBudget; // in reads per poll wakeup, zero for unlimited
+	bool enableKernelTls = false;       // if true, offload TLS encryption to the kernel if possible
+	                                    // (OpenSSL and TLS 1.3 on Linux, decryption stays in user
+	                                    // space)
+	bool enableTlsEarlyData = false;    // if true, send the request as TLS 1.3 0-RTT data on
+	                                    // resumption, only if a replayed request is harmless
+	optional<size_t> tlsRecordSize;     // fixed TLS record payload size, dynamic if not set
+	optional<TlsPolicy> tlsPolicy;      // defaults prefer AES-GCM only with hardware AES support
 };
 
 struct WebSocketServerConfiguration {
@@ -0,0 +1,267 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_CLIENT_COROUTINE_H
+#define WEBSOCKET_CLIENT_COROUTINE_H
+
+#include "websocket.hpp"
+
+// The library itself is C++17, the coroutine API is only available to C++20 applications
+#if (__cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)) &&                 \
+    __has_include(<coroutine>)
+
+#define WSC_HAS_COROUTINES 1
+
+#include <atomic>
+#include <coroutine>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+namespace wsc {
+
+// Awaitable operations on a WebSocket. Suspended coroutines are resumed directly from the library
+// callbacks, on the thread which processed the event, so they should not block. In particular, a
+// suspended receive() resumes on whichever thread delivers onAvailable, a poll thread, a worker,
+// or the thread calling Poll() with an external event loop, not on the thread which awaited it.
+// An operation completing before the coroutine suspends continues on the awaiting thread.
+// At most one open, one receive, and one send may be pending at a time.
+// Awaiting never allocates: the awaiters live in the coroutine frame. No task type is provided, so
+// the frame is allocated by the promise type of the application, which may define its own
+// promise_type::operator new to use a custom allocator. The allocator constructor below only
+// applies to the WebSocket.
+class AsyncWebSocket final {
+public:
+	AsyncWebSocket(WebSocket::Configuration config = {});
+	template <class Allocator>
+	AsyncWebSocket(std::allocator_arg_t, const Allocator &alloc,
+	               WebSocket::Configuration config = {});
+	AsyncWebSocket(shared_ptr<WebSocket> ws); // takes over the callbacks
+	~AsyncWebSocket();
+
+	// Pending operations are referenced from the callbacks
+	AsyncWebSocket(const AsyncWebSocket &) = delete;
+	AsyncWebSocket &operator=(const AsyncWebSocket &) = delete;
+	AsyncWebSocket(AsyncWebSocket &&) = delete;
+	AsyncWebSocket &operator=(AsyncWebSocket &&) = delete;
+
+	class OpenAwaiter;
+	class ReceiveAwaiter;
+	class SendAwaiter;
+
+	OpenAwaiter open(string url);           // throws if the connection fails
+	ReceiveAwaiter receive();               // nullopt once closed
+	SendAwaiter send(message_variant data); // waits while buffered amount is above threshold
+
+	void setBufferedAmountLowThreshold(size_t amount);
+	void close();
+
+	WebSocket &socket() { return *mWebSocket; }
+	const WebSocket &socket() const { return *mWebSocket; }
+
+private:
+	enum Operation { OpenOperation = 0, ReceiveOperation, SendOperation, OperationCount };
+
+	void setup();
+	template <class F> bool suspend(Operation op, std::coroutine_handle<> handle, F &&ready);
+	void resume(Operation op);
+	void resumeAll();
+	bool drained() const;
+
+	const shared_ptr<WebSocket> mWebSocket;
+	std::coroutine_handle<> mWaiting[OperationCount];
+	optional<string> mError;
+	std::atomic<size_t> mThreshold = 0;
+	mutable std::mutex mMutex;
+};
+
+class AsyncWebSocket::OpenAwaiter final {
+public:
+	bool await_ready() const { return false; }
+
+	bool await_suspend(std::coroutine_handle<> handle) {
+		{
+			std::lock_guard lock(mParent->mMutex);
+			mParent->mError.reset();
+		}
+		auto ws = mParent->mWebSocket;
+		ws->open(mUrl); // throws if the URL is invalid
+
+		// The state changes before callbacks are triggered, so an early open or close is seen here
+		return mParent->suspend(OpenOperation, handle, [&ws]() {
+			return ws->readyState() != WebSocket::State::Connecting;
+		});
+	}
+
+	void await_resume() const {
+		if (mParent->mWebSocket->isOpen())
+			return;
+
+		std::lock_guard lock(mParent->mMutex);
+		throw std::runtime_error(mParent->mError.value_or("WebSocket closed"));
+	}
+
+private:
+	friend class AsyncWebSocket;
+	OpenAwaiter(AsyncWebSocket *parent, string url) : mParent(parent), mUrl(std::move(url)) {}
+
+	AsyncWebSocket *mParent;
+	string mUrl;
+};
+
+class AsyncWebSocket::ReceiveAwaiter final {
+public:
+	bool await_ready() { return tryReceive(); }
+
+	bool await_suspend(std::coroutine_handle<> handle) {
+		// Check again with the lock held so a message arriving in between resumes us
+		return mParent->suspend(ReceiveOperation, handle, [this]() { return tryReceive(); });
+	}
+
+	optional<message_variant> await_resume() {
+		if (!mResult)
+			mResult = mParent->mWebSocket->receive();
+
+		return std::move(mResult);
+	}
+
+private:
+	friend class AsyncWebSocket;
+	ReceiveAwaiter(AsyncWebSocket *parent) : mParent(parent) {}
+
+	bool tryReceive() {
+		mResult = mParent->mWebSocket->receive();
+		return mResult || mParent->mWebSocket->isClosed();
+	}
+
+	AsyncWebSocket *mParent;
+	optional<message_variant> mResult;
+};
+
+class AsyncWebSocket::SendAwaiter final {
+public:
+	bool await_ready() {
+		mParent->mWebSocket->send(std::move(mData)); // throws if not open
+		return mParent->drained();
+	}
+
+	bool await_suspend(std::coroutine_handle<> handle) {
+		return mParent->suspend(SendOperation, handle, [this]() { return mParent->drained(); });
+	}
+
+	bool await_resume() const { return mParent->mWebSocket->isOpen(); } // false if closed
+
+private:
+	friend class AsyncWebSocket;
+	SendAwaiter(AsyncWebSocket *parent, message_variant data)
+	    : mParent(parent), mData(std::move(data)) {}
+
+	AsyncWebSocket *mParent;
+	message_variant mData;
+};
+
+inline AsyncWebSocket::AsyncWebSocket(WebSocket::Configuration config)
+    : mWebSocket(std::make_shared<WebSocket>(std::move(config))) {
+	setup();
+}
+
+template <class Allocator>
+AsyncWebSocket::AsyncWebSocket(std::allocator_arg_t, const Allocator &alloc,
+                               WebSocket::Configuration config)
+    : mWebSocket(std::allocate_shared<WebSocket>(alloc, std::move(config))) {
+	setup();
+}
+
+inline AsyncWebSocket::AsyncWebSocket(shared_ptr<WebSocket> ws) : mWebSocket(std::move(ws)) {
+	if (!mWebSocket)
+		throw std::invalid_argument("WebSocket is null");
+
+	setup();
+}
+
+inline AsyncWebSocket::~AsyncWebSocket() {
+	// Waits for callbacks in progress on other threads
+	mWebSocket->resetCallbacks();
+}
+
+inline AsyncWebSocket::OpenAwaiter AsyncWebSocket::open(string url) {
+	return OpenAwaiter(this, std::move(url));
+}
+
+inline AsyncWebSocket::ReceiveAwaiter AsyncWebSocket::receive() { return ReceiveAwaiter(this); }
+
+inline AsyncWebSocket::SendAwaiter AsyncWebSocket::send(message_variant data) {
+	return SendAwaiter(this, std::move(data));
+}
+
+inline void AsyncWebSocket::setBufferedAmountLowThreshold(size_t amount) {
+	mThreshold = amount;
+	mWebSocket->setBufferedAmountLowThreshold(amount);
+	if (drained())
+		resume(SendOperation);
+}
+
+inline void AsyncWebSocket::close() { mWebSocket->close(); }
+
+inline void AsyncWebSocket::setup() {
+	mWebSocket->onOpen([this]() { resume(OpenOperation); });
+	mWebSocket->onError([this](string error) {
+		std::lock_guard lock(mMutex);
+		mError.emplace(std::move(error));
+	});
+	mWebSocket->onClosed([this]() { resumeAll(); });
+	mWebSocket->onAvailable([this]() { resume(ReceiveOperation); });
+	mWebSocket->onBufferedAmountLow([this]() { resume(SendOperation); });
+	mWebSocket->setBufferedAmountLowThreshold(mThreshold);
+}
+
+template <class F>
+bool AsyncWebSocket::suspend(Operation op, std::coroutine_handle<> handle, F &&ready) {
+	std::lock_guard lock(mMutex);
+	if (ready())
+		return false;
+
+	if (mWaiting[op])
+		throw std::logic_error("An operation of the same kind is already pending");
+
+	mWaiting[op] = handle;
+	return true;
+}
+
+inline void AsyncWebSocket::resume(Operation op) {
+	std::coroutine_handle<> handle;
+	{
+		std::lock_guard lock(mMutex);
+		handle = std::exchange(mWaiting[op], nullptr);
+	}
+	if (handle)
+		handle.resume(); // this object may be destroyed from here
+}
+
+inline void AsyncWebSocket::resumeAll() {
+	std::coroutine_handle<> handles[OperationCount];
+	{
+		std::lock_guard lock(mMutex);
+		for (int i = 0; i < OperationCount; ++i)
+			handles[i] = std::exchange(mWaiting[i], nullptr);
+	}
+	for (auto handle : handles)
+		if (handle)
+			handle.resume();
+}
+
+inline bool AsyncWebSocket::drained() const {
+	return mWebSocket->bufferedAmount() <= mThreshold.load() || !mWebSocket->isOpen();
+}
+
+} // namespace wsc
+
+#endif
+
+#endif
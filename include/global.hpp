@@ -14,6 +14,7 @@
 #include <chrono>
 #include <future>
 #include <iostream>
+#include <vector>
 
 namespace wsc {
 
@@ -52,6 +53,70 @@ struct SctpSettings {
 
 WSC_CPP_EXPORT void SetSctpSettings(SctpSettings s);
 
+struct ThreadingSettings {
+	// For the following settings, not set means optimized default
+	optional<int> minWorkers;                              // always running, default is 1
+	optional<int> maxWorkers;                              // spawned on demand, default is CPUs
+	optional<std::chrono::milliseconds> workerIdleTimeout; // before workers above min exit
+	optional<int> reactorCount;                            // poll threads, default is 1
+	optional<bool> respectCpuQuota; // count CPUs allowed by affinity and cgroup, default is true
+	optional<int> workerPriority;   // nice value on POSIX, thread priority on Windows
+	optional<int> reactorPriority;  // nice value on POSIX, thread priority on Windows
+	optional<string> threadNamePrefix; // default is "wsc"
+	optional<bool> externalEventLoop;  // I/O and tasks run in Poll(), default is false
+
+	std::vector<int> workerCpus;  // CPU affinity for workers, empty for any
+	std::vector<int> reactorCpus; // CPU affinity for poll threads, empty for any
+};
+
+// Applied on the next global initialization
+WSC_CPP_EXPORT void SetThreadingSettings(ThreadingSettings s);
+
+// With externalEventLoop, process I/O, timers and callbacks on the calling thread, waiting up to
+// timeout for an event, negative to wait indefinitely. Returns the number of events and tasks
+// processed, or zero if the library is not initialized, see Preload(). Throws if it runs in
+// another mode. Keep polling until the future returned by Cleanup() is ready.
+// This removes the worker and poll threads, not synchronization: the loop still takes internal
+// locks, shared with API calls from other threads, and as getaddrinfo() blocks, hostnames are
+// still resolved on background threads, up to 2, before their callbacks are posted to the loop.
+WSC_CPP_EXPORT int Poll(std::chrono::milliseconds timeout);
+WSC_CPP_EXPORT int RunOnce(); // Poll() without waiting
+
+// Descriptor which is readable when Poll() has events to process, to integrate with another event
+// loop, or -1 if not supported (epoll on Linux only)
+WSC_CPP_EXPORT int GetPollDescriptor();
+
+// Delay before Poll() must be called to process timers even if the descriptor is not readable
+WSC_CPP_EXPORT optional<std::chrono::milliseconds> GetPollTimeout();
+
+// Resolve hostname to the given numeric addresses instead of querying DNS, empty to remove
+WSC_CPP_EXPORT void SetHostOverride(const string &hostname, std::vector<string> addresses);
+
+struct TlsSessionCacheStats {
+	size_t hits = 0;     // handshakes resuming a cached session
+	size_t misses = 0;   // full handshakes
+	size_t sessions = 0; // sessions currently cached
+};
+
+WSC_CPP_EXPORT TlsSessionCacheStats GetTlsSessionCacheStats();
+
+// Persist TLS client sessions to path so a restarted process can resume them, empty to disable
+WSC_CPP_EXPORT void SetTlsSessionCacheFile(const string &path);
+
+struct HandshakeStats {
+	size_t active = 0;    // TLS handshakes in progress
+	size_t queued = 0;    // TLS handshakes waiting for a slot
+	size_t completed = 0; // successful TLS handshakes
+	size_t failed = 0;    // failed TLS handshakes
+	std::chrono::milliseconds averageDuration = std::chrono::milliseconds::zero();
+	std::chrono::milliseconds maxDuration = std::chrono::milliseconds::zero();
+};
+
+WSC_CPP_EXPORT HandshakeStats GetHandshakeStats();
+
+// Limit the number of TLS handshakes in progress, the others wait in order, zero for unlimited
+WSC_CPP_EXPORT void SetMaxConcurrentHandshakes(size_t count);
+
 WSC_CPP_EXPORT std::ostream &operator<<(std::ostream &out, LogLevel level);
 
 } // namespace wsc
@@ -9,6 +9,9 @@
 #ifndef WEBSOCKET_CLIENT_UTILS_H
 #define WEBSOCKET_CLIENT_UTILS_H
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -52,54 +55,136 @@ private:
 };
 
 // callback with built-in synchronization
+// Invocations are lock-free: they hold a reference on an immutable snapshot of the current
+// function, so a replacement only publishes a new snapshot and returns immediately, and the
+// previous function is destroyed when its last invocation returns. Resetting to nullptr also
+// waits for invocations in progress on other threads to return, so no call happens afterwards.
 template <typename... Args> class synchronized_callback {
 public:
+	using function_type = std::function<void(Args...)>;
+
 	synchronized_callback() = default;
 	synchronized_callback(synchronized_callback &&cb) { *this = std::move(cb); }
 	synchronized_callback(const synchronized_callback &cb) { *this = cb; }
-	synchronized_callback(std::function<void(Args...)> func) { *this = std::move(func); }
+	synchronized_callback(function_type func) { *this = std::move(func); }
 	virtual ~synchronized_callback() { *this = nullptr; }
 
 	synchronized_callback &operator=(synchronized_callback &&cb) {
 		std::scoped_lock lock(mutex, cb.mutex);
-		set(std::exchange(cb.callback, nullptr));
+		function_type func = cb.load();
+		cb.set(nullptr);
+		set(std::move(func));
 		return *this;
 	}
 
 	synchronized_callback &operator=(const synchronized_callback &cb) {
 		std::scoped_lock lock(mutex, cb.mutex);
-		set(cb.callback);
+		set(cb.load());
 		return *this;
 	}
 
-	synchronized_callback &operator=(std::function<void(Args...)> func) {
-		std::lock_guard lock(mutex);
-		set(std::move(func));
+	synchronized_callback &operator=(function_type func) {
+		const bool reset = !func;
+		{
+			std::lock_guard lock(mutex);
+			set(std::move(func));
+		}
+
+		// Wait without the mutex, a call in progress might replace the callback too
+		if (reset)
+			wait();
+
 		return *this;
 	}
 
-	bool operator()(Args... args) const {
-		std::lock_guard lock(mutex);
-		return call(std::move(args)...);
-	}
+	bool operator()(Args... args) const { return call(std::move(args)...); }
 
-	operator bool() const {
-		std::lock_guard lock(mutex);
-		return callback ? true : false;
-	}
+	operator bool() const { return snapshot() ? true : false; }
 
 protected:
-	virtual void set(std::function<void(Args...)> func) { callback = std::move(func); }
+	virtual void set(function_type func) {
+		publish(func ? std::make_shared<const function_type>(std::move(func)) : nullptr);
+	}
+
 	virtual bool call(Args... args) const {
-		if (!callback)
+		Invocation invocation(this);
+		auto func = snapshot(); // after registering so a reset waits for us
+		if (!func)
 			return false;
 
-		callback(std::move(args)...);
+		(*func)(std::move(args)...);
 		return true;
 	}
 
-	std::function<void(Args...)> callback;
-	mutable std::recursive_mutex mutex;
+	mutable std::recursive_mutex mutex; // serializes replacements
+
+private:
+	using snapshot_ptr = std::shared_ptr<const function_type>;
+
+	// The state counts invocations in the low half and waiters in the high half, so invocations
+	// only take the wait mutex to notify a waiter
+	static constexpr uint64_t Invocations = 1;
+	static constexpr uint64_t Waiters = uint64_t(1) << 32;
+
+	struct Invocation {
+		Invocation(const synchronized_callback *cb_) : cb(cb_), prev(Current) {
+			cb->state += Invocations;
+			Current = this;
+		}
+
+		~Invocation() {
+			Current = prev;
+			uint64_t expected = cb->state.load();
+			while (expected < Waiters)
+				if (cb->state.compare_exchange_weak(expected, expected - Invocations))
+					return;
+
+			// Decrement with the mutex locked so the waiter can't miss it
+			std::lock_guard lock(cb->waitMutex);
+			cb->state -= Invocations;
+			cb->waitCondition.notify_all();
+		}
+
+		const synchronized_callback *const cb;
+		const Invocation *const prev;
+	};
+
+	void wait() const {
+		// Invocations on this thread, if reset from within itself, can't return meanwhile
+		uint64_t own = 0;
+		for (auto it = Current; it; it = it->prev)
+			if (it->cb == this)
+				++own;
+
+		std::unique_lock lock(waitMutex);
+		state += Waiters;
+		waitCondition.wait(lock, [&]() { return (state.load() & (Waiters - 1)) <= own; });
+		state -= Waiters;
+	}
+
+	function_type load() const {
+		// mutex must be locked
+		auto func = snapshot();
+		return func ? *func : nullptr;
+	}
+
+#if __cpp_lib_atomic_shared_ptr >= 201711L
+	snapshot_ptr snapshot() const { return current.load(); }
+	void publish(snapshot_ptr next) { current.store(std::move(next)); }
+
+	std::atomic<snapshot_ptr> current;
+#else
+	snapshot_ptr snapshot() const { return std::atomic_load(&current); }
+	void publish(snapshot_ptr next) { std::atomic_store(&current, std::move(next)); }
+
+	snapshot_ptr current;
+#endif
+
+	static inline thread_local const Invocation *Current = nullptr;
+
+	mutable std::atomic<uint64_t> state = 0;
+	mutable std::mutex waitMutex;
+	mutable std::condition_variable waitCondition;
 };
 
 // callback with built-in synchronization and replay of the last missed call
@@ -112,22 +197,30 @@ public:
 	~synchronized_stored_callback() {}
 
 private:
-	void set(std::function<void(Args...)> func) {
-		synchronized_callback<Args...>::set(func);
+	using base = synchronized_callback<Args...>;
+
+	void set(typename base::function_type func) override {
+		// mutex is locked
+		base::set(func);
 		if (func && stored) {
 			std::apply(func, std::move(*stored));
 			stored.reset();
 		}
 	}
 
-	bool call(Args... args) const {
-		if (!synchronized_callback<Args...>::call(args...))
+	bool call(Args... args) const override {
+		if (base::call(args...))
+			return true;
+
+		// Check again with replacements excluded so the call can't be missed
+		std::lock_guard lock(this->mutex);
+		if (!base::call(args...))
 			stored.emplace(std::move(args)...);
 
 		return true;
 	}
 
-	mutable std::optional<std::tuple<Args...>> stored;
+	mutable std::optional<std::tuple<Args...>> stored; // mutex must be locked
 };
 
 // pimpl base class
@@ -13,6 +13,8 @@
 #include "common.hpp"
 #include "configuration.hpp"
 
+#include <future>
+
 namespace wsc {
 
 namespace impl {
@@ -32,6 +34,12 @@ public:
 
 	using Configuration = WebSocketConfiguration;
 
+	// Keep count connections to the server of url established in advance so open() can claim
+	// one instead of connecting, zero to stop. Not available with proxy or client certificate.
+	// Connections are established up to the TLS handshake, open() sends the WebSocket request,
+	// and claims them only with the same TLS settings, including kernel TLS.
+	static void Preconnect(const string &url, size_t count = 1, Configuration config = {});
+
 	WebSocket();
 	WebSocket(Configuration config);
 	WebSocket(impl_ptr<impl::WebSocket> impl);
@@ -49,6 +57,18 @@ public:
 	bool send(const message_variant data) override;
 	bool send(const byte *data, size_t size) override;
 
+	// Send a message and call back on the thread pool once it is entirely written to the socket,
+	// or with false if the connection is closed first. If the message would exceed the maximum
+	// buffered amount set in the configuration, it is rejected: returns false and calls back with
+	// false. Written means copied to the kernel, as sends don't use MSG_ZEROCOPY, so completion
+	// does not wait for the peer to acknowledge the data.
+	bool sendAsync(message_variant data, std::function<void(bool written)> callback);
+	std::future<bool> sendAsync(message_variant data); // false if rejected or not written
+
+	// Send a region of a file as a binary message, streamed in fragments from a memory mapping.
+	// The file is sent until its end if length is unset. Returns false if buffered.
+	bool sendFile(const string &path, size_t offset = 0, optional<size_t> length = nullopt);
+
 	optional<string> remoteAddress() const;
 	optional<string> path() const;
 
@@ -126,6 +126,17 @@ typedef struct {
 	int pingIntervalMs;      // in milliseconds, 0 means default, < 0 means disabled
 	int maxOutstandingPings; // 0 means default, < 0 means disabled
 	int maxMessageSize;      // <= 0 means default
+	bool offloadTlsProcessing;   // if true, process TLS and callbacks on the thread pool
+	bool enableTcpFastOpen;      // if true, send the first flight in the SYN for a single address
+	int readBudget;              // in bytes per poll wakeup, 0 means default, < 0 means unlimited
+	int readMessageBudget;       // in reads per poll wakeup, 0 means default, < 0 means unlimited
+	bool enableKernelTls;        // if true, offload TLS encryption to the kernel if possible
+	bool enableTlsEarlyData;     // if true, send the request as TLS 1.3 0-RTT data on resumption
+	int tlsRecordSize;           // fixed TLS record payload size in bytes, <= 0 means dynamic
+	int tlsMinVersion;           // like 0x0303 for TLS 1.2, 0 means default
+	int tlsMaxVersion;           // like 0x0304 for TLS 1.3, 0 means default
+	const char *tlsCiphersuites; // TLS 1.3 names separated by ':', NULL means default
+	const char *tlsGroups;       // like "X25519:P-256", NULL means default
 } wscWsConfiguration;
 
 WSC_C_EXPORT int wscCreateWebSocket(const char *url); // returns ws id
@@ -134,6 +145,8 @@ WSC_C_EXPORT int wscDeleteWebSocket(int ws);
 
 WSC_C_EXPORT int wscGetWebSocketRemoteAddress(int ws, char *buffer, int size);
 WSC_C_EXPORT int wscGetWebSocketPath(int ws, char *buffer, int size);
+// Send a file region as a binary message, length < 0 means until the end of the file
+WSC_C_EXPORT int wscSendWebSocketFile(int ws, const char *path, int64_t offset, int64_t length);
 
 #ifdef __cplusplus
 } // extern "C"
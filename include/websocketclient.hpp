@@ -15,3 +15,4 @@
 
 // WebSocket
 #include "websocket.hpp"
+#include "coroutine.hpp" // C++20 only
@@ -12,6 +12,7 @@
 #include "impl/internals.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <exception>
 #include <mutex>
@@ -27,19 +28,47 @@ namespace {
 
 std::unordered_map<int, shared_ptr<WebSocket>> webSocketMap;
 
-std::unordered_map<int, void *> userPointerMap;
+// Callbacks capture the entry of their ID so they read the user pointer without locking
+struct UserPointer {
+	std::atomic<void *> ptr = nullptr;
+	std::atomic<bool> valid = true; // reset when the ID is deleted
+
+	optional<void *> get() const { return valid ? std::make_optional(ptr.load()) : nullopt; }
+};
+
+std::unordered_map<int, shared_ptr<UserPointer>> userPointerMap;
 std::mutex mutex;
 int lastId = 0;
 
-optional<void *> getUserPointer(int id) {
+shared_ptr<UserPointer> getUserPointer(int id) {
+	std::lock_guard lock(mutex);
+	if (auto it = userPointerMap.find(id); it != userPointerMap.end())
+		return it->second;
+
+	throw std::invalid_argument("WebSocket ID does not exist");
+}
+
+void *getUserPointerValue(int id) {
 	std::lock_guard lock(mutex);
 	auto it = userPointerMap.find(id);
-	return it != userPointerMap.end() ? std::make_optional(it->second) : nullopt;
+	return it != userPointerMap.end() ? it->second->ptr.load() : nullptr;
 }
 
 void setUserPointer(int i, void *ptr) {
 	std::lock_guard lock(mutex);
-	userPointerMap[i] = ptr;
+	auto &user = userPointerMap[i];
+	if (!user)
+		user = std::make_shared<UserPointer>();
+
+	user->ptr = ptr;
+}
+
+void eraseUserPointer(int id) {
+	// mutex must be locked
+	if (auto it = userPointerMap.find(id); it != userPointerMap.end()) {
+		it->second->valid = false;
+		userPointerMap.erase(it);
+	}
 }
 
 size_t eraseAll() {
@@ -48,6 +77,9 @@ size_t eraseAll() {
 	count += webSocketMap.size();
 	webSocketMap.clear();
 
+	for (auto &[id, user] : userPointerMap)
+		user->valid = false;
+
 	userPointerMap.clear();
 	return count;
 }
@@ -65,7 +97,7 @@ void eraseChannel(int id) {
 	std::lock_guard lock(mutex);
 
 	if (webSocketMap.erase(id) != 0) {
-		userPointerMap.erase(id);
+		eraseUserPointer(id);
 		return;
 	}
 
@@ -131,7 +163,7 @@ int emplaceWebSocket(shared_ptr<WebSocket> ptr) {
 	std::lock_guard lock(mutex);
 	int ws = ++lastId;
 	webSocketMap.emplace(std::make_pair(ws, ptr));
-	userPointerMap.emplace(std::make_pair(ws, nullptr));
+	userPointerMap.emplace(std::make_pair(ws, std::make_shared<UserPointer>()));
 	return ws;
 }
 
@@ -139,7 +171,7 @@ void eraseWebSocket(int ws) {
 	std::lock_guard lock(mutex);
 	if (webSocketMap.erase(ws) == 0)
 		throw std::invalid_argument("WebSocket ID does not exist");
-	userPointerMap.erase(ws);
+	eraseUserPointer(ws);
 }
 
 } // namespace
@@ -156,14 +188,15 @@ void wscInitLogger(wscLogLevel level, wscLogCallbackFunc cb) {
 
 void wscSetUserPointer(int i, void *ptr) { setUserPointer(i, ptr); }
 
-void *wscGetUserPointer(int i) { return getUserPointer(i).value_or(nullptr); }
+void *wscGetUserPointer(int i) { return getUserPointerValue(i); }
 
 int wscSetOpenCallback(int id, wscOpenCallbackFunc cb) {
 	return wrap([&] {
 		auto channel = getChannel(id);
+		auto user = getUserPointer(id);
 		if (cb)
-			channel->onOpen([id, cb]() {
-				if (auto ptr = getUserPointer(id))
+			channel->onOpen([id, cb, user]() {
+				if (auto ptr = user->get())
 					cb(id, *ptr);
 			});
 		else
@@ -175,9 +208,10 @@ int wscSetOpenCallback(int id, wscOpenCallbackFunc cb) {
 int wscSetClosedCallback(int id, wscClosedCallbackFunc cb) {
 	return wrap([&] {
 		auto channel = getChannel(id);
+		auto user = getUserPointer(id);
 		if (cb)
-			channel->onClosed([id, cb]() {
-				if (auto ptr = getUserPointer(id))
+			channel->onClosed([id, cb, user]() {
+				if (auto ptr = user->get())
 					cb(id, *ptr);
 			});
 		else
@@ -189,9 +223,10 @@ int wscSetClosedCallback(int id, wscClosedCallbackFunc cb) {
 int wscSetErrorCallback(int id, wscErrorCallbackFunc cb) {
 	return wrap([&] {
 		auto channel = getChannel(id);
+		auto user = getUserPointer(id);
 		if (cb)
-			channel->onError([id, cb](string error) {
-				if (auto ptr = getUserPointer(id))
+			channel->onError([id, cb, user](string error) {
+				if (auto ptr = user->get())
 					cb(id, error.c_str(), *ptr);
 			});
 		else
@@ -203,14 +238,15 @@ int wscSetErrorCallback(int id, wscErrorCallbackFunc cb) {
 int wscSetMessageCallback(int id, wscMessageCallbackFunc cb) {
 	return wrap([&] {
 		auto channel = getChannel(id);
+		auto user = getUserPointer(id);
 		if (cb)
 			channel->onMessage(
-			    [id, cb](binary b) {
-				    if (auto ptr = getUserPointer(id))
+			    [id, cb, user](binary b) {
+				    if (auto ptr = user->get())
 					    cb(id, reinterpret_cast<const char *>(b.data()), int(b.size()), *ptr);
 			    },
-			    [id, cb](string s) {
-				    if (auto ptr = getUserPointer(id))
+			    [id, cb, user](string s) {
+				    if (auto ptr = user->get())
 					    cb(id, s.c_str(), -int(s.size() + 1), *ptr);
 			    });
 		else
@@ -286,9 +322,10 @@ int wscSetBufferedAmountLowThreshold(int id, int amount) {
 int wscSetBufferedAmountLowCallback(int id, wscBufferedAmountLowCallbackFunc cb) {
 	return wrap([&] {
 		auto channel = getChannel(id);
+		auto user = getUserPointer(id);
 		if (cb)
-			channel->onBufferedAmountLow([id, cb]() {
-				if (auto ptr = getUserPointer(id))
+			channel->onBufferedAmountLow([id, cb, user]() {
+				if (auto ptr = user->get())
 					cb(id, *ptr);
 			});
 		else
@@ -304,9 +341,10 @@ int wscGetAvailableAmount(int id) {
 int wscSetAvailableCallback(int id, wscAvailableCallbackFunc cb) {
 	return wrap([&] {
 		auto channel = getChannel(id);
+		auto user = getUserPointer(id);
 		if (cb)
-			channel->onAvailable([id, cb]() {
-				if (auto ptr = getUserPointer(id))
+			channel->onAvailable([id, cb, user]() {
+				if (auto ptr = user->get())
 					cb(id, *ptr);
 			});
 		else
@@ -406,6 +444,39 @@ int wscCreateWebSocketEx(const char *url, const wscWsConfiguration *config) {
 		if (config->maxMessageSize > 0)
 			c.maxMessageSize = size_t(config->maxMessageSize);
 
+		c.offloadTlsProcessing = config->offloadTlsProcessing;
+		c.enableTcpFastOpen = config->enableTcpFastOpen;
+		c.enableKernelTls = config->enableKernelTls;
+		c.enableTlsEarlyData = config->enableTlsEarlyData;
+
+		if (config->tlsRecordSize > 0)
+			c.tlsRecordSize = size_t(config->tlsRecordSize);
+
+		if (config->tlsMinVersion > 0 || config->tlsMaxVersion > 0 || config->tlsCiphersuites ||
+		    config->tlsGroups) {
+			TlsPolicy policy;
+			if (config->tlsMinVersion > 0)
+				policy.minVersion = static_cast<TlsVersion>(config->tlsMinVersion);
+			if (config->tlsMaxVersion > 0)
+				policy.maxVersion = static_cast<TlsVersion>(config->tlsMaxVersion);
+			if (config->tlsCiphersuites)
+				policy.ciphersuites = string(config->tlsCiphersuites);
+			if (config->tlsGroups)
+				policy.groups = string(config->tlsGroups);
+
+			c.tlsPolicy = std::move(policy);
+		}
+
+		if (config->readBudget > 0)
+			c.readBudget = size_t(config->readBudget);
+		else if (config->readBudget < 0)
+			c.readBudget = 0; // setting to 0 disables, not setting keeps default
+
+		if (config->readMessageBudget > 0)
+			c.readMessageBudget = size_t(config->readMessageBudget);
+		else if (config->readMessageBudget < 0)
+			c.readMessageBudget = 0;
+
 		auto webSocket = std::make_shared<WebSocket>(std::move(c));
 		webSocket->open(url);
 		return emplaceWebSocket(webSocket);
@@ -442,6 +513,24 @@ int wscGetWebSocketPath(int ws, char *buffer, int size) {
 	});
 }
 
+int wscSendWebSocketFile(int ws, const char *path, int64_t offset, int64_t length) {
+	return wrap([&] {
+		auto webSocket = getWebSocket(ws);
+		if (!path)
+			throw std::invalid_argument("Unexpected null pointer for path");
+
+		if (offset < 0)
+			throw std::invalid_argument("Unexpected negative offset");
+
+		optional<size_t> optLength;
+		if (length >= 0)
+			optLength.emplace(size_t(length));
+
+		webSocket->sendFile(path, size_t(offset), optLength);
+		return WSC_ERR_SUCCESS;
+	});
+}
+
 void wscPreload() {
 	try {
 		wsc::Preload();
@@ -16,7 +16,11 @@
 
 #include "global.hpp"
 
+#include "impl/handshakeexecutor.hpp"
 #include "impl/init.hpp"
+#include "impl/pollservice.hpp"
+#include "impl/resolver.hpp"
+#include "impl/tlssessioncache.hpp"
 
 #include <mutex>
 
@@ -88,6 +92,48 @@ std::shared_future<void> Cleanup() { return impl::Init::Instance().cleanup(); }
 
 void SetSctpSettings(SctpSettings s) { impl::Init::Instance().setSctpSettings(std::move(s)); }
 
+void SetThreadingSettings(ThreadingSettings s) {
+	impl::Init::Instance().setThreadingSettings(std::move(s));
+}
+
+int Poll(std::chrono::milliseconds timeout) {
+	return impl::PollService::Instance().poll(timeout.count() >= 0 ? std::make_optional(timeout)
+	                                                                : nullopt);
+}
+
+int RunOnce() { return impl::PollService::Instance().poll(std::chrono::milliseconds::zero()); }
+
+int GetPollDescriptor() { return impl::PollService::Instance().descriptor(); }
+
+optional<std::chrono::milliseconds> GetPollTimeout() {
+	using clock = impl::PollService::clock;
+	auto next = impl::PollService::Instance().nextDeadline();
+	if (!next)
+		return nullopt;
+
+	// Round up so the timers have expired
+	return std::chrono::ceil<std::chrono::milliseconds>(
+	    std::max(clock::duration::zero(), *next - clock::now()));
+}
+
+void SetHostOverride(const string &hostname, std::vector<string> addresses) {
+	impl::Resolver::Instance().setOverride(hostname, std::move(addresses));
+}
+
+TlsSessionCacheStats GetTlsSessionCacheStats() {
+	return impl::TlsSessionCache::Instance().stats();
+}
+
+void SetTlsSessionCacheFile(const string &path) {
+	impl::TlsSessionCache::Instance().setFile(!path.empty() ? make_optional(path) : nullopt);
+}
+
+HandshakeStats GetHandshakeStats() { return impl::HandshakeExecutor::Instance().stats(); }
+
+void SetMaxConcurrentHandshakes(size_t count) {
+	impl::HandshakeExecutor::Instance().setMaxConcurrent(count);
+}
+
 std::ostream &operator<<(std::ostream &out, LogLevel level) {
 	switch (level) {
 	case LogLevel::Fatal:
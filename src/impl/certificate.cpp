@@ -648,6 +648,31 @@ future_certificate_ptr make_certificate(CertificateType type) {
 	});
 }
 
+certificate_ptr load_certificate(const string &crt_pem, const string &key_pem,
+                                 const string &pass) {
+	// Certificates hold an init token, so only weak references are kept
+	static std::mutex mutex;
+	static std::unordered_map<string, weak_ptr<Certificate>> cache;
+
+	const string key = crt_pem + '\0' + key_pem + '\0' + pass;
+	std::lock_guard lock(mutex);
+	if (auto it = cache.find(key); it != cache.end())
+		if (auto certificate = it->second.lock())
+			return certificate;
+
+	for (auto it = cache.begin(); it != cache.end();)
+		it = it->second.expired() ? cache.erase(it) : std::next(it);
+
+	const string PemBeginCertificateTag = "-----BEGIN CERTIFICATE-----";
+	auto certificate = std::make_shared<Certificate>(
+	    crt_pem.find(PemBeginCertificateTag) != string::npos
+	        ? Certificate::FromString(crt_pem, key_pem)
+	        : Certificate::FromFile(crt_pem, key_pem, pass));
+
+	cache.emplace(key, certificate);
+	return certificate;
+}
+
 CertificateFingerprint Certificate::fingerprint() const {
 	return CertificateFingerprint{CertificateFingerprint::Algorithm::Sha256, mFingerprint};
 }
@@ -87,6 +87,10 @@ using future_certificate_ptr = std::shared_future<certificate_ptr>;
 
 future_certificate_ptr make_certificate(CertificateType type = CertificateType::Default);
 
+// Load a certificate from PEM files or PEM contents, shared while in use
+certificate_ptr load_certificate(const string &crt_pem, const string &key_pem,
+                                 const string &pass = "");
+
 } // namespace wsc::impl
 
 #endif
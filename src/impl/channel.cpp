@@ -50,14 +50,15 @@ void Channel::triggerAvailable(size_t count) {
 }
 
 void Channel::triggerBufferedAmount(size_t amount) {
-	size_t previous = bufferedAmount.exchange(amount);
-	size_t threshold = bufferedAmountLowThreshold.load();
-	if (previous > threshold && amount <= threshold) {
-		try {
-			bufferedAmountLowCallback();
-		} catch (const std::exception &e) {
-			PLOG_WARNING << "Uncaught exception in callback: " << e.what();
-		}
+	if (updateBufferedAmount(amount))
+		triggerBufferedAmountLow();
+}
+
+void Channel::triggerBufferedAmountLow() {
+	try {
+		bufferedAmountLowCallback();
+	} catch (const std::exception &e) {
+		PLOG_WARNING << "Uncaught exception in callback: " << e.what();
 	}
 }
 
@@ -93,4 +94,10 @@ void Channel::resetCallbacks() {
 	messageCallback = nullptr;
 }
 
+bool Channel::updateBufferedAmount(size_t amount) {
+	size_t previous = bufferedAmount.exchange(amount);
+	size_t threshold = bufferedAmountLowThreshold.load();
+	return previous > threshold && amount <= threshold;
+}
+
 } // namespace wsc::impl
@@ -27,11 +27,14 @@ struct Channel {
 	virtual void triggerError(string error);
 	virtual void triggerAvailable(size_t count);
 	virtual void triggerBufferedAmount(size_t amount);
+	void triggerBufferedAmountLow();
 
 	virtual void flushPendingMessages();
 	void resetOpenCallback();
 	void resetCallbacks();
 
+	bool updateBufferedAmount(size_t amount); // true if it dropped to the low threshold
+
 	synchronized_stored_callback<> openCallback;
 	synchronized_stored_callback<> closedCallback;
 	synchronized_stored_callback<string> errorCallback;
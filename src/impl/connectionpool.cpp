@@ -0,0 +1,370 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "connectionpool.hpp"
+#include "internals.hpp"
+#include "threadpool.hpp"
+#include "verifiedtlstransport.hpp"
+
+namespace wsc::impl {
+
+namespace {
+
+shared_ptr<Transport> top_transport(const ConnectionPool::Connection &connection) {
+	if (connection.tls)
+		return connection.tls;
+	else
+		return connection.tcp;
+}
+
+string policy_key(const TlsPolicy &policy) {
+	auto version = [](optional<TlsVersion> v) { return v ? std::to_string(int(*v)) : string(); };
+	return "|policy:" + version(policy.minVersion) + '-' + version(policy.maxVersion) + ':' +
+	       policy.ciphersuites.value_or("") + ':' + policy.groups.value_or("");
+}
+
+} // namespace
+
+string ConnectionPool::Endpoint::key() const {
+	string key = sessionKey();
+	if (isSecure && kernelTls)
+		key += "|ktls";
+
+	return key;
+}
+
+string ConnectionPool::Endpoint::sessionKey() const {
+	string key = (isSecure ? "wss://" : "ws://") + hostname + ':' + service;
+	if (isSecure) {
+		key += verify ? "|verify" : "|noverify";
+		if (caCertificatePemFile)
+			key += '|' + *caCertificatePemFile;
+		if (tlsPolicy)
+			key += policy_key(*tlsPolicy);
+	}
+	return key;
+}
+
+ConnectionPool &ConnectionPool::Instance() {
+	static ConnectionPool *instance = new ConnectionPool;
+	return *instance;
+}
+
+ConnectionPool::ConnectionPool() {}
+
+ConnectionPool::~ConnectionPool() {}
+
+void ConnectionPool::preconnect(Endpoint endpoint, size_t count) {
+	const string key = endpoint.key();
+	PLOG_DEBUG << "Setting connection pool size to " << count << " for " << key;
+
+	std::vector<Connection> evicted;
+	{
+		std::lock_guard lock(mMutex);
+		if (count == 0) {
+			if (auto it = mPools.find(key); it != mPools.end()) {
+				for (auto &entry : it->second.entries)
+					evicted.push_back(std::move(entry->connection));
+
+				mPools.erase(it);
+			}
+		} else {
+			auto &pool = mPools[key];
+			pool.endpoint = std::move(endpoint);
+			pool.count = count;
+			while (pool.entries.size() > count) {
+				evicted.push_back(std::move(pool.entries.back()->connection));
+				pool.entries.pop_back();
+			}
+		}
+	}
+
+	for (auto &connection : evicted)
+		TearDown(std::move(connection));
+
+	if (count > 0)
+		fill(key);
+
+	scheduleSweep();
+}
+
+optional<ConnectionPool::Connection> ConnectionPool::claim(const Endpoint &endpoint) {
+	const string key = endpoint.key();
+	optional<Connection> result;
+	{
+		std::lock_guard lock(mMutex);
+		auto it = mPools.find(key);
+		if (it == mPools.end())
+			return nullopt;
+
+		auto &entries = it->second.entries;
+		for (auto jt = entries.begin(); jt != entries.end(); ++jt) {
+			const auto &entry = *jt;
+			auto transport = top_transport(entry->connection);
+			if (entry->ready && transport->state() == Transport::State::Connected) {
+				result.emplace(std::move(entry->connection));
+				entries.erase(jt);
+				break;
+			}
+		}
+	}
+
+	if (!result) {
+		PLOG_DEBUG << "No pooled connection available for " << key;
+		return nullopt;
+	}
+
+	PLOG_DEBUG << "Claimed pooled connection for " << key;
+	ThreadPool::Instance().post(&ConnectionPool::fill, this, key);
+	return result;
+}
+
+size_t ConnectionPool::available(const Endpoint &endpoint) {
+	std::lock_guard lock(mMutex);
+	auto it = mPools.find(endpoint.key());
+	if (it == mPools.end())
+		return 0;
+
+	const auto &entries = it->second.entries;
+	return std::count_if(entries.begin(), entries.end(), [](const shared_ptr<Entry> &entry) {
+		return entry->ready &&
+		       top_transport(entry->connection)->state() == Transport::State::Connected;
+	});
+}
+
+void ConnectionPool::clear() {
+	std::unordered_map<string, Pool> pools;
+	{
+		std::lock_guard lock(mMutex);
+		pools = std::exchange(mPools, {});
+		mSweepScheduled = false;
+	}
+
+	for (auto &[key, pool] : pools)
+		for (auto &entry : pool.entries)
+			TearDown(std::move(entry->connection));
+}
+
+void ConnectionPool::fill(const string &key) {
+	std::vector<shared_ptr<TcpTransport>> transports;
+	{
+		std::lock_guard lock(mMutex);
+		auto it = mPools.find(key);
+		if (it == mPools.end())
+			return;
+
+		auto &pool = it->second;
+		while (pool.entries.size() < pool.count) {
+			auto entry = std::make_shared<Entry>();
+			auto callback = [this, key, weak_entry = weak_ptr<Entry>(entry)](Transport::State s) {
+				processTcpStateChange(key, weak_entry, s);
+			};
+			entry->connection.tcp = std::make_shared<TcpTransport>(
+			    pool.endpoint.hostname, pool.endpoint.service, std::move(callback));
+			entry->connection.tcp->setFastOpen(pool.endpoint.fastOpen);
+
+			transports.push_back(entry->connection.tcp);
+			pool.entries.push_back(std::move(entry));
+		}
+	}
+
+	for (auto &transport : transports) {
+		PLOG_VERBOSE << "Establishing pooled connection for " << key;
+		try {
+			transport->start();
+		} catch (const std::exception &e) {
+			PLOG_WARNING << e.what(); // the entry will be evicted on next sweep
+		}
+	}
+}
+
+void ConnectionPool::sweep() {
+	std::vector<Connection> evicted;
+	std::vector<string> keys;
+	{
+		std::lock_guard lock(mMutex);
+		mSweepScheduled = false;
+
+		const auto now = clock::now();
+		for (auto &[key, pool] : mPools) {
+			const std::chrono::milliseconds connectionTimeout =
+			    pool.endpoint.connectionTimeout.value_or(POOL_CONNECTION_TIMEOUT);
+			auto &entries = pool.entries;
+			for (auto it = entries.begin(); it != entries.end();) {
+				const auto &entry = *it;
+				bool stale = entry->ready ? top_transport(entry->connection)->state() !=
+				                                    Transport::State::Connected ||
+				                                now - entry->since > POOL_IDLE_TIMEOUT
+				                          : connectionTimeout > std::chrono::milliseconds::zero() &&
+				                                now - entry->since > connectionTimeout;
+				if (stale) {
+					evicted.push_back(std::move(entry->connection));
+					it = entries.erase(it);
+				} else {
+					++it;
+				}
+			}
+
+			keys.push_back(key);
+		}
+	}
+
+	if (!evicted.empty()) {
+		PLOG_DEBUG << "Evicting " << evicted.size() << " stale pooled connections";
+	}
+
+	for (auto &connection : evicted)
+		TearDown(std::move(connection));
+
+	for (const auto &key : keys)
+		fill(key);
+
+	scheduleSweep();
+}
+
+void ConnectionPool::scheduleSweep() {
+	std::lock_guard lock(mMutex);
+	if (mSweepScheduled || mPools.empty())
+		return;
+
+	mSweepScheduled = true;
+	ThreadPool::Instance().post(POOL_HEALTH_CHECK_INTERVAL, &ConnectionPool::sweep, this);
+}
+
+void ConnectionPool::processTcpStateChange(const string &key, weak_ptr<Entry> weak_entry,
+                                           Transport::State state) {
+	auto entry = weak_entry.lock();
+	if (!entry)
+		return;
+
+	switch (state) {
+	case Transport::State::Connected: {
+		shared_ptr<TlsTransport> transport;
+		try {
+			std::lock_guard lock(mMutex);
+			auto it = mPools.find(key);
+			if (it == mPools.end() || !entry->connection.tcp)
+				return; // Removed or claimed
+
+			const auto &endpoint = it->second.endpoint;
+			if (!endpoint.isSecure) {
+				entry->ready = true;
+				entry->since = clock::now();
+				return;
+			}
+
+			auto callback = [this, key, weak_entry](Transport::State state) {
+				processTlsStateChange(key, weak_entry, state);
+			};
+
+			if (endpoint.verify)
+				transport = std::make_shared<VerifiedTlsTransport>(
+				    entry->connection.tcp, endpoint.hostname, nullptr, std::move(callback),
+				    endpoint.caCertificatePemFile);
+			else
+				transport = std::make_shared<TlsTransport>(entry->connection.tcp, endpoint.hostname,
+				                                           nullptr, std::move(callback));
+
+			if (endpoint.tlsPolicy)
+				transport->setPolicy(*endpoint.tlsPolicy);
+
+			transport->setKernelTls(endpoint.kernelTls);
+			transport->setSessionCacheKey(endpoint.sessionKey());
+			entry->connection.tls = transport;
+
+		} catch (const std::exception &e) {
+			PLOG_WARNING << e.what();
+			remove(key, entry);
+			return;
+		}
+
+		try {
+			transport->start();
+		} catch (const std::exception &e) {
+			PLOG_WARNING << e.what();
+			remove(key, entry);
+		}
+		break;
+	}
+	case Transport::State::Failed:
+		PLOG_DEBUG << "Pooled TCP connection failed for " << key;
+		remove(key, entry);
+		break;
+	case Transport::State::Disconnected:
+		remove(key, entry);
+		break;
+	default:
+		// Ignore
+		break;
+	}
+}
+
+void ConnectionPool::processTlsStateChange(const string &key, weak_ptr<Entry> weak_entry,
+                                           Transport::State state) {
+	auto entry = weak_entry.lock();
+	if (!entry)
+		return;
+
+	switch (state) {
+	case Transport::State::Connected: {
+		std::lock_guard lock(mMutex);
+		entry->ready = true;
+		entry->since = clock::now();
+		break;
+	}
+	case Transport::State::Failed:
+		PLOG_DEBUG << "Pooled TLS connection failed for " << key;
+		remove(key, entry);
+		break;
+	case Transport::State::Disconnected:
+		remove(key, entry);
+		break;
+	default:
+		// Ignore
+		break;
+	}
+}
+
+void ConnectionPool::remove(const string &key, const shared_ptr<Entry> &entry) {
+	optional<Connection> connection;
+	{
+		std::lock_guard lock(mMutex);
+		auto it = mPools.find(key);
+		if (it == mPools.end())
+			return;
+
+		auto &entries = it->second.entries;
+		if (auto jt = std::find(entries.begin(), entries.end(), entry); jt != entries.end()) {
+			connection.emplace(std::move(entry->connection));
+			entries.erase(jt);
+		}
+	}
+
+	// Failed connections are replaced on next sweep to avoid hammering the endpoint
+	if (connection)
+		TearDown(std::move(*connection));
+}
+
+void ConnectionPool::TearDown(Connection connection) {
+	if (!connection.tcp)
+		return;
+
+	// Callbacks must not be reset from the transport's own thread, so delegate everything
+	ThreadPool::Instance().post([connection = std::move(connection)]() mutable {
+		auto top = top_transport(connection);
+		connection.tcp->onStateChange(nullptr);
+		if (connection.tls)
+			connection.tls->onStateChange(nullptr);
+
+		top->stop();
+		connection.tls.reset();
+		connection.tcp.reset();
+	});
+}
+
+} // namespace wsc::impl
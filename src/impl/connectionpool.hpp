@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_IMPL_CONNECTION_POOL_H
+#define WEBSOCKET_IMPL_CONNECTION_POOL_H
+
+#include "common.hpp"
+#include "tcptransport.hpp"
+#include "tlstransport.hpp"
+
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace wsc::impl {
+
+// Pre-established TCP and TLS connections per endpoint, refilled in the background. Connections
+// are not upgraded to WebSocket in advance, as the HTTP request depends on the path, protocols
+// and headers of the claiming open(), so TLS early data has nothing to carry on them either.
+class ConnectionPool final {
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct Endpoint {
+		string hostname;
+		string service;
+		bool isSecure = false;
+		bool verify = false; // verify the TLS certificate
+		optional<string> caCertificatePemFile;
+		optional<TlsPolicy> tlsPolicy;
+		bool kernelTls = false;
+
+		// Only used while establishing, so not part of the key
+		bool fastOpen = false;
+		optional<std::chrono::milliseconds> connectionTimeout; // zero to disable
+
+		string key() const;        // connections with the same key are interchangeable
+		string sessionKey() const; // TLS sessions are shared between the same session keys
+	};
+
+	struct Connection {
+		shared_ptr<TcpTransport> tcp;
+		shared_ptr<TlsTransport> tls; // null if not secure
+	};
+
+	static ConnectionPool &Instance();
+
+	ConnectionPool(const ConnectionPool &) = delete;
+	ConnectionPool &operator=(const ConnectionPool &) = delete;
+	ConnectionPool(ConnectionPool &&) = delete;
+	ConnectionPool &operator=(ConnectionPool &&) = delete;
+
+	// Keep count connections established to endpoint, zero to stop
+	void preconnect(Endpoint endpoint, size_t count);
+
+	// Take an established connection, the caller must replace the state callbacks
+	optional<Connection> claim(const Endpoint &endpoint);
+
+	size_t available(const Endpoint &endpoint); // established connections ready to be claimed
+
+	void clear();
+
+private:
+	ConnectionPool();
+	~ConnectionPool();
+
+	struct Entry {
+		Connection connection;
+		bool ready = false;
+		clock::time_point since = clock::now();
+	};
+
+	struct Pool {
+		Endpoint endpoint;
+		size_t count = 0;
+		std::list<shared_ptr<Entry>> entries;
+	};
+
+	void fill(const string &key);
+	void sweep();
+	void scheduleSweep();
+	void processTcpStateChange(const string &key, weak_ptr<Entry> weak_entry,
+	                           Transport::State state);
+	void processTlsStateChange(const string &key, weak_ptr<Entry> weak_entry,
+	                           Transport::State state);
+	void remove(const string &key, const shared_ptr<Entry> &entry);
+
+	static void TearDown(Connection connection);
+
+	std::unordered_map<string, Pool> mPools; // key is Endpoint::key()
+	bool mSweepScheduled = false;
+	std::mutex mMutex;
+};
+
+} // namespace wsc::impl
+
+#endif
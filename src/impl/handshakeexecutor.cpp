@@ -0,0 +1,185 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "handshakeexecutor.hpp"
+#include "internals.hpp"
+#include "threadpool.hpp"
+#include "utils.hpp"
+
+namespace wsc::impl {
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+
+HandshakeExecutor &HandshakeExecutor::Instance() {
+	static HandshakeExecutor *instance = new HandshakeExecutor;
+	return *instance;
+}
+
+HandshakeExecutor::HandshakeExecutor() : mMaxConcurrent(HANDSHAKE_MAX_CONCURRENT) {}
+
+HandshakeExecutor::~HandshakeExecutor() {}
+
+void HandshakeExecutor::start(int count) {
+	std::lock_guard lock(mMutex);
+	mStopped = false;
+	mMaxThreads = size_t(std::max(count, 0)); // threads are spawned on demand, none for the pool
+}
+
+void HandshakeExecutor::join() {
+	{
+		std::lock_guard lock(mMutex);
+		mStopped = true;
+		mCondition.notify_all();
+	}
+
+	for (auto &t : mThreads)
+		t.join();
+
+	mThreads.clear();
+
+	std::lock_guard lock(mMutex);
+	mTasks = {};
+	mWaiting = {};
+	mActive = 0;
+	mIdleThreads = 0;
+}
+
+void HandshakeExecutor::admit(admission func) {
+	std::lock_guard lock(mMutex);
+	mWaiting.push(std::move(func));
+	admitWaiting();
+
+	if (!mWaiting.empty()) {
+		PLOG_DEBUG << "Too many TLS handshakes in progress, " << mWaiting.size() << " waiting";
+	}
+}
+
+void HandshakeExecutor::release(clock::duration duration, bool success) {
+	std::lock_guard lock(mMutex);
+	if (mActive > 0)
+		--mActive;
+
+	if (success)
+		++mCompleted;
+	else
+		++mFailed;
+
+	mTotalDuration += duration;
+	mMaxDuration = std::max(mMaxDuration, duration);
+
+	admitWaiting();
+}
+
+void HandshakeExecutor::enqueue(std::function<void()> func) {
+	std::lock_guard lock(mMutex);
+	mTasks.push(std::move(func));
+	notify();
+}
+
+void HandshakeExecutor::setMaxConcurrent(size_t count) {
+	std::lock_guard lock(mMutex);
+	mMaxConcurrent = count;
+	admitWaiting();
+}
+
+HandshakeStats HandshakeExecutor::stats() {
+	std::lock_guard lock(mMutex);
+	HandshakeStats s;
+	s.active = mActive;
+	s.queued = mWaiting.size();
+	s.completed = mCompleted;
+	s.failed = mFailed;
+	if (size_t count = mCompleted + mFailed; count > 0)
+		s.averageDuration = duration_cast<milliseconds>(mTotalDuration / count);
+
+	s.maxDuration = duration_cast<milliseconds>(mMaxDuration);
+	return s;
+}
+
+void HandshakeExecutor::run() {
+	utils::this_thread::set_name("handshake");
+
+	std::unique_lock lock(mMutex);
+	bool idle = true; // counted as idle when spawned
+	while (true) {
+		if (!std::exchange(idle, true))
+			++mIdleThreads;
+
+		mCondition.wait(lock, [this]() { return mStopped || !mTasks.empty(); });
+		if (mStopped)
+			break;
+
+		--mIdleThreads;
+		idle = false;
+
+		auto func = std::move(mTasks.front());
+		mTasks.pop();
+
+		lock.unlock();
+		try {
+			func();
+		} catch (const std::exception &e) {
+			PLOG_WARNING << e.what();
+		}
+		lock.lock();
+	}
+}
+
+void HandshakeExecutor::runOne() {
+	std::unique_lock lock(mMutex);
+	if (mStopped || mTasks.empty())
+		return;
+
+	auto func = std::move(mTasks.front());
+	mTasks.pop();
+
+	lock.unlock();
+	try {
+		func();
+	} catch (const std::exception &e) {
+		PLOG_WARNING << e.what();
+	}
+}
+
+void HandshakeExecutor::admitWaiting() {
+	// mMutex must be locked
+	while (!mWaiting.empty() && (mMaxConcurrent == 0 || mActive < mMaxConcurrent)) {
+		++mActive;
+		mTasks.push([this, func = std::move(mWaiting.front())]() {
+			if (!func()) {
+				// Abandoned while waiting, give the slot to the next one
+				std::lock_guard lock(mMutex);
+				if (mActive > 0)
+					--mActive;
+
+				admitWaiting();
+			}
+		});
+		mWaiting.pop();
+		notify();
+	}
+}
+
+void HandshakeExecutor::notify() {
+	// mMutex must be locked
+	if (mMaxThreads == 0) {
+		// No dedicated threads, for instance when the application runs the loop
+		ThreadPool::Instance().post([this]() { runOne(); });
+		return;
+	}
+
+	if (!mStopped && mIdleThreads == 0 && mThreads.size() < mMaxThreads) {
+		mThreads.emplace_back(std::bind(&HandshakeExecutor::run, this));
+		++mIdleThreads; // until it picks a task
+	} else {
+		mCondition.notify_one();
+	}
+}
+
+} // namespace wsc::impl
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_IMPL_HANDSHAKE_EXECUTOR_H
+#define WEBSOCKET_IMPL_HANDSHAKE_EXECUTOR_H
+
+#include "common.hpp"
+#include "global.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace wsc::impl {
+
+// TLS handshakes on dedicated threads, so a reconnect storm does not delay processing for
+// established connections, with a bound on concurrent handshakes and a FIFO for the others
+class HandshakeExecutor final {
+public:
+	using clock = std::chrono::steady_clock;
+	using admission = std::function<bool()>; // returns false if the handshake was abandoned
+
+	static HandshakeExecutor &Instance();
+
+	HandshakeExecutor(const HandshakeExecutor &) = delete;
+	HandshakeExecutor &operator=(const HandshakeExecutor &) = delete;
+	HandshakeExecutor(HandshakeExecutor &&) = delete;
+	HandshakeExecutor &operator=(HandshakeExecutor &&) = delete;
+
+	void start(int count = 1); // max threads, spawned on demand, zero to run on the thread pool
+	void join();
+
+	// Run func on the handshake threads once a slot is free, the slot is held until release()
+	void admit(admission func);
+	void release(clock::duration duration, bool success);
+
+	// Run handshake processing on the handshake threads
+	void enqueue(std::function<void()> func);
+
+	void setMaxConcurrent(size_t count); // zero for unlimited
+	HandshakeStats stats();
+
+private:
+	HandshakeExecutor();
+	~HandshakeExecutor();
+
+	void run();
+	void runOne();
+	void admitWaiting(); // mMutex must be locked
+	void notify();       // mMutex must be locked
+
+	std::queue<std::function<void()>> mTasks;
+	std::queue<admission> mWaiting;
+	size_t mMaxConcurrent;
+	size_t mActive = 0;
+
+	size_t mCompleted = 0;
+	size_t mFailed = 0;
+	clock::duration mTotalDuration = clock::duration::zero();
+	clock::duration mMaxDuration = clock::duration::zero();
+
+	std::vector<std::thread> mThreads;
+	size_t mMaxThreads = 0;
+	size_t mIdleThreads = 0;
+	std::condition_variable mCondition;
+	std::mutex mMutex;
+	bool mStopped = true;
+};
+
+} // namespace wsc::impl
+
+#endif
@@ -8,9 +8,13 @@
 
 #include "init.hpp"
 #include "certificate.hpp"
+#include "connectionpool.hpp"
+#include "handshakeexecutor.hpp"
 #include "internals.hpp"
 #include "pollservice.hpp"
+#include "resolver.hpp"
 #include "threadpool.hpp"
+#include "tlssessioncache.hpp"
 #include "tls.hpp"
 #include "utils.hpp"
 
@@ -20,6 +24,7 @@
 #include <winsock2.h>
 #endif
 
+#include <algorithm>
 #include <thread>
 
 namespace wsc::impl {
@@ -34,7 +39,7 @@ struct Init::TokenPayload {
 	~TokenPayload() {
 		std::thread t(
 		    [](std::promise<void> promise) {
-			    utils::this_thread::set_name("wsc cleanup");
+			    utils::this_thread::set_name("cleanup");
 			    try {
 				    Init::Instance().doCleanup();
 				    promise.set_value();
@@ -82,6 +87,8 @@ void Init::preload() {
 }
 
 std::shared_future<void> Init::cleanup() {
+	ConnectionPool::Instance().clear(); // pooled transports hold tokens
+
 	std::lock_guard lock(mMutex);
 	mGlobal.reset();
 	return mCleanupFuture;
@@ -95,6 +102,11 @@ void Init::setSctpSettings(SctpSettings s) {
 	mCurrentSctpSettings = std::move(s); // store for next init
 }
 
+void Init::setThreadingSettings(ThreadingSettings s) {
+	std::lock_guard lock(mMutex);
+	mThreadingSettings = std::move(s); // store for next init
+}
+
 void Init::doInit() {
 	// mMutex needs to be locked
 
@@ -109,12 +121,41 @@ void Init::doInit() {
 		throw std::runtime_error("WSAStartup failed, error=" + std::to_string(WSAGetLastError()));
 #endif
 
-	int concurrency = std::thread::hardware_concurrency();
-	int count = std::max(concurrency, MIN_THREADPOOL_SIZE);
-	PLOG_DEBUG << "Spawning " << count << " threads";
-	ThreadPool::Instance().spawn(count);
-
-	PollService::Instance().start();
+	const auto &settings = mThreadingSettings;
+	utils::this_thread::set_name_prefix(settings.threadNamePrefix.value_or("wsc"));
+
+	if (settings.externalEventLoop.value_or(false)) {
+		// No threads for I/O and tasks, the application runs the loop with Poll(), internal locks
+		// are kept as the API may still be called from other threads
+		PLOG_DEBUG << "Using an external event loop";
+		ThreadPool::Instance().setLimits(0, 0, ThreadPool::clock::duration::zero());
+		ThreadPool::Instance().setNotifier([]() { PollService::Instance().interrupt(); });
+		ThreadPool::Instance().spawn(0);
+
+		PollService::Instance().start(0);
+		Resolver::Instance().start(RESOLVER_THREADPOOL_SIZE, true); // getaddrinfo() blocks
+		HandshakeExecutor::Instance().start(0);
+
+	} else {
+		// Workers are spawned on demand while all are busy, and exit when idle again
+		int concurrency = settings.respectCpuQuota.value_or(true)
+		                      ? utils::available_concurrency()
+		                      : int(std::thread::hardware_concurrency());
+		int defaultMaxCount = std::max(concurrency, MIN_THREADPOOL_SIZE);
+		int maxCount = std::max(settings.maxWorkers.value_or(defaultMaxCount), 2); // tasks may wait
+		int minCount = std::clamp(settings.minWorkers.value_or(1), 1, maxCount);
+		auto idleTimeout = settings.workerIdleTimeout.value_or(THREADPOOL_IDLE_TIMEOUT);
+		PLOG_DEBUG << "Spawning " << minCount << " threads, up to " << maxCount;
+		ThreadPool::Instance().setLimits(minCount, maxCount, idleTimeout);
+		ThreadPool::Instance().setThreadOptions({settings.workerCpus, settings.workerPriority});
+		ThreadPool::Instance().setNotifier(nullptr);
+		ThreadPool::Instance().spawn(minCount);
+
+		PollService::Instance().start(std::max(settings.reactorCount.value_or(1), 1),
+		                              {settings.reactorCpus, settings.reactorPriority});
+		Resolver::Instance().start(RESOLVER_THREADPOOL_SIZE);
+		HandshakeExecutor::Instance().start(HANDSHAKE_THREADPOOL_SIZE);
+	}
 
 #if USE_GNUTLS
 	// Nothing to do
@@ -140,7 +181,10 @@ void Init::doCleanup() {
 	ThreadPool::Instance().join();
 	ThreadPool::Instance().clear();
 	PollService::Instance().join();
+	Resolver::Instance().join();
+	HandshakeExecutor::Instance().join();
 
+	TlsSessionCache::Instance().flush(); // pending scheduled saves were cleared
 	TlsTransport::Cleanup();
 
 #ifdef _WIN32
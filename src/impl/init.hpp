@@ -10,7 +10,7 @@
 #define WEBSOCKET_CLIEN_IMPL_INIT_H
 
 #include "common.hpp"
-#include "global.hpp" // for SctpSettings
+#include "global.hpp" // for SctpSettings and ThreadingSettings
 
 #include <chrono>
 #include <future>
@@ -33,6 +33,7 @@ public:
 	void preload();
 	std::shared_future<void> cleanup();
 	void setSctpSettings(SctpSettings s);
+	void setThreadingSettings(ThreadingSettings s);
 
 private:
 	Init();
@@ -45,6 +46,7 @@ private:
 	weak_ptr<void> mWeak;
 	bool mInitialized = false;
 	SctpSettings mCurrentSctpSettings = {};
+	ThreadingSettings mThreadingSettings = {};
 	std::mutex mMutex;
 	std::shared_future<void> mCleanupFuture;
 
@@ -11,6 +11,8 @@
 
 #include "common.hpp"
 
+#include <chrono>
+
 // Disable warnings before including plog
 #if defined(__GNUC__) || defined(__clang__)
 #pragma GCC diagnostic push
@@ -45,7 +47,47 @@ const size_t DEFAULT_WS_MAX_MESSAGE_SIZE = 256 * 1024; // Default max message si
 
 const size_t RECV_QUEUE_LIMIT = 1024; // Max per-channel queue size (messages)
 
-const int MIN_THREADPOOL_SIZE = 4; // Minimum number of threads in the global thread pool (>= 2)
+const size_t FILE_SEND_FRAGMENT_SIZE = 64 * 1024; // Max payload size of file fragments
+const size_t FILE_SEND_BUFFER_HIGH = 1024 * 1024; // Pause sending a file above this buffered amount
+const size_t FILE_SEND_BUFFER_LOW = 256 * 1024;   // Resume sending a file below this amount
+
+const size_t DEFAULT_READ_BUDGET = 256 * 1024; // Max bytes read from a socket per poll wakeup
+const size_t DEFAULT_READ_MESSAGE_BUDGET = 64; // Max reads from a socket per poll wakeup
+
+const auto CONNECTION_ATTEMPT_DELAY = std::chrono::milliseconds(250); // RFC 8305 recommends 250ms
+const auto CONNECTION_ATTEMPT_TIMEOUT = std::chrono::seconds(10);       // Timeout per address
+const auto CONNECTION_FAMILY_TTL = std::chrono::minutes(10); // Lifetime of a race winner family
+const size_t CONNECTION_FAMILY_MAX_ENTRIES = 256;            // Max hosts with a winner family
+
+const auto RESOLVER_CACHE_TTL = std::chrono::seconds(60);         // TTL for successful resolutions
+const auto RESOLVER_NEGATIVE_CACHE_TTL = std::chrono::seconds(5); // TTL for failed resolutions
+const size_t RESOLVER_CACHE_MAX_ENTRIES = 256; // Least recently used entries are evicted above
+const int RESOLVER_THREADPOOL_SIZE = 2; // Number of threads dedicated to name resolution
+
+const auto POOL_HEALTH_CHECK_INTERVAL = std::chrono::seconds(5); // Pooled connections check period
+const auto POOL_IDLE_TIMEOUT = std::chrono::seconds(60);          // Max idle time in the pool
+const auto POOL_CONNECTION_TIMEOUT = std::chrono::seconds(30);    // Max time to establish
+
+const auto TLS_CACHE_TTL = std::chrono::minutes(60); // Reuse time of TLS contexts and CA chains
+
+const size_t TLS_SESSION_CACHE_MAX_PER_KEY = 4;              // Max cached sessions per server
+const size_t TLS_SESSION_CACHE_MAX_KEYS = 1024;              // Max servers with cached sessions
+const auto TLS_SESSION_LIFETIME = std::chrono::hours(2);     // Session lifetime if not given by TLS
+const auto TLS_SESSION_SAVE_DELAY = std::chrono::seconds(1); // Delay to batch session file writes
+
+const size_t TLS_MAX_RECORD_SIZE = 16384;                   // Max TLS record payload size
+const size_t TLS_SMALL_RECORD_SIZE = 1369;                  // Record payload fitting in a segment
+const size_t TLS_SMALL_RECORDS_BYTES = 64 * 1024;           // Sent in small records per burst
+const auto TLS_RECORD_IDLE_RESET = std::chrono::seconds(1); // Idle time ending a burst
+const size_t TLS_COALESCED_WRITE_SIZE = 16384;              // Records coalesced per TCP write
+
+const int HANDSHAKE_THREADPOOL_SIZE = 2;     // Number of threads dedicated to TLS handshakes
+const size_t HANDSHAKE_MAX_CONCURRENT = 64; // Max TLS handshakes in progress, others wait
+
+const int MIN_THREADPOOL_SIZE = 4; // Minimum default limit for the global thread pool (>= 2)
+const auto THREADPOOL_IDLE_TIMEOUT = std::chrono::seconds(10); // Before extra workers exit
+
+const size_t STRAND_BATCH_BUDGET = 16; // Max tasks run by a strand before yielding to the pool
 
 const size_t DEFAULT_MTU = WSC_DEFAULT_MTU; // defined in websocketclient.h
 
@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "mappedfile.hpp"
+#include "internals.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <limits>
+#include <stdexcept>
+
+namespace wsc::impl {
+
+using std::to_string;
+
+namespace {
+
+size_t checked_length(const string &path, uint64_t fileSize, size_t offset,
+                      optional<size_t> length) {
+	if (offset > fileSize)
+		throw std::out_of_range("Offset is beyond the end of file \"" + path + "\"");
+
+	const uint64_t available = fileSize - offset;
+	if (length && *length > available)
+		throw std::out_of_range("Length is beyond the end of file \"" + path + "\"");
+
+	const uint64_t result = length ? *length : available;
+	if (result > std::numeric_limits<size_t>::max())
+		throw std::runtime_error("File \"" + path + "\" is too large to be mapped");
+
+	return size_t(result);
+}
+
+} // namespace
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const string &path, size_t offset, optional<size_t> length) {
+	HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+	                            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Failed to open file \"" + path +
+		                         "\", error=" + to_string(::GetLastError()));
+
+	scope_guard fileGuard([file]() { ::CloseHandle(file); });
+
+	LARGE_INTEGER fileSize;
+	if (!::GetFileSizeEx(file, &fileSize))
+		throw std::runtime_error("Failed to get size of file \"" + path + "\"");
+
+	mSize = checked_length(path, uint64_t(fileSize.QuadPart), offset, length);
+	if (mSize == 0)
+		return;
+
+	// The view offset must be aligned on the allocation granularity
+	SYSTEM_INFO info;
+	::GetSystemInfo(&info);
+	const uint64_t granularity = info.dwAllocationGranularity;
+	const uint64_t start = uint64_t(offset) - uint64_t(offset) % granularity;
+	const size_t delta = size_t(offset - start);
+
+	HANDLE mapping = ::CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+		throw std::runtime_error("Failed to map file \"" + path +
+		                         "\", error=" + to_string(::GetLastError()));
+
+	scope_guard mappingGuard([mapping]() { ::CloseHandle(mapping); });
+
+	mMappedSize = mSize + delta;
+	mBase = ::MapViewOfFile(mapping, FILE_MAP_READ, DWORD(start >> 32), DWORD(start & 0xFFFFFFFF),
+	                        mMappedSize);
+	if (!mBase)
+		throw std::runtime_error("Failed to map view of file \"" + path +
+		                         "\", error=" + to_string(::GetLastError()));
+
+	mData = static_cast<const byte *>(mBase) + delta;
+}
+
+MappedFile::~MappedFile() {
+	if (mBase)
+		::UnmapViewOfFile(mBase);
+}
+
+#else
+
+MappedFile::MappedFile(const string &path, size_t offset, optional<size_t> length) {
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error("Failed to open file \"" + path + "\", errno=" + to_string(errno));
+
+	scope_guard fdGuard([fd]() { ::close(fd); });
+
+	struct stat st = {};
+	if (::fstat(fd, &st) < 0)
+		throw std::runtime_error("Failed to get size of file \"" + path +
+		                         "\", errno=" + to_string(errno));
+
+	mSize = checked_length(path, uint64_t(st.st_size), offset, length);
+	if (mSize == 0)
+		return;
+
+	// The mapping offset must be aligned on the page size
+	const size_t pageSize = size_t(::sysconf(_SC_PAGESIZE));
+	const size_t start = offset - offset % pageSize;
+	const size_t delta = offset - start;
+
+	mMappedSize = mSize + delta;
+	void *base = ::mmap(NULL, mMappedSize, PROT_READ, MAP_PRIVATE, fd, off_t(start));
+	if (base == MAP_FAILED)
+		throw std::runtime_error("Failed to map file \"" + path + "\", errno=" + to_string(errno));
+
+	mBase = base;
+	mData = static_cast<const byte *>(mBase) + delta;
+
+#ifdef POSIX_MADV_SEQUENTIAL
+	::posix_madvise(mBase, mMappedSize, POSIX_MADV_SEQUENTIAL);
+#endif
+}
+
+MappedFile::~MappedFile() {
+	if (mBase)
+		::munmap(mBase, mMappedSize);
+}
+
+#endif
+
+} // namespace wsc::impl
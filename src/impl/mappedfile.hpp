@@ -0,0 +1,37 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_IMPL_MAPPED_FILE_H
+#define WEBSOCKET_IMPL_MAPPED_FILE_H
+
+#include "common.hpp"
+
+namespace wsc::impl {
+
+// Read-only memory mapping of a file region
+class MappedFile final {
+public:
+	MappedFile(const string &path, size_t offset = 0, optional<size_t> length = nullopt);
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	const byte *data() const { return mData; }
+	size_t size() const { return mSize; }
+
+private:
+	void *mBase = nullptr; // start of the mapping, aligned down from data
+	size_t mMappedSize = 0;
+	const byte *mData = nullptr;
+	size_t mSize = 0;
+};
+
+} // namespace wsc::impl
+
+#endif
@@ -8,12 +8,17 @@
 
 #include "pollservice.hpp"
 #include "internals.hpp"
+#include "threadpool.hpp"
 #include "utils.hpp"
 
 #include <algorithm>
 #include <cassert>
 #include <sstream>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 namespace wsc::impl {
 
 using namespace std::chrono_literals;
@@ -25,77 +30,268 @@ PollService &PollService::Instance() {
 	return *instance;
 }
 
+thread_local PollService::Reactor *PollService::CurrentReactor = nullptr;
+
+namespace {
+
+short poll_events(PollService::Direction direction) {
+	switch (direction) {
+	case PollService::Direction::In:
+		return POLLIN;
+	case PollService::Direction::Out:
+		return POLLOUT;
+	default:
+		return POLLIN | POLLOUT;
+	}
+}
+
+#ifdef __linux__
+void epoll_update(int epoll, int fd, short events) {
+	struct epoll_event ev = {};
+	ev.events = ((events & POLLIN) ? uint32_t(EPOLLIN) : 0u) |
+	            ((events & POLLOUT) ? uint32_t(EPOLLOUT) : 0u);
+	ev.data.fd = fd;
+	if (::epoll_ctl(epoll, EPOLL_CTL_MOD, fd, &ev) < 0 && errno == ENOENT)
+		if (::epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+			PLOG_WARNING << "epoll_ctl failed, errno=" << errno;
+}
+#endif
+
+} // namespace
+
 PollService::PollService() : mStopped(true) {}
 
 PollService::~PollService() {}
 
-void PollService::start() {
-	mSocks = std::make_unique<SocketMap>();
-	mInterrupter = std::make_unique<PollInterrupter>();
+void PollService::start(int count, utils::thread_options options) {
+	std::lock_guard lock(mMutex);
 	mStopped = false;
-	mThread = std::thread(&PollService::runLoop, this);
+	if (count <= 0) {
+		// No reactor thread, the application runs the loop
+		auto reactor = std::make_unique<Reactor>();
+#ifdef __linux__
+		reactor->epoll = ::epoll_create1(EPOLL_CLOEXEC);
+		if (reactor->epoll < 0)
+			throw std::runtime_error("epoll_create1 failed, errno=" + std::to_string(errno));
+
+		struct pollfd pfd;
+		reactor->interrupter.prepare(pfd);
+		epoll_update(reactor->epoll, pfd.fd, pfd.events);
+#endif
+		mReactors.push_back(std::move(reactor));
+		return;
+	}
+
+	for (int i = 0; i < count; ++i)
+		mReactors.push_back(std::make_unique<Reactor>());
+
+	for (auto &reactor : mReactors)
+		reactor->thread = std::thread(&PollService::runLoop, this, std::ref(*reactor), options);
 }
 
 void PollService::join() {
-	std::unique_lock lock(mMutex);
-	if (std::exchange(mStopped, true))
+	std::lock_guard lock(mMutex);
+	if (mStopped.exchange(true))
 		return;
 
-	lock.unlock();
+	for (auto &reactor : mReactors)
+		reactor->interrupter.interrupt();
+
+	std::lock_guard pollLock(mPollMutex); // the application might be polling
+	for (auto &reactor : mReactors) {
+		if (reactor->thread.joinable())
+			reactor->thread.join();
+
+		std::unique_lock reactorLock(reactor->mutex);
+		applyPending(*reactor); // close deferred sockets
+#ifdef __linux__
+		if (reactor->epoll >= 0)
+			::close(reactor->epoll);
+#endif
+	}
+
+	mReactors.clear();
+}
+
+int PollService::poll(optional<clock::duration> timeout) {
+	std::lock_guard pollLock(mPollMutex);
+	Reactor *reactor = external();
+	if (!reactor) {
+		if (!mStopped)
+			throw std::logic_error("Poll service is not in external mode");
+
+		return 0;
+	}
+
+	auto &pool = ThreadPool::Instance();
+	bool attached = pool.attach(); // so tasks posted by callbacks are queued locally
+	Reactor *previous = std::exchange(CurrentReactor, reactor);
+	scope_guard guard([&]() {
+		CurrentReactor = previous;
+		if (attached)
+			pool.detach();
+	});
+
+	optional<clock::time_point> next;
+	prepare(*reactor, reactor->pfds, next);
+	for (auto deadline :
+	     {pool.nextDeadline(), timeout ? std::make_optional(clock::now() + *timeout) : nullopt})
+		if (deadline)
+			next = next ? std::min(*next, *deadline) : *deadline;
+
+	int count = 0;
+	if (wait(reactor->pfds, next))
+		count += process(*reactor, reactor->pfds);
+
+	count += pool.runPending();
+	return count;
+}
+
+optional<PollService::clock::time_point> PollService::nextDeadline() {
+	std::lock_guard pollLock(mPollMutex);
+	Reactor *reactor = external();
+	if (!reactor)
+		return nullopt;
+
+	auto next = ThreadPool::Instance().nextDeadline();
+	std::unique_lock lock(reactor->mutex);
+	applyPending(*reactor);
+	for (const auto &[sock, entry] : reactor->socks)
+		if (entry.until)
+			next = next ? std::min(*next, *entry.until) : *entry.until;
+
+	return next;
+}
+
+int PollService::descriptor() {
+#ifdef __linux__
+	std::lock_guard pollLock(mPollMutex);
+	Reactor *reactor = external();
+	return reactor ? reactor->epoll : -1;
+#else
+	return -1;
+#endif
+}
+
+void PollService::interrupt() {
+	std::lock_guard lock(mMutex);
+	for (auto &reactor : mReactors)
+		reactor->interrupter.interrupt();
+}
 
-	mInterrupter->interrupt();
-	mThread.join();
+PollService::Reactor *PollService::external() {
+	// mPollMutex must be locked
+	if (mStopped || mReactors.size() != 1 || mReactors.front()->thread.joinable())
+		return nullptr;
 
-	mSocks.reset();
-	mInterrupter.reset();
+	return mReactors.front().get();
 }
 
 void PollService::add(socket_t sock, Params params) {
 	assert(sock != INVALID_SOCKET);
 	assert(params.callback);
 
-	std::unique_lock lock(mMutex);
 	PLOG_VERBOSE << "Registering socket in poll service, direction=" << params.direction;
-	auto until = params.timeout ? std::make_optional(clock::now() + *params.timeout) : nullopt;
-	assert(mSocks);
-	mSocks->insert_or_assign(sock, SocketEntry{std::move(params), std::move(until)});
-
-	assert(mInterrupter);
-	mInterrupter->interrupt();
+	update(reactor(sock), Change{sock, std::move(params)});
 }
 
 void PollService::remove(socket_t sock) {
 	assert(sock != INVALID_SOCKET);
 
-	std::unique_lock lock(mMutex);
 	PLOG_VERBOSE << "Unregistering socket in poll service";
-	assert(mSocks);
-	mSocks->erase(sock);
+	update(reactor(sock), Change{sock, nullopt});
+}
+
+void PollService::close(socket_t sock) {
+	assert(sock != INVALID_SOCKET);
+
+	PLOG_VERBOSE << "Unregistering and closing socket in poll service";
+	update(reactor(sock), Change{sock, nullopt, true});
+}
+
+PollService::Reactor &PollService::reactor(socket_t sock) {
+	assert(!mReactors.empty());
+#ifdef _WIN32
+	size_t index = size_t(sock) >> 2; // socket handles are multiples of 4
+#else
+	size_t index = size_t(sock);
+#endif
+	return *mReactors[index % mReactors.size()];
+}
+
+void PollService::update(Reactor &reactor, Change change) {
+	if (CurrentReactor != &reactor && (CurrentReactor || change.params)) {
+		// Waiting for the reactor could deadlock, as its callbacks may need a lock held by the
+		// caller, like a sender updating the direction, so defer the change. Removals still wait
+		// outside of callbacks, so no callback runs for the socket once they return. Removed from
+		// another reactor's callback, the callback may still run once, so it must hold its owner
+		// weakly, and the socket is closed by the reactor so the descriptor can't be reused before.
+		std::lock_guard lock(reactor.pendingMutex);
+		reactor.pending.push_back(std::move(change));
+	} else {
+		std::unique_lock lock(reactor.mutex);
+		applyPending(reactor); // keep changes ordered
+		apply(reactor, std::move(change));
+	}
+
+	if (CurrentReactor != &reactor) // otherwise it prepares again before waiting
+		reactor.interrupter.interrupt();
+}
+
+void PollService::applyPending(Reactor &reactor) {
+	// reactor.mutex must be locked
+	std::vector<Change> pending;
+	{
+		std::lock_guard lock(reactor.pendingMutex);
+		if (reactor.pending.empty())
+			return;
+
+		std::swap(pending, reactor.pending);
+	}
+
+	for (auto &change : pending)
+		apply(reactor, std::move(change));
+}
+
+void PollService::apply(Reactor &reactor, Change change) {
+	// reactor.mutex must be locked
+	auto &[sock, params, closeSocket] = change;
+	if (params) {
+#ifdef __linux__
+		if (reactor.epoll >= 0)
+			epoll_update(reactor.epoll, sock, poll_events(params->direction));
+#endif
+		auto until =
+		    params->timeout ? std::make_optional(clock::now() + *params->timeout) : nullopt;
+		reactor.socks.insert_or_assign(sock, SocketEntry{std::move(*params), std::move(until)});
+	} else {
+		erase(reactor, sock);
+		if (closeSocket)
+			::closesocket(sock);
+	}
+}
 
-	assert(mInterrupter);
-	mInterrupter->interrupt();
+void PollService::erase(Reactor &reactor, socket_t sock) {
+	// reactor.mutex must be locked
+#ifdef __linux__
+	if (reactor.epoll >= 0)
+		::epoll_ctl(reactor.epoll, EPOLL_CTL_DEL, sock, nullptr); // may be closed already
+#endif
+	reactor.socks.erase(sock);
 }
 
-void PollService::prepare(std::vector<struct pollfd> &pfds, optional<clock::time_point> &next) {
-	std::unique_lock lock(mMutex);
-	pfds.resize(1 + mSocks->size());
+void PollService::prepare(Reactor &reactor, std::vector<struct pollfd> &pfds,
+                          optional<clock::time_point> &next) {
+	std::unique_lock lock(reactor.mutex);
+	applyPending(reactor);
+	pfds.resize(1 + reactor.socks.size());
 	next.reset();
 
 	auto it = pfds.begin();
-	mInterrupter->prepare(*it++);
-	for (const auto &[sock, entry] : *mSocks) {
+	reactor.interrupter.prepare(*it++);
+	for (const auto &[sock, entry] : reactor.socks) {
 		it->fd = sock;
-		switch (entry.params.direction) {
-		case Direction::In:
-			it->events = POLLIN;
-			break;
-		case Direction::Out:
-			it->events = POLLOUT;
-			break;
-		default:
-			it->events = POLLIN | POLLOUT;
-			break;
-		}
+		it->events = poll_events(entry.params.direction);
 		if (entry.until)
 			next = next ? std::min(*next, *entry.until) : *entry.until;
 
@@ -103,16 +299,19 @@ void PollService::prepare(std::vector<struct pollfd> &pfds, optional<clock::time
 	}
 }
 
-void PollService::process(std::vector<struct pollfd> &pfds) {
-	std::unique_lock lock(mMutex);
+int PollService::process(Reactor &reactor, std::vector<struct pollfd> &pfds) {
+	std::unique_lock lock(reactor.mutex);
+	int count = 0;
+	applyPending(reactor);
+	auto &socks = reactor.socks;
 	auto it = pfds.begin();
 	if (it != pfds.end()) {
-		mInterrupter->process(*it++);
+		reactor.interrupter.process(*it++);
 	}
 	while (it != pfds.end()) {
 		socket_t sock = it->fd;
-		auto jt = mSocks->find(sock);
-		if (jt != mSocks->end()) {
+		auto jt = socks.find(sock);
+		if (jt != socks.end()) {
 			try {
 				auto &entry = jt->second;
 				const auto &params = entry.params;
@@ -122,8 +321,9 @@ void PollService::process(std::vector<struct pollfd> &pfds) {
 				     !(it->events & POLLIN))) { // MacOS sets POLLHUP on connection failure
 					PLOG_VERBOSE << "Poll error event";
 					auto callback = std::move(params.callback);
-					mSocks->erase(sock);
+					erase(reactor, sock);
 					callback(Event::Error);
+					++count;
 
 				} else if (it->revents & POLLIN || it->revents & POLLOUT || it->revents & POLLHUP) {
 					entry.until = params.timeout
@@ -140,63 +340,72 @@ void PollService::process(std::vector<struct pollfd> &pfds) {
 						PLOG_VERBOSE << "Poll out event";
 						callback(Event::Out);
 					}
+					++count;
 
 				} else if (entry.until && clock::now() >= *entry.until) {
 					PLOG_VERBOSE << "Poll timeout event";
 					auto callback = std::move(params.callback);
-					mSocks->erase(sock);
+					erase(reactor, sock);
 					callback(Event::Timeout);
+					++count;
 				}
 
 			} catch (const std::exception &e) {
 				PLOG_WARNING << e.what();
-				mSocks->erase(sock);
+				erase(reactor, sock);
 			}
 		}
 
 		++it;
 	}
-}
 
-void PollService::runLoop() {
-	utils::this_thread::set_name("wsc poll");
-	PLOG_DEBUG << "Poll service started";
+	return count;
+}
 
-	try {
-		assert(mSocks);
-		std::vector<struct pollfd> pfds;
-		optional<clock::time_point> next;
-		while (!mStopped) {
-			prepare(pfds, next);
-
-			int ret;
-			do {
-				int timeout;
-				if (next) {
-					auto msecs = duration_cast<milliseconds>(
-					    std::max(clock::duration::zero(), *next - clock::now() + 1ms));
-					PLOG_VERBOSE << "Entering poll, timeout=" << msecs.count() << "ms";
-					timeout = static_cast<int>(msecs.count());
-				} else {
-					PLOG_VERBOSE << "Entering poll";
-					timeout = -1;
-				}
+bool PollService::wait(std::vector<struct pollfd> &pfds, optional<clock::time_point> until) {
+	int ret;
+	do {
+		int timeout;
+		if (until) {
+			// Round up so the timeouts have expired on wakeup
+			auto msecs = std::chrono::ceil<milliseconds>(
+			    std::max(clock::duration::zero(), *until - clock::now()));
+			PLOG_VERBOSE << "Entering poll, timeout=" << msecs.count() << "ms";
+			timeout = static_cast<int>(msecs.count());
+		} else {
+			PLOG_VERBOSE << "Entering poll";
+			timeout = -1;
+		}
 
-				ret = ::poll(pfds.data(), static_cast<nfds_t>(pfds.size()), timeout);
+		ret = ::poll(pfds.data(), static_cast<nfds_t>(pfds.size()), timeout);
 
-				PLOG_VERBOSE << "Exiting poll";
+		PLOG_VERBOSE << "Exiting poll";
 
-			} while (ret < 0 && (sockerrno == SEINTR || sockerrno == SEAGAIN));
+	} while (ret < 0 && (sockerrno == SEINTR || sockerrno == SEAGAIN));
 
-			if (ret < 0) {
+	if (ret < 0) {
 #ifdef _WIN32
-				if (sockerrno == WSAENOTSOCK)
-					continue; // prepare again as the fd has been removed
+		if (sockerrno == WSAENOTSOCK)
+			return false; // prepare again as the fd has been removed
 #endif
-				throw std::runtime_error("poll failed, errno=" + std::to_string(sockerrno));
-			}
+		throw std::runtime_error("poll failed, errno=" + std::to_string(sockerrno));
+	}
+
+	return true;
+}
 
-			process(pfds);
+void PollService::runLoop(Reactor &reactor, utils::thread_options options) {
+	utils::this_thread::set_name("poll");
+	utils::this_thread::apply(options);
+	CurrentReactor = &reactor;
+	PLOG_DEBUG << "Poll service started";
+
+	try {
+		optional<clock::time_point> next;
+		while (!mStopped) {
+			prepare(reactor, reactor.pfds, next);
+			if (wait(reactor.pfds, next))
+				process(reactor, reactor.pfds);
 		}
 	} catch (const std::exception &e) {
 		PLOG_FATAL << "Poll service failed: " << e.what();
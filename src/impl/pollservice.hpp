@@ -13,7 +13,9 @@
 #include "internals.hpp"
 #include "pollinterrupter.hpp"
 #include "socket.hpp"
+#include "utils.hpp"
 
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <mutex>
@@ -34,9 +36,15 @@ public:
 	PollService(PollService &&) = delete;
 	PollService &operator=(PollService &&) = delete;
 
-	void start();
+	void start(int count = 1, utils::thread_options options = {}); // count reactor threads
 	void join();
 
+	// With zero reactor threads, the application runs the loop by calling poll()
+	int poll(optional<clock::duration> timeout); // returns the number of events and tasks run
+	optional<clock::time_point> nextDeadline();  // when poll() must be called at the latest
+	int descriptor();                            // readable when poll() must be called, or -1
+	void interrupt();
+
 	enum class Direction { Both, In, Out };
 	enum class Event { None, Error, Timeout, In, Out };
 
@@ -47,28 +55,64 @@ public:
 	};
 
 	void add(socket_t sock, Params params);
-	void remove(socket_t sock);
+	void remove(socket_t sock); // the callback may still run once if called from another reactor
+
+	// Removes and closes the socket. Called from another reactor, the socket is only closed once
+	// its reactor has applied the removal, so the callback never runs on a reused descriptor.
+	void close(socket_t sock);
 
 private:
 	PollService();
 	~PollService();
 
-	void prepare(std::vector<struct pollfd> &pfds, optional<clock::time_point> &next);
-	void process(std::vector<struct pollfd> &pfds);
-	void runLoop();
-
 	struct SocketEntry {
 		Params params;
 		optional<clock::time_point> until;
 	};
 
 	using SocketMap = std::unordered_map<socket_t, SocketEntry>;
-	unique_ptr<SocketMap> mSocks;
-	unique_ptr<PollInterrupter> mInterrupter;
 
-	std::recursive_mutex mMutex;
-	std::thread mThread;
-	bool mStopped;
+	// Addition or update if params is set, removal otherwise
+	struct Change {
+		socket_t sock;
+		optional<Params> params;
+		bool close = false; // close the socket once removed
+	};
+
+	// Sockets are spread over reactors, each polling its share on its own thread
+	struct Reactor {
+		SocketMap socks;
+		PollInterrupter interrupter;
+		std::recursive_mutex mutex;
+		std::thread thread; // not joinable in external mode
+		std::vector<struct pollfd> pfds;
+#ifdef __linux__
+		int epoll = -1; // mirrors the polled descriptors in external mode
+#endif
+
+		// Changes requested from other reactor threads, which must not wait for this one
+		std::vector<Change> pending;
+		std::mutex pendingMutex;
+	};
+
+	Reactor &reactor(socket_t sock);
+	void update(Reactor &reactor, Change change);
+	void applyPending(Reactor &reactor);         // reactor mutex locked
+	void apply(Reactor &reactor, Change change); // reactor mutex locked
+	void erase(Reactor &reactor, socket_t sock); // reactor mutex locked
+	void prepare(Reactor &reactor, std::vector<struct pollfd> &pfds,
+	             optional<clock::time_point> &next);
+	bool wait(std::vector<struct pollfd> &pfds, optional<clock::time_point> until);
+	int process(Reactor &reactor, std::vector<struct pollfd> &pfds);
+	Reactor *external(); // the reactor if running in external mode, mPollMutex must be locked
+	void runLoop(Reactor &reactor, utils::thread_options options);
+
+	static thread_local Reactor *CurrentReactor; // null if not a reactor thread
+
+	std::vector<unique_ptr<Reactor>> mReactors;
+	std::atomic<bool> mStopped;
+	std::mutex mMutex;
+	std::mutex mPollMutex; // held by the application thread while polling in external mode
 };
 
 std::ostream &operator<<(std::ostream &out, PollService::Direction direction);
@@ -0,0 +1,279 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "resolver.hpp"
+#include "internals.hpp"
+#include "threadpool.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+
+namespace wsc::impl {
+
+namespace {
+
+string make_key(const string &hostname, const string &service) {
+	return hostname + ':' + service;
+}
+
+bool append_addresses(const string &node, const string &service, int flags,
+                      Resolver::address_list &result) {
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = flags;
+
+	struct addrinfo *ai = nullptr;
+	if (getaddrinfo(node.c_str(), service.c_str(), &hints, &ai))
+		return false;
+
+	for (auto *it = ai; it; it = it->ai_next) {
+		struct sockaddr_storage addr;
+		std::memcpy(&addr, it->ai_addr, it->ai_addrlen);
+		result.emplace_back(addr, socklen_t(it->ai_addrlen));
+	}
+
+	freeaddrinfo(ai);
+	return true;
+}
+
+} // namespace
+
+Resolver &Resolver::Instance() {
+	static Resolver *instance = new Resolver;
+	return *instance;
+}
+
+Resolver::Resolver() {}
+
+Resolver::~Resolver() {}
+
+void Resolver::start(int count, bool postCallbacks) {
+	std::lock_guard lock(mMutex);
+	mStopped = false;
+	mPostCallbacks = postCallbacks;
+	mMaxThreads = size_t(std::max(count, 1)); // threads are spawned on demand
+}
+
+void Resolver::join() {
+	{
+		std::lock_guard lock(mMutex);
+		mStopped = true;
+		mCondition.notify_all();
+	}
+
+	for (auto &t : mThreads)
+		t.join();
+
+	mThreads.clear();
+
+	decltype(mPending) pending;
+	{
+		std::lock_guard lock(mMutex);
+		mRequests = {};
+		pending = std::move(mPending);
+		mPending.clear();
+		mIdleThreads = 0;
+		mCache.clear();
+		mLru.clear();
+	}
+
+	// Requests still queued are failed
+	for (auto &[key, callbacks] : pending) {
+		for (auto &cb : callbacks) {
+			try {
+				cb(nullopt);
+			} catch (const std::exception &e) {
+				PLOG_WARNING << e.what();
+			}
+		}
+	}
+}
+
+void Resolver::resolve(const string &hostname, const string &service, callback cb) {
+	const string key = make_key(hostname, service);
+	std::unique_lock lock(mMutex);
+
+	if (mStopped) {
+		lock.unlock();
+		PLOG_WARNING << "Resolver is stopped, failing resolution for " << key;
+		cb(nullopt);
+		return;
+	}
+
+	if (auto it = mCache.find(key); it != mCache.end()) {
+		if (clock::now() < it->second.until) {
+			PLOG_VERBOSE << "Resolution cache hit for " << key;
+			mLru.splice(mLru.begin(), mLru, it->second.lru);
+			// Posted so the callback never runs within the caller
+			ThreadPool::Instance().post([cb = std::move(cb), result = it->second.result]() {
+				try {
+					cb(result);
+				} catch (const std::exception &e) {
+					PLOG_WARNING << e.what();
+				}
+			});
+			return;
+		}
+		mLru.erase(it->second.lru);
+		mCache.erase(it);
+	}
+
+	auto [it, inserted] = mPending.try_emplace(key);
+	it->second.emplace_back(std::move(cb));
+	if (!inserted) {
+		PLOG_VERBOSE << "Resolution already in progress for " << key;
+		return;
+	}
+
+	mRequests.push(Request{hostname, service});
+	if (mIdleThreads == 0 && mThreads.size() < mMaxThreads) {
+		mThreads.emplace_back(std::bind(&Resolver::run, this));
+		++mIdleThreads; // until it picks a task
+	} else {
+		mCondition.notify_one();
+	}
+}
+
+void Resolver::setCacheTtl(clock::duration ttl, clock::duration negativeTtl) {
+	std::lock_guard lock(mMutex);
+	mCacheTtl = ttl;
+	mNegativeCacheTtl = negativeTtl;
+}
+
+void Resolver::setOverride(const string &hostname, std::vector<string> addresses) {
+	std::lock_guard lock(mMutex);
+	if (addresses.empty())
+		mOverrides.erase(hostname);
+	else
+		mOverrides[hostname] = std::move(addresses);
+
+	erase(hostname);
+}
+
+size_t Resolver::lookupCount() const { return mLookupCount.load(); }
+
+void Resolver::run() {
+	utils::this_thread::set_name("resolver");
+
+	std::unique_lock lock(mMutex);
+	bool idle = true; // counted as idle when spawned
+	while (true) {
+		if (!std::exchange(idle, true))
+			++mIdleThreads;
+
+		mCondition.wait(lock, [this]() { return mStopped || !mRequests.empty(); });
+		if (mStopped)
+			break;
+
+		--mIdleThreads;
+		idle = false;
+
+		Request request = std::move(mRequests.front());
+		mRequests.pop();
+		const string key = make_key(request.hostname, request.service);
+
+		lock.unlock();
+		PLOG_DEBUG << "Resolving " << key;
+		++mLookupCount;
+		auto result = lookup(request.hostname, request.service);
+		if (!result) {
+			PLOG_WARNING << "Resolution failed for \"" << key << "\"";
+		}
+		lock.lock();
+
+		store(key, result);
+
+		auto it = mPending.find(key);
+		if (it == mPending.end())
+			continue;
+
+		auto callbacks = std::move(it->second);
+		mPending.erase(it);
+
+		if (mPostCallbacks) {
+			ThreadPool::Instance().post([callbacks = std::move(callbacks), result]() {
+				for (auto &cb : callbacks) {
+					try {
+						cb(result);
+					} catch (const std::exception &e) {
+						PLOG_WARNING << e.what();
+					}
+				}
+			});
+			continue;
+		}
+
+		lock.unlock();
+		for (auto &cb : callbacks) {
+			try {
+				cb(result);
+			} catch (const std::exception &e) {
+				PLOG_WARNING << e.what();
+			}
+		}
+		lock.lock();
+	}
+}
+
+optional<Resolver::address_list> Resolver::lookup(const string &hostname,
+                                                  const string &service) {
+	address_list result;
+
+	optional<std::vector<string>> overrides;
+	{
+		std::lock_guard lock(mMutex);
+		if (auto it = mOverrides.find(hostname); it != mOverrides.end())
+			overrides = it->second;
+	}
+
+	if (overrides) {
+		for (const auto &node : *overrides)
+			if (!append_addresses(node, service, AI_NUMERICHOST | AI_NUMERICSERV, result))
+				PLOG_WARNING << "Invalid override address \"" << node << "\" for " << hostname;
+
+	} else if (!append_addresses(hostname, service, AI_ADDRCONFIG, result)) {
+		return nullopt;
+	}
+
+	return !result.empty() ? std::make_optional(std::move(result)) : nullopt;
+}
+
+void Resolver::store(const string &key, optional<address_list> result) {
+	// mMutex must be locked
+	// Expired entries are only removed on lookup or when evicted
+	if (auto it = mCache.find(key); it != mCache.end()) {
+		mLru.erase(it->second.lru);
+		mCache.erase(it);
+	}
+
+	while (mCache.size() >= RESOLVER_CACHE_MAX_ENTRIES) {
+		PLOG_VERBOSE << "Evicting " << mLru.back() << " from the resolution cache";
+		mCache.erase(mLru.back());
+		mLru.pop_back();
+	}
+
+	auto until = clock::now() + (result ? mCacheTtl : mNegativeCacheTtl);
+	mLru.push_front(key);
+	mCache.emplace(key, CacheEntry{std::move(result), until, mLru.begin()});
+}
+
+void Resolver::erase(const string &hostname) {
+	// mMutex must be locked
+	for (auto it = mCache.begin(); it != mCache.end();) {
+		if (it->first.compare(0, it->first.rfind(':'), hostname) == 0) {
+			mLru.erase(it->second.lru);
+			it = mCache.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+} // namespace wsc::impl
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_IMPL_RESOLVER_H
+#define WEBSOCKET_IMPL_RESOLVER_H
+
+#include "common.hpp"
+#include "internals.hpp"
+#include "socket.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace wsc::impl {
+
+// Asynchronous name resolution on dedicated threads, with coalescing of identical in-flight
+// requests and a bounded positive and negative cache
+class Resolver final {
+public:
+	using clock = std::chrono::steady_clock;
+	using address = std::tuple<struct sockaddr_storage, socklen_t>;
+	using address_list = std::vector<address>;
+	using callback = std::function<void(optional<address_list> result)>; // nullopt on failure
+
+	static Resolver &Instance();
+
+	Resolver(const Resolver &) = delete;
+	Resolver &operator=(const Resolver &) = delete;
+	Resolver(Resolver &&) = delete;
+	Resolver &operator=(Resolver &&) = delete;
+
+	// Max threads, spawned on demand, and whether callbacks are posted to the thread pool instead
+	// of being called on the resolver threads
+	void start(int count = 1, bool postCallbacks = false);
+	void join();
+
+	// On cache hit, the callback is posted to the thread pool. It is only called synchronously,
+	// with nullopt, if stopped.
+	void resolve(const string &hostname, const string &service, callback cb);
+
+	// Time to live for successful and failed resolutions, applied to subsequent entries
+	void setCacheTtl(clock::duration ttl, clock::duration negativeTtl);
+
+	// Static addresses for hostname, bypassing resolution, empty to remove
+	void setOverride(const string &hostname, std::vector<string> addresses);
+
+	// Number of lookups performed, excluding cache hits and coalesced requests
+	size_t lookupCount() const;
+
+private:
+	Resolver();
+	~Resolver();
+
+	void run();
+	optional<address_list> lookup(const string &hostname, const string &service);
+	void store(const string &key, optional<address_list> result);
+	void erase(const string &hostname);
+
+	struct CacheEntry {
+		optional<address_list> result;
+		clock::time_point until;
+		std::list<string>::iterator lru;
+	};
+
+	struct Request {
+		string hostname;
+		string service;
+	};
+
+	std::unordered_map<string, CacheEntry> mCache;       // key is hostname:service
+	std::list<string> mLru;                              // cache keys, most recently used first
+	std::unordered_map<string, std::vector<callback>> mPending; // key is hostname:service
+	std::unordered_map<string, std::vector<string>> mOverrides;
+	std::queue<Request> mRequests;
+
+	std::vector<std::thread> mThreads;
+	size_t mMaxThreads = 0;
+	size_t mIdleThreads = 0;
+	bool mPostCallbacks = false;
+	clock::duration mCacheTtl = RESOLVER_CACHE_TTL;
+	clock::duration mNegativeCacheTtl = RESOLVER_NEGATIVE_CACHE_TTL;
+	std::condition_variable mCondition;
+	std::mutex mMutex;
+	bool mStopped = true;
+	std::atomic<size_t> mLookupCount = 0;
+};
+
+} // namespace wsc::impl
+
+#endif
@@ -0,0 +1,173 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_IMPL_RING_QUEUE_H
+#define WEBSOCKET_IMPL_RING_QUEUE_H
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+namespace wsc::impl {
+
+// Bounded lock-free queue for a single producer and a single consumer. The roles may move between
+// threads as long as calls on each side are serialized. Each side caches the index of the other
+// to avoid touching its cache line on every call, and only a producer waiting for room locks.
+template <typename T> class RingQueue final {
+public:
+	using amount_function = size_t (*)(const T &element);
+
+	RingQueue(size_t limit, // elements
+	          amount_function func = nullptr);
+	~RingQueue();
+
+	RingQueue(const RingQueue &) = delete;
+	RingQueue &operator=(const RingQueue &) = delete;
+
+	void stop(); // any thread
+	bool running() const;
+	bool empty() const;
+	bool full() const;
+	size_t size() const;   // elements
+	size_t amount() const; // amount
+	void push(T element);  // producer, blocks while full
+	optional<T> pop();     // consumer
+	optional<T> peek();    // consumer
+
+private:
+	static constexpr size_t CacheLineSize = 64;
+
+	static size_t Capacity(size_t limit) { // power of two so indices wrap with a mask
+		size_t capacity = 1;
+		while (capacity < limit)
+			capacity <<= 1;
+		return capacity;
+	}
+
+	const size_t mLimit;
+	const size_t mMask;
+	const amount_function mAmountFunction;
+	const std::unique_ptr<T[]> mSlots;
+
+	alignas(CacheLineSize) std::atomic<size_t> mHead = 0; // written by the consumer
+	std::atomic<size_t> mPoppedAmount = 0;
+	size_t mCachedTail = 0;
+
+	alignas(CacheLineSize) std::atomic<size_t> mTail = 0; // written by the producer
+	std::atomic<size_t> mPushedAmount = 0;
+	size_t mCachedHead = 0;
+
+	alignas(CacheLineSize) std::atomic<bool> mStopping = false;
+	std::atomic<bool> mProducerWaiting = false;
+	std::condition_variable mCondition;
+	std::mutex mMutex;
+};
+
+template <typename T>
+RingQueue<T>::RingQueue(size_t limit, amount_function func)
+    : mLimit(std::max(limit, size_t(1))), mMask(Capacity(mLimit) - 1), mAmountFunction(func),
+      mSlots(new T[mMask + 1]) {}
+
+template <typename T> RingQueue<T>::~RingQueue() { stop(); }
+
+template <typename T> void RingQueue<T>::stop() {
+	mStopping = true;
+	std::lock_guard lock(mMutex);
+	mCondition.notify_all();
+}
+
+template <typename T> bool RingQueue<T>::running() const { return !empty() || !mStopping; }
+
+template <typename T> bool RingQueue<T>::empty() const { return size() == 0; }
+
+template <typename T> bool RingQueue<T>::full() const { return size() >= mLimit; }
+
+template <typename T> size_t RingQueue<T>::size() const {
+	size_t head = mHead.load(std::memory_order_acquire);
+	return mTail.load(std::memory_order_acquire) - head;
+}
+
+template <typename T> size_t RingQueue<T>::amount() const {
+	if (!mAmountFunction)
+		return size();
+
+	// Each counter has a single writer, and elements are counted as pushed before being popped
+	size_t popped = mPoppedAmount.load(std::memory_order_acquire);
+	return mPushedAmount.load(std::memory_order_acquire) - popped;
+}
+
+template <typename T> void RingQueue<T>::push(T element) {
+	const size_t tail = mTail.load(std::memory_order_relaxed);
+	if (tail - mCachedHead >= mLimit) {
+		mCachedHead = mHead.load(std::memory_order_acquire);
+		if (tail - mCachedHead >= mLimit) {
+			// The consumer checks the flag after moving the head, so one of us sees the other
+			std::unique_lock lock(mMutex);
+			mCondition.wait(lock, [&]() {
+				mProducerWaiting = true;
+				mCachedHead = mHead.load();
+				return tail - mCachedHead < mLimit || mStopping;
+			});
+			mProducerWaiting = false;
+		}
+	}
+
+	if (mStopping)
+		return;
+
+	if (mAmountFunction) {
+		size_t amount = mPushedAmount.load(std::memory_order_relaxed) + mAmountFunction(element);
+		mPushedAmount.store(amount, std::memory_order_release); // single writer
+	}
+
+	mSlots[tail & mMask] = std::move(element);
+	mTail.store(tail + 1, std::memory_order_release);
+}
+
+template <typename T> optional<T> RingQueue<T>::pop() {
+	const size_t head = mHead.load(std::memory_order_relaxed);
+	if (head == mCachedTail) {
+		mCachedTail = mTail.load(std::memory_order_acquire);
+		if (head == mCachedTail)
+			return nullopt;
+	}
+
+	optional<T> element{std::move(mSlots[head & mMask])};
+	mSlots[head & mMask] = T(); // release the element now
+	if (mAmountFunction) {
+		size_t amount = mPoppedAmount.load(std::memory_order_relaxed) + mAmountFunction(*element);
+		mPoppedAmount.store(amount, std::memory_order_release); // single writer
+	}
+
+	mHead.store(head + 1);
+	if (mProducerWaiting.load() && mProducerWaiting.exchange(false)) {
+		std::lock_guard lock(mMutex);
+		mCondition.notify_one();
+	}
+
+	return element;
+}
+
+template <typename T> optional<T> RingQueue<T>::peek() {
+	const size_t head = mHead.load(std::memory_order_relaxed);
+	if (head == mCachedTail) {
+		mCachedTail = mTail.load(std::memory_order_acquire);
+		if (head == mCachedTail)
+			return nullopt;
+	}
+
+	return std::make_optional(mSlots[head & mMask]);
+}
+
+} // namespace wsc::impl
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "strand.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace wsc::impl {
+
+Strand::Strand(size_t budget)
+    : mBudget(std::max(budget, size_t(1))), mHead(&mStub), mTail(&mStub) {}
+
+Strand::~Strand() {
+	// A scheduled run holds a reference, so tasks can only remain if the pool was cleared
+	while (Node *node = pop())
+		delete node;
+}
+
+void Strand::push(Node *node) {
+	link(node);
+
+	// Counted once linked, the producer bringing the count up from zero schedules a run
+	if (mCount.fetch_add(1, std::memory_order_acq_rel) == 0)
+		ThreadPool::Instance().post([self = shared_from_this()]() { self->run(); });
+}
+
+void Strand::link(Node *node) {
+	Node *prev = mHead.exchange(node, std::memory_order_acq_rel);
+	prev->next.store(node, std::memory_order_release);
+}
+
+Strand::Node *Strand::pop() {
+	Node *tail = mTail;
+	Node *next = tail->next.load(std::memory_order_acquire);
+	if (tail == &mStub) {
+		if (!next)
+			return nullptr;
+
+		mTail = next;
+		tail = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+
+	if (next) {
+		mTail = next;
+		return tail;
+	}
+
+	if (tail != mHead.load(std::memory_order_acquire))
+		return nullptr; // a producer is between exchanging the head and linking
+
+	// Put the stub back so the last node can be detached
+	mStub.next.store(nullptr, std::memory_order_relaxed);
+	link(&mStub);
+	next = tail->next.load(std::memory_order_acquire);
+	if (next) {
+		mTail = next;
+		return tail;
+	}
+
+	return nullptr;
+}
+
+void Strand::run() {
+	size_t count = 0;
+	while (count < mBudget) {
+		Node *node = pop();
+		if (!node) {
+			if (count == mCount.load(std::memory_order_acquire))
+				break;
+
+			// A task is counted but not reachable yet, its producer is about to link it
+			std::this_thread::yield();
+			continue;
+		}
+
+		Task task = std::move(node->task);
+		delete node;
+		++count;
+
+		try {
+			task();
+		} catch (const std::exception &e) {
+			PLOG_WARNING << e.what();
+		}
+	}
+
+	// Schedule another run for the remaining tasks, behind the other tasks in the pool
+	if (mCount.fetch_sub(count, std::memory_order_acq_rel) > count)
+		ThreadPool::Instance().post([self = shared_from_this()]() { self->run(); });
+}
+
+} // namespace wsc::impl
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_IMPL_STRAND_H
+#define WEBSOCKET_IMPL_STRAND_H
+
+#include "common.hpp"
+#include "internals.hpp"
+#include "task.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+namespace wsc::impl {
+
+// Runs tasks in order on the thread pool, one at a time. Tasks are pushed on a lock-free queue
+// and the first producer schedules a run, which processes them in batches of limited size so a
+// busy strand does not monopolize a worker.
+class Strand final : public std::enable_shared_from_this<Strand> {
+public:
+	Strand(size_t budget = STRAND_BATCH_BUDGET); // must be owned by a shared_ptr
+	~Strand();
+
+	Strand(const Strand &) = delete;
+	Strand &operator=(const Strand &) = delete;
+	Strand(Strand &&) = delete;
+	Strand &operator=(Strand &&) = delete;
+
+	template <class F, class... Args> void post(F &&f, Args &&...args) noexcept;
+
+private:
+	struct Node {
+		Task task;
+		std::atomic<Node *> next = nullptr;
+	};
+
+	void push(Node *node);
+	void link(Node *node);
+	Node *pop(); // only called by the running batch
+	void run();
+
+	const size_t mBudget;
+	std::atomic<size_t> mCount = 0; // a run is scheduled iff not zero
+
+	// Intrusive MPSC queue: producers exchange the head, the consumer owns the tail
+	Node mStub;
+	std::atomic<Node *> mHead;
+	Node *mTail;
+};
+
+template <class F, class... Args> void Strand::post(F &&f, Args &&...args) noexcept {
+	auto node = new Node;
+	if constexpr (sizeof...(Args) == 0)
+		node->task = Task(std::forward<F>(f));
+	else
+		node->task = Task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+	push(node);
+}
+
+} // namespace wsc::impl
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_IMPL_TASK_H
+#define WEBSOCKET_IMPL_TASK_H
+
+#include "common.hpp"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace wsc::impl {
+
+// Move-only replacement for std::function<void()>, callables up to InlineSize bytes are stored
+// in place so queuing a typical task (a pointer-to-member with a shared or weak pointer, or a
+// lambda with a few captures) does not allocate
+class Task final {
+public:
+	static constexpr size_t InlineSize = 6 * sizeof(void *);
+
+	Task() noexcept = default;
+	Task(std::nullptr_t) noexcept {}
+
+	template <class F, class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task> &&
+	                                            !std::is_same_v<std::decay_t<F>, std::nullptr_t>>>
+	Task(F &&f) {
+		using T = std::decay_t<F>;
+		if constexpr (IsInline<T>) {
+			new (mStorage) T(std::forward<F>(f));
+			mOps = &InlineOps<T>;
+		} else {
+			*reinterpret_cast<T **>(mStorage) = new T(std::forward<F>(f));
+			mOps = &HeapOps<T>;
+		}
+	}
+
+	Task(Task &&other) noexcept { moveFrom(other); }
+
+	Task &operator=(Task &&other) noexcept {
+		if (this != &other) {
+			reset();
+			moveFrom(other);
+		}
+		return *this;
+	}
+
+	Task &operator=(std::nullptr_t) noexcept {
+		reset();
+		return *this;
+	}
+
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+
+	~Task() { reset(); }
+
+	explicit operator bool() const noexcept { return mOps != nullptr; }
+
+	void operator()() { mOps->invoke(mStorage); }
+
+private:
+	struct Ops {
+		void (*invoke)(void *storage);
+		void (*move)(void *dst, void *src) noexcept; // destroys src
+		void (*destroy)(void *storage) noexcept;
+	};
+
+	template <class T>
+	static constexpr bool IsInline = sizeof(T) <= InlineSize &&
+	                                 alignof(std::max_align_t) % alignof(T) == 0 &&
+	                                 std::is_nothrow_move_constructible_v<T>;
+
+	template <class T>
+	static inline const Ops InlineOps = {
+	    [](void *storage) { (*std::launder(reinterpret_cast<T *>(storage)))(); },
+	    [](void *dst, void *src) noexcept {
+		    T *t = std::launder(reinterpret_cast<T *>(src));
+		    new (dst) T(std::move(*t));
+		    t->~T();
+	    },
+	    [](void *storage) noexcept { std::launder(reinterpret_cast<T *>(storage))->~T(); }};
+
+	template <class T>
+	static inline const Ops HeapOps = {
+	    [](void *storage) { (**reinterpret_cast<T **>(storage))(); },
+	    [](void *dst, void *src) noexcept {
+		    *reinterpret_cast<T **>(dst) = *reinterpret_cast<T **>(src);
+	    },
+	    [](void *storage) noexcept { delete *reinterpret_cast<T **>(storage); }};
+
+	void moveFrom(Task &other) noexcept {
+		if (other.mOps) {
+			other.mOps->move(mStorage, other.mStorage);
+			mOps = std::exchange(other.mOps, nullptr);
+		}
+	}
+
+	void reset() noexcept {
+		if (mOps) {
+			mOps->destroy(mStorage);
+			mOps = nullptr;
+		}
+	}
+
+	alignas(std::max_align_t) unsigned char mStorage[InlineSize];
+	const Ops *mOps = nullptr;
+};
+
+} // namespace wsc::impl
+
+#endif
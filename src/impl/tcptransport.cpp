@@ -15,8 +15,18 @@
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <linux/tls.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
 #include <chrono>
+#include <cstring>
+#include <limits>
 #include <sstream>
+#include <unordered_map>
 
 namespace wsc::impl {
 
@@ -47,6 +57,58 @@ bool unmap_inet6_v4mapped(struct sockaddr *sa, socklen_t *len) {
 	return true;
 }
 
+// Cache of the last address family which won the connection race for each host, entries expire
+// after a while and the oldest one is evicted when full
+class FamilyCache {
+public:
+	using clock = std::chrono::steady_clock;
+
+	static FamilyCache &Instance() {
+		static FamilyCache *instance = new FamilyCache;
+		return *instance;
+	}
+
+	optional<int> get(const string &hostname) {
+		std::lock_guard lock(mMutex);
+		auto it = mFamilies.find(hostname);
+		if (it == mFamilies.end())
+			return nullopt;
+
+		if (it->second.expiry <= clock::now()) {
+			mFamilies.erase(it);
+			return nullopt;
+		}
+
+		return it->second.family;
+	}
+
+	void set(const string &hostname, int family) {
+		std::lock_guard lock(mMutex);
+		const auto now = clock::now();
+		if (mFamilies.size() >= CONNECTION_FAMILY_MAX_ENTRIES &&
+		    mFamilies.find(hostname) == mFamilies.end()) {
+			// Full, so evict the entry expiring first, which is also the oldest
+			auto oldest = mFamilies.begin();
+			for (auto it = mFamilies.begin(); it != mFamilies.end(); ++it)
+				if (it->second.expiry < oldest->second.expiry)
+					oldest = it;
+
+			mFamilies.erase(oldest);
+		}
+
+		mFamilies[hostname] = Entry{family, now + CONNECTION_FAMILY_TTL};
+	}
+
+private:
+	struct Entry {
+		int family;
+		clock::time_point expiry;
+	};
+
+	std::unordered_map<string, Entry> mFamilies;
+	std::mutex mMutex;
+};
+
 } // namespace
 
 TcpTransport::TcpTransport(string hostname, string service, state_callback callback)
@@ -62,7 +124,7 @@ TcpTransport::TcpTransport(socket_t sock, state_callback callback)
 	PLOG_DEBUG << "Initializing TCP transport with socket";
 
 	// Configure socket
-	configureSocket();
+	configureSocket(mSock);
 
 	// Retrieve hostname and service
 	struct sockaddr_storage addr;
@@ -89,8 +151,64 @@ void TcpTransport::onBufferedAmount(amount_callback callback) {
 	mBufferedAmountCallback = std::move(callback);
 }
 
+void TcpTransport::onWritten(written_callback callback) {
+	std::lock_guard lock(mSendMutex);
+	if (mSock == INVALID_SOCKET) {
+		callback(false);
+		return;
+	}
+
+	mWrittenCallbacks.emplace_back(mOutgoingTotal, std::move(callback));
+	triggerWritten();
+}
+
 void TcpTransport::setReadTimeout(std::chrono::milliseconds readTimeout) {
+	std::lock_guard lock(mSendMutex);
 	mReadTimeout = readTimeout;
+
+	// A connected socket is already polled, for instance when claimed from the connection pool
+	if (mSock != INVALID_SOCKET && state() == State::Connected)
+		setPoll(mSendQueue.empty() ? PollService::Direction::In : PollService::Direction::Both);
+}
+
+void TcpTransport::setFastOpen(bool enabled) {
+#ifdef TCP_FASTOPEN_CONNECT
+	mFastOpen = enabled;
+#else
+	if (enabled) {
+		PLOG_WARNING << "TCP Fast Open is not supported on this platform";
+	}
+#endif
+}
+
+void TcpTransport::setReadBudget(size_t bytes, size_t messages) {
+	mReadBudget = bytes;
+	mReadMessageBudget = messages;
+}
+
+bool TcpTransport::enableKernelTls([[maybe_unused]] const void *txCryptoInfo,
+                                   [[maybe_unused]] size_t size) {
+#if defined(__linux__) && defined(TCP_ULP)
+	std::lock_guard lock(mSendMutex);
+	if (mSock == INVALID_SOCKET || !mSendQueue.empty())
+		return false;
+
+	if (::setsockopt(mSock, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+		PLOG_DEBUG << "Kernel TLS is not available, errno=" << sockerrno;
+		return false;
+	}
+
+	// Without crypto info, the TLS upper layer protocol passes data through unchanged
+	if (::setsockopt(mSock, SOL_TLS, TLS_TX, txCryptoInfo, socklen_t(size)) < 0) {
+		PLOG_DEBUG << "Kernel TLS transmit offload failed, errno=" << sockerrno;
+		return false;
+	}
+
+	PLOG_DEBUG << "Kernel TLS transmit offload enabled";
+	return true;
+#else
+	return false;
+#endif
 }
 
 void TcpTransport::start() {
@@ -98,6 +216,8 @@ void TcpTransport::start() {
 		connect();
 	} else {
 		changeState(State::Connected);
+
+		std::lock_guard lock(mSendMutex);
 		setPoll(PollService::Direction::In);
 	}
 }
@@ -125,6 +245,8 @@ void TcpTransport::incoming(message_ptr message) {
 
 bool TcpTransport::outgoing(message_ptr message) {
 	// mSendMutex must be locked
+	mOutgoingTotal += message->size();
+
 	// Flush the queue, and if nothing is pending, try to send directly
 	if (trySendQueue() && trySendMessage(message))
 		return true;
@@ -149,83 +271,141 @@ void TcpTransport::connect() {
 	PLOG_DEBUG << "Connecting to " << mHostname << ":" << mService;
 	changeState(State::Connecting);
 
-	ThreadPool::Instance().enqueue(weak_bind(&TcpTransport::resolve, this));
+	resolve();
 }
 
 void TcpTransport::resolve() {
-	std::lock_guard lock(mSendMutex);
+	PLOG_DEBUG << "Resolving " << mHostname << ":" << mService;
+	Resolver::Instance().resolve(mHostname, mService,
+	                             weak_bind(&TcpTransport::processResolution, this, _1));
+}
+
+void TcpTransport::processResolution(optional<Resolver::address_list> result) {
+	std::unique_lock lock(mSendMutex);
 	mResolved.clear();
 
 	if (state() != State::Connecting)
 		return; // Cancelled
 
-	try {
-		PLOG_DEBUG << "Resolving " << mHostname << ":" << mService;
+	if (!result) {
+		lock.unlock();
+		changeState(State::Failed);
+		return;
+	}
 
-		struct addrinfo hints = {};
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_protocol = IPPROTO_TCP;
-		hints.ai_flags = AI_ADDRCONFIG;
+	mResolved.assign(result->begin(), result->end());
 
-		struct addrinfo *result = nullptr;
-		if (getaddrinfo(mHostname.c_str(), mService.c_str(), &hints, &result))
-			throw std::runtime_error("Resolution failed for \"" + mHostname + ":" + mService +
-			                         "\"");
+	// RFC 8305 4. Sorting Addresses: interleave address families, starting with the family which
+	// won the last race to this host if any, or with the first family returned otherwise.
+	// See https://www.rfc-editor.org/rfc/rfc8305.html#section-4
+	if (!mResolved.empty()) {
+		int preferred = FamilyCache::Instance().get(mHostname).value_or(
+		    int(std::get<0>(mResolved.front()).ss_family));
 
-		try {
-			struct addrinfo *ai = result;
-			while (ai) {
-				struct sockaddr_storage addr;
-				std::memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
-				mResolved.emplace_back(addr, socklen_t(ai->ai_addrlen));
-				ai = ai->ai_next;
+		decltype(mResolved) first, second;
+		for (auto &entry : mResolved)
+			(std::get<0>(entry).ss_family == preferred ? first : second)
+			    .emplace_back(std::move(entry));
+
+		mResolved.clear();
+		while (!first.empty() || !second.empty()) {
+			if (!first.empty()) {
+				mResolved.splice(mResolved.end(), first, first.begin());
+			}
+			if (!second.empty()) {
+				mResolved.splice(mResolved.end(), second, second.begin());
 			}
-		} catch (...) {
-			freeaddrinfo(result);
-			throw;
 		}
+	}
 
-		freeaddrinfo(result);
-	} catch (const std::exception &e) {
-		PLOG_WARNING << e.what();
+	if (!attempt()) {
+		lock.unlock(); // the state callback must not run with mSendMutex held
 		changeState(State::Failed);
-		return;
 	}
-
-	ThreadPool::Instance().enqueue(weak_bind(&TcpTransport::attempt, this));
 }
 
-void TcpTransport::attempt() {
-	std::lock_guard lock(mSendMutex);
+bool TcpTransport::attempt() {
+	// mSendMutex must be held
+	if (state() != State::Connecting || mSock != INVALID_SOCKET)
+		return true; // Cancelled or already connected
 
-	if (state() != State::Connecting)
-		return; // Cancelled
+	while (!mResolved.empty()) {
+		auto [addr, addrlen] = mResolved.front();
+		mResolved.pop_front();
 
-	if (mSock == INVALID_SOCKET) {
-		::closesocket(mSock);
-		mSock = INVALID_SOCKET;
+		// With TCP Fast Open, connect() completes immediately and the socket is writable at once,
+		// so the attempt would always win the race. Only use it when nothing else could race.
+		bool fastOpen = mFastOpen && mResolved.empty() && mAttempts.empty();
+
+		socket_t sock;
+		try {
+			sock = createSocket(reinterpret_cast<const struct sockaddr *>(&addr), addrlen,
+			                    fastOpen);
+		} catch (const std::runtime_error &e) {
+			PLOG_DEBUG << e.what();
+			continue;
+		}
+
+		mAttempts.emplace(sock, int(addr.ss_family));
+
+		// Poll out event callback, processed on the thread pool so attempts can race. It may still
+		// run after a removal from another reactor thread, so it must not outlive the transport.
+		auto callback = [this, weak_this = weak_from_this(), sock](PollService::Event event) {
+			if (event != PollService::Event::Out && event != PollService::Event::Error &&
+			    event != PollService::Event::Timeout)
+				return;
+
+			auto shared_this = weak_this.lock();
+			if (!shared_this)
+				return;
+
+			PollService::Instance().remove(sock);
+			ThreadPool::Instance().post(
+			    weak_bind(&TcpTransport::processAttempt, this, sock, event));
+		};
+
+		PollService::Instance().add(
+		    sock, {PollService::Direction::Out, CONNECTION_ATTEMPT_TIMEOUT, std::move(callback)});
+
+		// RFC 8305 5. Connection Attempts: start the next attempt after a delay unless this one
+		// completes first. See https://www.rfc-editor.org/rfc/rfc8305.html#section-5
+		if (!mResolved.empty())
+			ThreadPool::Instance().post(
+			    CONNECTION_ATTEMPT_DELAY,
+			    weak_bind(&TcpTransport::attemptAfterDelay, this, ++mAttemptGeneration));
+
+		return true;
 	}
 
-	if (mResolved.empty()) {
+	if (mAttempts.empty()) {
 		PLOG_WARNING << "Connection to " << mHostname << ":" << mService << " failed";
-		changeState(State::Failed);
-		return;
+		return false;
 	}
 
-	try {
-		auto [addr, addrlen] = mResolved.front();
-		mResolved.pop_front();
+	return true; // Wait for the other attempts in progress
+}
 
-		createSocket(reinterpret_cast<const struct sockaddr *>(&addr), addrlen);
-	} catch (const std::runtime_error &e) {
-		PLOG_DEBUG << e.what();
-		ThreadPool::Instance().enqueue(weak_bind(&TcpTransport::attempt, this));
-		return;
+void TcpTransport::attemptAfterDelay(unsigned int generation) {
+	// Check and attempt atomically, otherwise a concurrent success could happen in between
+	std::unique_lock lock(mSendMutex);
+	if (generation != mAttemptGeneration)
+		return; // Another attempt has been started or the race is over
+
+	if (!attempt()) {
+		lock.unlock();
+		changeState(State::Failed);
 	}
+}
 
-	// Poll out event callback
-	auto callback = [this](PollService::Event event) {
+void TcpTransport::processAttempt(socket_t sock, PollService::Event event) {
+	{
+		std::unique_lock lock(mSendMutex);
+
+		auto it = mAttempts.find(sock);
+		if (it == mAttempts.end() || state() != State::Connecting)
+			return; // Cancelled or lost the race
+
+		int family = it->second;
 		try {
 			if (event == PollService::Event::Error)
 				throw std::runtime_error("TCP connection failed");
@@ -233,12 +413,9 @@ void TcpTransport::attempt() {
 			if (event == PollService::Event::Timeout)
 				throw std::runtime_error("TCP connection timed out");
 
-			if (event != PollService::Event::Out)
-				return;
-
 			int err = 0;
 			socklen_t errlen = sizeof(err);
-			if (::getsockopt(mSock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&err),
+			if (::getsockopt(sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&err),
 			                 &errlen) != 0)
 				throw std::runtime_error("Failed to get socket error code");
 
@@ -248,71 +425,110 @@ void TcpTransport::attempt() {
 				throw std::runtime_error(msg.str());
 			}
 
-			// Success
-			PLOG_INFO << "TCP connected";
-			changeState(State::Connected);
-			setPoll(PollService::Direction::In);
 		} catch (const std::exception &e) {
 			PLOG_DEBUG << e.what();
-			PollService::Instance().remove(mSock);
-			ThreadPool::Instance().enqueue(weak_bind(&TcpTransport::attempt, this));
+			::closesocket(sock);
+			mAttempts.erase(it);
+
+			// RFC 8305 5. Connection Attempts: start the next attempt right away on failure, even
+			// if other attempts are still in progress, and restart the delay for the following one
+			++mAttemptGeneration;
+			if (!attempt()) {
+				lock.unlock();
+				changeState(State::Failed);
+			}
+			return;
 		}
-	};
 
-	const auto timeout = 10s;
-	PollService::Instance().add(mSock, {PollService::Direction::Out, timeout, std::move(callback)});
+		// Success, cancel the other attempts
+		mAttempts.erase(it);
+		for (auto [s, f] : mAttempts)
+			PollService::Instance().close(s);
+		mAttempts.clear();
+		mResolved.clear();
+		++mAttemptGeneration;
+
+		mSock = sock;
+		FamilyCache::Instance().set(mHostname, family);
+	}
+
+	PLOG_INFO << "TCP connected";
+	changeState(State::Connected);
+
+	std::lock_guard lock(mSendMutex);
+	if (mSock != INVALID_SOCKET)
+		setPoll(mSendQueue.empty() ? PollService::Direction::In : PollService::Direction::Both);
 }
 
-void TcpTransport::createSocket(const struct sockaddr *addr, socklen_t addrlen) {
+socket_t TcpTransport::createSocket(const struct sockaddr *addr, socklen_t addrlen,
+                                   [[maybe_unused]] bool fastOpen) {
+	socket_t sock = INVALID_SOCKET;
 	try {
+		string address = remoteAddress(); // for non-IP addresses
 		char node[MAX_NUMERICNODE_LEN];
 		char serv[MAX_NUMERICSERV_LEN];
 		if (getnameinfo(addr, addrlen, node, MAX_NUMERICNODE_LEN, serv, MAX_NUMERICSERV_LEN,
 		                NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
-			PLOG_DEBUG << "Trying address " << node << ":" << serv;
+			address = string(node) + ':' + serv;
 		}
 
+		PLOG_DEBUG << "Trying address " << address;
 		PLOG_VERBOSE << "Creating TCP socket";
 
 		// Create socket
-		mSock = ::socket(addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
-		if (mSock == INVALID_SOCKET)
+		int protocol = addr->sa_family != AF_UNIX ? IPPROTO_TCP : 0;
+		sock = ::socket(addr->sa_family, SOCK_STREAM, protocol);
+		if (sock == INVALID_SOCKET)
 			throw std::runtime_error("TCP socket creation failed");
 
 		// Configure socket
-		configureSocket();
+		configureSocket(sock);
+
+#ifdef TCP_FASTOPEN_CONNECT
+		// With TCP Fast Open, connect() returns immediately and the first data sent rides in the
+		// SYN if a cookie is available. Otherwise, the kernel falls back to a regular handshake.
+		if (fastOpen) {
+			int enabled = 1;
+			if (::setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+			                 reinterpret_cast<const char *>(&enabled), sizeof(enabled)) < 0) {
+				PLOG_DEBUG << "TCP Fast Open is not available, errno=" << sockerrno;
+			}
+		}
+#endif
 
 		// Initiate connection
-		int ret = ::connect(mSock, addr, addrlen);
+		int ret = ::connect(sock, addr, addrlen);
 		if (ret < 0 && sockerrno != SEINPROGRESS && sockerrno != SEWOULDBLOCK) {
 			std::ostringstream msg;
-			msg << "TCP connection to " << node << ":" << serv << " failed, errno=" << sockerrno;
+			msg << "TCP connection to " << address << " failed, errno=" << sockerrno;
 			throw std::runtime_error(msg.str());
 		}
+
+		return sock;
+
 	} catch (...) {
-		if (mSock != INVALID_SOCKET) {
-			::closesocket(mSock);
-			mSock = INVALID_SOCKET;
-		}
+		if (sock != INVALID_SOCKET)
+			::closesocket(sock);
+
 		throw;
 	}
 }
 
-void TcpTransport::configureSocket() {
+void TcpTransport::configureSocket(socket_t sock) {
 	// Set non-blocking
 	ctl_t nbio = 1;
-	if (::ioctlsocket(mSock, FIONBIO, &nbio) < 0)
+	if (::ioctlsocket(sock, FIONBIO, &nbio) < 0)
 		throw std::runtime_error("Failed to set socket non-blocking mode");
 
 	// Disable the Nagle algorithm
 	int nodelay = 1;
-	::setsockopt(mSock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&nodelay),
+	::setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&nodelay),
 	             sizeof(nodelay));
 
 #ifdef __APPLE__
 	// MacOS lacks MSG_NOSIGNAL and requires SO_NOSIGPIPE instead
 	const sockopt_t enabled = 1;
-	if (::setsockopt(mSock, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled)) < 0)
+	if (::setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled)) < 0)
 		throw std::runtime_error("Failed to disable SIGPIPE for socket");
 #endif
 }
@@ -320,17 +536,25 @@ void TcpTransport::configureSocket() {
 void TcpTransport::setPoll(PollService::Direction direction) {
 	PollService::Instance().add(
 	    mSock, {direction, direction == PollService::Direction::In ? mReadTimeout : nullopt,
-	            std::bind(&TcpTransport::process, this, _1)});
+	            weak_bind(&TcpTransport::process, this, _1)});
 }
 
 void TcpTransport::close() {
 	std::lock_guard lock(mSendMutex);
+	for (auto [sock, family] : mAttempts)
+		PollService::Instance().close(sock);
+	mAttempts.clear();
+	mResolved.clear();
+
 	if (mSock != INVALID_SOCKET) {
 		PLOG_DEBUG << "Closing TCP socket";
-		PollService::Instance().remove(mSock);
-		::closesocket(mSock);
+		PollService::Instance().close(mSock); // once no callback can run for it
 		mSock = INVALID_SOCKET;
 	}
+
+	for (auto &[total, callback] : std::exchange(mWrittenCallbacks, {}))
+		callback(false);
+
 	changeState(State::Disconnected);
 }
 
@@ -365,7 +589,8 @@ bool TcpTransport::trySendMessage(message_ptr &message) {
 #endif
 		int len = ::send(mSock, data, int(size), flags);
 		if (len < 0) {
-			if (sockerrno == SEAGAIN || sockerrno == SEWOULDBLOCK) {
+			// With TCP Fast Open and no cookie, the first send initiates the handshake
+			if (sockerrno == SEAGAIN || sockerrno == SEWOULDBLOCK || sockerrno == SEINPROGRESS) {
 				message = make_message(message->end() - size, message->end());
 				return false;
 			} else {
@@ -391,6 +616,25 @@ void TcpTransport::updateBufferedAmount(ptrdiff_t delta) {
 
 	// Synchronously call the buffered amount callback
 	triggerBufferedAmount(mBufferedAmount);
+
+	if (delta < 0)
+		triggerWritten();
+}
+
+void TcpTransport::triggerWritten() {
+	// Requires mSendMutex to be locked
+
+	// Everything accepted is either written or buffered
+	const uint64_t written = mOutgoingTotal - mBufferedAmount;
+	while (!mWrittenCallbacks.empty() && std::get<0>(mWrittenCallbacks.front()) <= written) {
+		auto callback = std::move(std::get<1>(mWrittenCallbacks.front()));
+		mWrittenCallbacks.pop_front();
+		try {
+			callback(true);
+		} catch (const std::exception &e) {
+			PLOG_WARNING << "TCP written callback: " << e.what();
+		}
+	}
 }
 
 void TcpTransport::triggerBufferedAmount(size_t amount) {
@@ -416,11 +660,16 @@ void TcpTransport::process(PollService::Event event) {
 		case PollService::Event::Timeout: {
 			PLOG_VERBOSE << "TCP is idle";
 			incoming(make_message(0));
-			setPoll(PollService::Direction::In);
+
+			std::lock_guard lock(mSendMutex);
+			if (mSock != INVALID_SOCKET)
+				setPoll(mSendQueue.empty() ? PollService::Direction::In
+				                           : PollService::Direction::Both);
 			return;
 		}
 
 		case PollService::Event::Out: {
+			std::lock_guard lock(mSendMutex);
 			if (trySendQueue())
 				setPoll(PollService::Direction::In);
 
@@ -430,10 +679,27 @@ void TcpTransport::process(PollService::Event event) {
 		case PollService::Event::In: {
 			const size_t bufferSize = 4096;
 			char buffer[bufferSize];
+			size_t budget = mReadBudget;
+			if (budget == 0)
+				budget = std::numeric_limits<size_t>::max();
+
+			// The message budget bounds the work per wakeup when reads return little data, as
+			// each message goes through the upper layers
+			size_t messageBudget = mReadMessageBudget;
+			if (messageBudget == 0)
+				messageBudget = std::numeric_limits<size_t>::max();
+
 			int len;
 			while ((len = ::recv(mSock, buffer, bufferSize, 0)) > 0) {
 				auto *b = reinterpret_cast<byte *>(buffer);
 				incoming(make_message(b, b + len));
+
+				// Poll is level-triggered, so yield to the other sockets once a budget is spent
+				// and the remaining data will be read on the next wakeup
+				if (size_t(len) >= budget || --messageBudget == 0)
+					return;
+
+				budget -= size_t(len);
 			}
 
 			if (len == 0)
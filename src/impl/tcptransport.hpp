@@ -12,26 +12,43 @@
 #include "common.hpp"
 #include "pollservice.hpp"
 #include "queue.hpp"
+#include "resolver.hpp"
 #include "socket.hpp"
 #include "transport.hpp"
 
+#include <atomic>
 #include <chrono>
+#include <deque>
 #include <list>
+#include <map>
 #include <mutex>
 #include <tuple>
 
 namespace wsc::impl {
 
-class TcpTransport final : public Transport, public std::enable_shared_from_this<TcpTransport> {
+class TcpTransport : public Transport, public std::enable_shared_from_this<TcpTransport> {
 public:
 	using amount_callback = std::function<void(size_t amount)>;
+	using written_callback = std::function<void(bool written)>;
 
 	TcpTransport(string hostname, string service, state_callback callback); // active
 	TcpTransport(socket_t sock, state_callback callback);                   // passive
 	~TcpTransport();
 
 	void onBufferedAmount(amount_callback callback);
+
+	// Call back once everything sent so far has been written to the socket, or with false if the
+	// connection is closed first. Called with the send mutex locked, so it must not block.
+	void onWritten(written_callback callback);
+
 	void setReadTimeout(std::chrono::milliseconds readTimeout);
+	void setFastOpen(bool enabled); // before start(), only used for a single candidate address
+	// Per poll wakeup, in bytes and in messages each from one read, 0 means unlimited
+	void setReadBudget(size_t bytes, size_t messages);
+
+	// Attach kernel TLS and offload transmission with the given crypto info (Linux only), fails if
+	// data encrypted in user space is still pending
+	bool enableKernelTls(const void *txCryptoInfo, size_t size);
 
 	void start() override;
 	bool send(message_ptr message) override;
@@ -40,34 +57,48 @@ public:
 	bool outgoing(message_ptr message) override;
 
 	bool isActive() const;
-	string remoteAddress() const;
+	virtual string remoteAddress() const;
+
+protected:
+	virtual void resolve();
+	void processResolution(optional<Resolver::address_list> result);
+
+	const bool mIsActive;
+	string mHostname, mService;
 
 private:
 	void connect();
-	void resolve();
-	void attempt();
-	void createSocket(const struct sockaddr *addr, socklen_t addrlen);
-	void configureSocket();
-	void setPoll(PollService::Direction direction);
+	bool attempt(); // returns false if the connection failed, mSendMutex must be held
+	void attemptAfterDelay(unsigned int generation);
+	void processAttempt(socket_t sock, PollService::Event event);
+	socket_t createSocket(const struct sockaddr *addr, socklen_t addrlen, bool fastOpen);
+	void configureSocket(socket_t sock);
+	void setPoll(PollService::Direction direction); // reads mReadTimeout, mSendMutex must be held
 	void close();
 
 	bool trySendQueue();
 	bool trySendMessage(message_ptr &message);
 	void updateBufferedAmount(ptrdiff_t delta);
+	void triggerWritten();
 	void triggerBufferedAmount(size_t amount);
 
 	void process(PollService::Event event);
 
-	const bool mIsActive;
-	string mHostname, mService;
 	amount_callback mBufferedAmountCallback;
 	optional<std::chrono::milliseconds> mReadTimeout;
+	bool mFastOpen = false;
+	std::atomic<size_t> mReadBudget = DEFAULT_READ_BUDGET;
+	std::atomic<size_t> mReadMessageBudget = DEFAULT_READ_MESSAGE_BUDGET;
 
 	std::list<std::tuple<struct sockaddr_storage, socklen_t>> mResolved;
+	std::map<socket_t, int> mAttempts; // pending connection attempts, socket to address family
+	unsigned int mAttemptGeneration = 0;
 
 	socket_t mSock;
 	Queue<message_ptr> mSendQueue;
 	size_t mBufferedAmount = 0;
+	uint64_t mOutgoingTotal = 0; // bytes accepted for sending, written or buffered
+	std::deque<std::tuple<uint64_t, written_callback>> mWrittenCallbacks; // by increasing total
 	std::mutex mSendMutex;
 };
 
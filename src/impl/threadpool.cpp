@@ -9,6 +9,8 @@
 #include "threadpool.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+
 namespace wsc::impl {
 
 ThreadPool &ThreadPool::Instance() {
@@ -16,82 +18,439 @@ ThreadPool &ThreadPool::Instance() {
 	return *instance;
 }
 
-ThreadPool::ThreadPool() {}
+thread_local ThreadPool::Worker *ThreadPool::CurrentWorker = nullptr;
+
+ThreadPool::ThreadPool() : mNextTimer(clock::time_point::max().time_since_epoch().count()) {
+	// There is always a worker to queue tasks on, even before spawning threads
+	mWorkerList = new Worker;
+}
 
 ThreadPool::~ThreadPool() {}
 
-int ThreadPool::count() const {
-	std::unique_lock lock(mWorkersMutex);
-	return int(mWorkers.size());
-}
+int ThreadPool::count() const { return mThreadCount; }
 
 void ThreadPool::spawn(int count) {
 	std::unique_lock lock(mWorkersMutex);
+	mStarted = true;
 	while (count-- > 0)
-		mWorkers.emplace_back(std::bind(&ThreadPool::run, this));
+		spawnThread();
+}
+
+void ThreadPool::setLimits(int minCount, int maxCount, clock::duration idleTimeout) {
+	std::lock_guard lock(mParkMutex);
+	mMinCount = minCount;
+	mMaxCount = maxCount;
+	mIdleTimeout = idleTimeout;
+}
+
+void ThreadPool::setThreadOptions(utils::thread_options options) {
+	std::lock_guard lock(mWorkersMutex);
+	mThreadOptions = std::move(options);
 }
 
 void ThreadPool::join() {
+	const bool hasWorkers = count() > 0;
 	{
-		std::unique_lock lock(mMutex);
-		mWaitingCondition.wait(lock, [&]() { return mBusyWorkers == 0; });
+		std::unique_lock lock(mParkMutex);
+		mIdleCondition.wait(lock, [&]() {
+			return mBusyWorkers == 0 && (mPendingTasks <= 0 || !hasWorkers);
+		});
 		mJoining = true;
-		mTasksCondition.notify_all();
+		mParkCondition.notify_all();
+		mTimerCondition.notify_all();
 	}
 
-	std::unique_lock lock(mWorkersMutex);
-	for (auto &w : mWorkers)
-		w.join();
+	std::vector<std::thread> workers;
+	{
+		std::unique_lock lock(mWorkersMutex);
+		mStarted = false;
+		workers = std::exchange(mWorkers, {});
+	}
 
-	mWorkers.clear();
+	for (auto &w : workers)
+		w.join();
 
 	mJoining = false;
 }
 
 void ThreadPool::clear() {
-	std::unique_lock lock(mMutex);
-	while (!mTasks.empty())
-		mTasks.pop();
+	for (Worker *worker = mWorkerList; worker; worker = worker->next) {
+		std::lock_guard lock(worker->mutex);
+		mPendingTasks -= long(worker->tasks.size());
+		worker->tasks.clear();
+		worker->size = 0;
+	}
+
+	std::lock_guard lock(mTimersMutex);
+	mTimers = {};
+	mNextTimer = clock::time_point::max().time_since_epoch().count();
 }
 
 void ThreadPool::run() {
-	utils::this_thread::set_name("wsc worker");
+	utils::this_thread::set_name("worker");
+	{
+		std::unique_lock lock(mWorkersMutex);
+		auto options = mThreadOptions;
+		lock.unlock();
+		utils::this_thread::apply(options);
+	}
+
+	CurrentWorker = acquireWorker();
 	++mBusyWorkers;
-	scope_guard guard([&]() { --mBusyWorkers; });
-	while (runOne()) {
+	--mSearchingWorkers; // counted as searching since spawned, see spawnThread()
+	{
+		scope_guard guard([&]() {
+			--mBusyWorkers;
+			if (!std::exchange(CurrentWorker->retired, false))
+				--mThreadCount;
+
+			CurrentWorker->active = false; // queued tasks will be stolen or run by the next owner
+			CurrentWorker = nullptr;
+		});
+		while (runOne()) {
+		}
+	}
+
+	// A retired worker detaches itself, unless join() already took it
+	std::lock_guard lock(mWorkersMutex);
+	auto it = std::find_if(mWorkers.begin(), mWorkers.end(), [](const std::thread &t) {
+		return t.get_id() == std::this_thread::get_id();
+	});
+	if (it != mWorkers.end()) {
+		it->detach();
+		mWorkers.erase(it);
 	}
 }
 
 bool ThreadPool::runOne() {
 	if (auto task = dequeue()) {
-		task();
+		try {
+			task();
+		} catch (const std::exception &e) {
+			PLOG_WARNING << e.what();
+		}
 		return true;
 	}
 	return false;
 }
 
-std::function<void()> ThreadPool::dequeue() {
-	std::unique_lock lock(mMutex);
+bool ThreadPool::attach() {
+	if (CurrentWorker)
+		return false;
+
+	CurrentWorker = acquireWorker();
+	return true;
+}
+
+void ThreadPool::detach() {
+	CurrentWorker->active = false;
+	CurrentWorker = nullptr;
+}
+
+int ThreadPool::runPending() {
+	expireTimers(CurrentWorker);
+
+	// Tasks queued meanwhile are left for the next call, so they can't starve I/O
+	int count = 0;
+	long pending = mPendingTasks;
+	while (count < pending) {
+		auto task = pop(CurrentWorker);
+		if (!task)
+			task = steal(CurrentWorker);
+		if (!task)
+			break;
+
+		try {
+			task();
+		} catch (const std::exception &e) {
+			PLOG_WARNING << e.what();
+		}
+		++count;
+	}
+	return count;
+}
+
+optional<ThreadPool::clock::time_point> ThreadPool::nextDeadline() {
+	if (mPendingTasks > 0)
+		return clock::now();
+
+	auto next = clock::time_point(clock::duration(mNextTimer.load()));
+	return next != clock::time_point::max() ? std::make_optional(next) : nullopt;
+}
+
+void ThreadPool::setNotifier(void (*func)()) { mNotifier = func; }
+
+void ThreadPool::push(clock::time_point time, Task func) {
+	if (time <= clock::now()) {
+		push(CurrentWorker ? CurrentWorker : nextTarget(), std::move(func));
+		wake();
+		if (auto notifier = mNotifier.load(); notifier && !CurrentWorker)
+			notifier();
+
+		return;
+	}
+
+	bool first;
+	{
+		std::lock_guard lock(mTimersMutex);
+		mTimers.push({time, std::move(func)});
+		first = mTimers.top().time == time;
+		if (first)
+			mNextTimer = time.time_since_epoch().count();
+	}
+
+	if (first) {
+		wakeTimerWaiter(); // the deadline changed
+		if (auto notifier = mNotifier.load(); notifier && !CurrentWorker)
+			notifier();
+	}
+}
+
+void ThreadPool::push(Worker *worker, Task func) {
+	{
+		std::lock_guard lock(worker->mutex);
+		worker->tasks.push_back(std::move(func));
+		++worker->size;
+	}
+
+	// Counted once queued, so workers never spin on a task they can't pop yet. The caller must
+	// call wake() afterwards: either a parking worker sees the count or it gets woken up.
+	++mPendingTasks;
+}
+
+Task ThreadPool::dequeue() {
+	Worker *worker = CurrentWorker;
+	++mSearchingWorkers;
 	while (!mJoining) {
-		std::optional<clock::time_point> time;
-		if (!mTasks.empty()) {
-			time = mTasks.top().time;
-			if (*time <= clock::now()) {
-				auto func = std::move(mTasks.top().func);
-				mTasks.pop();
-				return func;
-			}
+		expireTimers(worker);
+
+		auto func = pop(worker);
+		if (!func)
+			func = steal(worker);
+
+		if (func) {
+			// The last searching worker wakes up another one in case there are more tasks
+			if (--mSearchingWorkers == 0 && mPendingTasks > 0)
+				wake();
+
+			return func;
 		}
 
-		--mBusyWorkers;
-		scope_guard guard([&]() { ++mBusyWorkers; });
-		mWaitingCondition.notify_all();
-		if (time)
-			mTasksCondition.wait_until(lock, *time);
-		else
-			mTasksCondition.wait(lock);
+		if (!park())
+			break;
 	}
+	--mSearchingWorkers;
 	return nullptr;
 }
 
+Task ThreadPool::pop(Worker *worker) {
+	if (!worker || worker->size == 0)
+		return nullptr;
+
+	std::lock_guard lock(worker->mutex);
+	if (worker->tasks.empty())
+		return nullptr;
+
+	auto func = std::move(worker->tasks.front());
+	worker->tasks.pop_front();
+	--worker->size;
+	--mPendingTasks;
+	return func;
+}
+
+Task ThreadPool::steal(Worker *worker) {
+	// Start after the worker so thieves spread over the victims
+	Worker *first = worker && worker->next ? worker->next : mWorkerList.load();
+	Worker *victim = first;
+	do {
+		if (victim != worker)
+			if (auto func = pop(victim))
+				return func;
+
+		victim = victim->next ? victim->next : mWorkerList.load();
+	} while (victim != first);
+
+	return nullptr;
+}
+
+void ThreadPool::expireTimers(Worker *worker) {
+	if (clock::time_point(clock::duration(mNextTimer.load())) > clock::now())
+		return;
+
+	if (!worker)
+		worker = nextTarget();
+
+	long count = 0;
+	{
+		// Worker locks are never held while locking mTimersMutex
+		std::lock_guard lock(mTimersMutex);
+		std::lock_guard workerLock(worker->mutex);
+		const auto now = clock::now();
+		while (!mTimers.empty() && mTimers.top().time <= now) {
+			// Moving out the function is safe as ordering only depends on the time
+			worker->tasks.push_back(std::move(const_cast<Timer &>(mTimers.top()).func));
+			mTimers.pop();
+			++count;
+		}
+		worker->size += count;
+		mNextTimer = mTimers.empty() ? clock::time_point::max().time_since_epoch().count()
+		                             : mTimers.top().time.time_since_epoch().count();
+	}
+
+	mPendingTasks += count;
+
+	// The current worker runs one, others may steal the rest
+	for (long i = 1; i < count; ++i)
+		wake();
+}
+
+bool ThreadPool::park() {
+	std::unique_lock lock(mParkMutex);
+	++mParkedWorkers;
+	--mSearchingWorkers; // before checking for tasks, see wake()
+	scope_guard parkedGuard([&]() {
+		--mParkedWorkers;
+		++mSearchingWorkers;
+	});
+	if (mJoining || mPendingTasks > 0)
+		return true;
+
+	if (--mBusyWorkers == 0)
+		mIdleCondition.notify_all();
+
+	scope_guard busyGuard([&]() { ++mBusyWorkers; });
+
+	const auto next = clock::time_point(clock::duration(mNextTimer.load()));
+	if (next != clock::time_point::max() && !mTimerWaiting) {
+		mTimerWaiting = true;
+		mTimerCondition.wait_until(lock, next, [&]() {
+			return mJoining || std::exchange(mTimerWakeup, false);
+		});
+		mTimerWaiting = false;
+		mTimerWakeup = false;
+	} else {
+		auto ready = [&]() {
+			if (mJoining)
+				return true;
+			if (mWakeups == 0)
+				return false;
+			--mWakeups;
+			return true;
+		};
+		if (CurrentWorker && mIdleTimeout > clock::duration::zero()) {
+			while (!mParkCondition.wait_for(lock, mIdleTimeout, ready))
+				if (retire())
+					return false;
+		} else {
+			mParkCondition.wait(lock, ready);
+		}
+	}
+	return true;
+}
+
+void ThreadPool::wake() {
+	// A searching worker will find the task, or see it before parking
+	if (mSearchingWorkers > 0)
+		return;
+
+	if (mParkedWorkers == 0) {
+		grow(); // all workers are busy
+		return;
+	}
+
+	// Prefer workers not waiting for a timer so the timer waiter keeps its role
+	std::lock_guard lock(mParkMutex);
+	if (mParkedWorkers - (mTimerWaiting ? 1 : 0) > mWakeups) {
+		++mWakeups;
+		mParkCondition.notify_one();
+	} else if (mTimerWaiting && !mTimerWakeup) {
+		mTimerWakeup = true;
+		mTimerCondition.notify_one();
+	}
+}
+
+void ThreadPool::wakeTimerWaiter() {
+	if (mParkedWorkers == 0)
+		return;
+
+	// Either the timer waiter updates its deadline or a parked worker takes the role
+	std::lock_guard lock(mParkMutex);
+	if (mTimerWaiting) {
+		mTimerWakeup = true;
+		mTimerCondition.notify_one();
+	} else if (mParkedWorkers > mWakeups) {
+		++mWakeups;
+		mParkCondition.notify_one();
+	}
+}
+
+void ThreadPool::grow() {
+	if (mThreadCount >= mMaxCount)
+		return;
+
+	std::lock_guard lock(mWorkersMutex);
+	if (mStarted && !mJoining && mThreadCount < mMaxCount) {
+		PLOG_VERBOSE << "Spawning a worker, count=" << mThreadCount + 1;
+		try {
+			spawnThread();
+		} catch (const std::exception &e) {
+			PLOG_WARNING << "Failed to spawn a worker: " << e.what();
+		}
+	}
+}
+
+bool ThreadPool::retire() {
+	// mParkMutex must be locked
+	int count = mThreadCount;
+	do {
+		if (count <= std::max(mMinCount.load(), 1))
+			return false;
+	} while (!mThreadCount.compare_exchange_weak(count, count - 1));
+
+	PLOG_VERBOSE << "Idle worker exiting, count=" << count - 1;
+	CurrentWorker->retired = true;
+	return true;
+}
+
+void ThreadPool::spawnThread() {
+	// mWorkersMutex must be locked
+	++mThreadCount;
+	++mSearchingWorkers; // so wake() does not spawn more while it starts, see run()
+	try {
+		mWorkers.emplace_back(std::bind(&ThreadPool::run, this));
+	} catch (...) {
+		--mThreadCount;
+		--mSearchingWorkers;
+		throw;
+	}
+}
+
+ThreadPool::Worker *ThreadPool::acquireWorker() {
+	for (Worker *worker = mWorkerList; worker; worker = worker->next) {
+		bool expected = false;
+		if (worker->active.compare_exchange_strong(expected, true))
+			return worker;
+	}
+
+	auto worker = new Worker;
+	worker->active = true;
+	worker->next = mWorkerList.load();
+	while (!mWorkerList.compare_exchange_weak(worker->next, worker)) {
+	}
+	return worker;
+}
+
+ThreadPool::Worker *ThreadPool::nextTarget() {
+	// Races only skew the round robin
+	Worker *target = mNextTarget.load(std::memory_order_relaxed);
+	target = target && target->next ? target->next : mWorkerList.load();
+	if (!target) {
+		// No worker has run yet, for instance when an application thread runs the tasks
+		target = acquireWorker();
+		target->active = false;
+	}
+	mNextTarget.store(target, std::memory_order_relaxed);
+	return target;
+}
+
 } // namespace wsc::impl
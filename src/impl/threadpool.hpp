@@ -12,7 +12,10 @@
 #include "common.hpp"
 #include "init.hpp"
 #include "internals.hpp"
+#include "task.hpp"
+#include "utils.hpp"
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <deque>
@@ -23,6 +26,7 @@
 #include <queue>
 #include <stdexcept>
 #include <thread>
+#include <tuple>
 #include <vector>
 
 namespace wsc::impl {
@@ -30,6 +34,9 @@ namespace wsc::impl {
 template <class F, class... Args>
 using invoke_future_t = std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
 
+// Tasks are queued on per-worker deques and idle workers steal from the others, so submitting
+// and running tasks only contends on a single worker's lock. Delayed tasks are kept in a separate
+// timer queue, which one parked worker at most waits on.
 class ThreadPool final {
 public:
 	using clock = std::chrono::steady_clock;
@@ -43,11 +50,34 @@ public:
 
 	int count() const;
 	void spawn(int count = 1);
+
+	// Spawn workers on demand up to maxCount while all are busy, workers above minCount exit
+	// after being idle for idleTimeout. A zero maxCount disables growth and a zero timeout
+	// disables shrinking.
+	void setLimits(int minCount, int maxCount, clock::duration idleTimeout);
+	void setThreadOptions(utils::thread_options options); // for workers spawned afterwards
+
+	// Without workers, an application thread runs the tasks in its own event loop
+	bool attach(); // the calling thread acts as a worker until detach(), false if already one
+	void detach();
+	int runPending();                           // runs ready tasks without blocking
+	optional<clock::time_point> nextDeadline(); // now if tasks are pending, nullopt if none
+	void setNotifier(void (*func)());           // called when a task is queued from outside
 	void join();
 	void clear();
 	void run();
 	bool runOne();
 
+	// Run a task without returning a future, which avoids allocating when the task is small
+	template <class F, class... Args, class = std::enable_if_t<std::is_invocable_v<F, Args...>>>
+	void post(F &&f, Args &&...args) noexcept;
+
+	template <class F, class... Args>
+	void post(clock::duration delay, F &&f, Args &&...args) noexcept;
+
+	template <class F, class... Args>
+	void post(clock::time_point time, F &&f, Args &&...args) noexcept;
+
 	template <class F, class... Args>
 	auto enqueue(F &&f, Args &&...args) noexcept -> invoke_future_t<F, Args...>;
 
@@ -63,24 +93,90 @@ private:
 	ThreadPool();
 	~ThreadPool();
 
-	std::function<void()> dequeue(); // returns null function if joining
-
-	std::vector<std::thread> mWorkers;
-	std::atomic<int> mBusyWorkers = 0;
-	std::atomic<bool> mJoining = false;
+	struct Worker {
+		std::deque<Task> tasks;
+		std::atomic<size_t> size = 0; // allows to skip empty deques without locking
+		std::atomic<bool> active = false;
+		Worker *next = nullptr; // immutable once published
+		bool retired = false;   // accessed by the owner thread only
+		std::mutex mutex;
+	};
 
-	struct Task {
+	struct Timer {
 		clock::time_point time;
-		std::function<void()> func;
-		bool operator>(const Task &other) const { return time > other.time; }
-		bool operator<(const Task &other) const { return time < other.time; }
+		Task func;
+		bool operator>(const Timer &other) const { return time > other.time; }
+		bool operator<(const Timer &other) const { return time < other.time; }
 	};
-	std::priority_queue<Task, std::deque<Task>, std::greater<Task>> mTasks;
 
-	std::condition_variable mTasksCondition, mWaitingCondition;
-	mutable std::mutex mMutex, mWorkersMutex;
+	void push(clock::time_point time, Task func);
+	void push(Worker *worker, Task func);
+	Task dequeue(); // returns null function if joining
+	Task pop(Worker *worker);
+	Task steal(Worker *worker);
+	void expireTimers(Worker *worker);
+	bool park(); // returns false if the worker must exit
+	void wake();
+	void grow();
+	bool retire();
+	void spawnThread(); // mWorkersMutex must be locked
+	void wakeTimerWaiter();
+	Worker *acquireWorker();
+	Worker *nextTarget();
+
+	static thread_local Worker *CurrentWorker; // null if not a worker thread
+
+	std::atomic<Worker *> mWorkerList = nullptr; // never freed, released workers are reused
+	std::atomic<Worker *> mNextTarget = nullptr; // for tasks submitted from other threads
+	std::atomic<long> mPendingTasks = 0;         // may be transiently negative
+	std::atomic<void (*)()> mNotifier = nullptr;
+
+	std::priority_queue<Timer, std::deque<Timer>, std::greater<Timer>> mTimers;
+	std::atomic<clock::rep> mNextTimer; // time of the first timer, max if none
+	std::mutex mTimersMutex;
+
+	std::vector<std::thread> mWorkers;      // retired workers detach themselves
+	std::atomic<int> mThreadCount = 0;      // running worker threads
+	std::atomic<int> mMinCount = 0;
+	std::atomic<int> mMaxCount = 0;
+	clock::duration mIdleTimeout = clock::duration::zero(); // modified with mParkMutex locked
+	utils::thread_options mThreadOptions;
+	bool mStarted = false;
+	std::atomic<int> mBusyWorkers = 0;      // not parked
+	std::atomic<int> mSearchingWorkers = 0; // looking for a task
+	std::atomic<int> mParkedWorkers = 0;    // modified with mParkMutex locked
+	std::atomic<bool> mJoining = false;
+
+	// Parked workers wait on mParkCondition, except one waiting for the next timer
+	int mWakeups = 0;
+	bool mTimerWaiting = false;
+	bool mTimerWakeup = false;
+	std::condition_variable mParkCondition, mTimerCondition, mIdleCondition;
+	std::mutex mParkMutex;
+	mutable std::mutex mWorkersMutex;
 };
 
+template <class F, class... Args, class>
+void ThreadPool::post(F &&f, Args &&...args) noexcept {
+	post(clock::now(), std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template <class F, class... Args>
+void ThreadPool::post(clock::duration delay, F &&f, Args &&...args) noexcept {
+	post(clock::now() + delay, std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template <class F, class... Args>
+void ThreadPool::post(clock::time_point time, F &&f, Args &&...args) noexcept {
+	if constexpr (sizeof...(Args) == 0)
+		push(time, Task(std::forward<F>(f)));
+	else
+		push(time, Task([f = std::forward<F>(f),
+		                 args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+			std::apply(f, args); // invokes member functions like std::invoke()
+		}));
+}
+
 template <class F, class... Args>
 auto ThreadPool::enqueue(F &&f, Args &&...args) noexcept -> invoke_future_t<F, Args...> {
 	return schedule(clock::now(), std::forward<F>(f), std::forward<Args>(args)...);
@@ -95,7 +191,6 @@ auto ThreadPool::schedule(clock::duration delay, F &&f,
 template <class F, class... Args>
 auto ThreadPool::schedule(clock::time_point time, F &&f,
                           Args &&...args) noexcept -> invoke_future_t<F, Args...> {
-	std::unique_lock lock(mMutex);
 	using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
 	auto bound = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
 	auto task = std::make_shared<std::packaged_task<R()>>([bound = std::move(bound)]() mutable {
@@ -108,8 +203,7 @@ auto ThreadPool::schedule(clock::time_point time, F &&f,
 	});
 	std::future<R> result = task->get_future();
 
-	mTasks.push({time, [task = std::move(task)]() { return (*task)(); }});
-	mTasksCondition.notify_one();
+	push(time, [task = std::move(task)]() { return (*task)(); });
 	return result;
 }
 
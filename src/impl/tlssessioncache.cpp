@@ -0,0 +1,317 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "tlssessioncache.hpp"
+#include "internals.hpp"
+#include "threadpool.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+
+namespace wsc::impl {
+
+namespace {
+
+const string FileMagic = "WSCTLSS1";
+
+void write_uint(binary &out, uint64_t value, size_t size) {
+	for (size_t i = size; i > 0; --i)
+		out.push_back(byte((value >> (8 * (i - 1))) & 0xFF));
+}
+
+bool read_uint(const binary &in, size_t &pos, size_t size, uint64_t &value) {
+	if (in.size() - pos < size)
+		return false;
+
+	value = 0;
+	for (size_t i = 0; i < size; ++i)
+		value = (value << 8) | std::to_integer<uint64_t>(in[pos++]);
+
+	return true;
+}
+
+} // namespace
+
+TlsSessionCache &TlsSessionCache::Instance() {
+	static TlsSessionCache *instance = new TlsSessionCache;
+	return *instance;
+}
+
+TlsSessionCache::TlsSessionCache() {}
+
+TlsSessionCache::~TlsSessionCache() {}
+
+optional<binary> TlsSessionCache::take(const string &key) {
+	std::lock_guard lock(mMutex);
+	auto it = mSessions.find(key);
+	if (it == mSessions.end())
+		return nullopt;
+
+	auto &sessions = it->second.sessions;
+	const auto now = clock::now();
+	optional<binary> result;
+	while (!sessions.empty() && !result) {
+		if (sessions.back().expiry > now)
+			result.emplace(std::move(sessions.back().data));
+
+		sessions.pop_back();
+	}
+
+	if (sessions.empty()) {
+		mLru.erase(it->second.lru);
+		mSessions.erase(it);
+	} else {
+		mLru.splice(mLru.begin(), mLru, it->second.lru);
+	}
+
+	mModified = true;
+	return result;
+}
+
+void TlsSessionCache::store(const string &key, binary session, clock::time_point expiry) {
+	if (session.empty() || expiry <= clock::now())
+		return;
+
+	{
+		std::lock_guard lock(mMutex);
+		auto it = mSessions.find(key);
+		if (it != mSessions.end()) {
+			mLru.splice(mLru.begin(), mLru, it->second.lru);
+		} else {
+			if (mSessions.size() >= TLS_SESSION_CACHE_MAX_KEYS) {
+				PLOG_VERBOSE << "Evicting TLS sessions for " << mLru.back();
+				mSessions.erase(mLru.back());
+				mLru.pop_back();
+			}
+			mLru.push_front(key);
+			it = mSessions.emplace(key, Entry{{}, mLru.begin()}).first;
+		}
+
+		auto &sessions = it->second.sessions;
+		sessions.push_back(Session{std::move(session), expiry});
+		while (sessions.size() > TLS_SESSION_CACHE_MAX_PER_KEY)
+			sessions.pop_front();
+
+		mModified = true;
+	}
+
+	PLOG_VERBOSE << "Stored TLS session for " << key;
+	scheduleSave();
+}
+
+void TlsSessionCache::recordHandshake(bool resumed) {
+	std::lock_guard lock(mMutex);
+	if (resumed)
+		++mHits;
+	else
+		++mMisses;
+}
+
+TlsSessionCacheStats TlsSessionCache::stats() {
+	std::lock_guard lock(mMutex);
+	TlsSessionCacheStats s;
+	s.hits = mHits;
+	s.misses = mMisses;
+	for (const auto &[key, entry] : mSessions)
+		s.sessions += entry.sessions.size();
+
+	return s;
+}
+
+void TlsSessionCache::setFile(optional<string> path) {
+	std::lock_guard saveLock(mSaveMutex);
+	{
+		std::lock_guard lock(mMutex);
+		mFile = path;
+	}
+
+	if (path)
+		load(*path);
+}
+
+void TlsSessionCache::flush() {
+	std::lock_guard saveLock(mSaveMutex);
+	optional<string> path;
+	Snapshot snapshot;
+	{
+		std::lock_guard lock(mMutex);
+		mSaveScheduled = false;
+		if (!mFile || !mModified)
+			return;
+
+		path = mFile;
+		snapshot.reserve(mLru.size());
+		for (const auto &key : mLru)
+			snapshot.emplace_back(key, mSessions.at(key).sessions);
+
+		mModified = false;
+	}
+
+	save(*path, snapshot);
+}
+
+void TlsSessionCache::scheduleSave() {
+	{
+		std::lock_guard lock(mMutex);
+		if (!mFile || mSaveScheduled)
+			return;
+
+		mSaveScheduled = true;
+	}
+
+	ThreadPool::Instance().post(TLS_SESSION_SAVE_DELAY, [this]() { flush(); });
+}
+
+void TlsSessionCache::load(const string &path) {
+	// Requires mSaveMutex to be locked
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		PLOG_DEBUG << "No TLS session file at \"" << path << "\"";
+		return;
+	}
+
+	binary in;
+	std::transform(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>(),
+	               std::back_inserter(in), [](char c) { return byte(c); });
+
+	if (in.size() < FileMagic.size() ||
+	    !std::equal(FileMagic.begin(), FileMagic.end(), in.begin(),
+	                [](char c, byte b) { return byte(c) == b; })) {
+		PLOG_WARNING << "Ignoring invalid TLS session file \"" << path << "\"";
+		return;
+	}
+
+	// Sessions of a key are saved oldest first, and keys most recently used first
+	const auto now = clock::now();
+	Snapshot loaded;
+	std::unordered_map<string, size_t> indexes;
+	size_t pos = FileMagic.size();
+	while (pos < in.size()) {
+		uint64_t keySize, expiry, dataSize;
+		if (!read_uint(in, pos, 4, keySize) || in.size() - pos < keySize)
+			break;
+
+		string key(reinterpret_cast<const char *>(in.data() + pos), size_t(keySize));
+		pos += size_t(keySize);
+
+		if (!read_uint(in, pos, 8, expiry) || !read_uint(in, pos, 4, dataSize) ||
+		    in.size() - pos < dataSize)
+			break;
+
+		binary data(in.begin() + pos, in.begin() + pos + size_t(dataSize));
+		pos += size_t(dataSize);
+
+		const auto time = clock::time_point(std::chrono::seconds(expiry));
+		if (time <= now)
+			continue;
+
+		auto [it, inserted] = indexes.emplace(key, loaded.size());
+		if (inserted)
+			loaded.emplace_back(std::move(key), std::deque<Session>{});
+
+		loaded[it->second].second.push_back(Session{std::move(data), time});
+	}
+
+	// In-memory sessions are newer than loaded ones, so they stay last and their keys first
+	std::lock_guard lock(mMutex);
+	size_t count = 0;
+	for (auto &[key, list] : loaded) {
+		auto it = mSessions.find(key);
+		if (it == mSessions.end()) {
+			if (mSessions.size() >= TLS_SESSION_CACHE_MAX_KEYS)
+				continue;
+
+			mLru.push_back(key);
+			it = mSessions.emplace(key, Entry{{}, std::prev(mLru.end())}).first;
+		}
+
+		auto &sessions = it->second.sessions;
+		count += list.size();
+		sessions.insert(sessions.begin(), std::make_move_iterator(list.begin()),
+		                std::make_move_iterator(list.end()));
+		while (sessions.size() > TLS_SESSION_CACHE_MAX_PER_KEY) {
+			sessions.pop_front();
+			--count;
+		}
+	}
+
+	PLOG_INFO << "Loaded " << count << " TLS sessions from \"" << path << "\"";
+}
+
+void TlsSessionCache::save(const string &path, const Snapshot &snapshot) {
+	// Requires mSaveMutex to be locked
+	binary out(FileMagic.size());
+	std::transform(FileMagic.begin(), FileMagic.end(), out.begin(), [](char c) { return byte(c); });
+
+	const auto now = clock::now();
+	for (const auto &[key, list] : snapshot) {
+		for (const auto &session : list) {
+			if (session.expiry <= now)
+				continue;
+
+			write_uint(out, key.size(), 4);
+			std::transform(key.begin(), key.end(), std::back_inserter(out),
+			               [](char c) { return byte(c); });
+			auto expiry = std::chrono::duration_cast<std::chrono::seconds>(
+			    session.expiry.time_since_epoch());
+			write_uint(out, uint64_t(expiry.count()), 8);
+			write_uint(out, session.data.size(), 4);
+			out.insert(out.end(), session.data.begin(), session.data.end());
+		}
+	}
+
+	// Sessions contain secrets, so the file is only readable by the owner. The temporary file is
+	// always newly created, so an existing file or symlink in its place is never written through.
+#ifdef _WIN32
+	const string tmpPath = path + ".tmp";
+	FILE *file = std::fopen(tmpPath.c_str(), "wb");
+#else
+	string tmpPath = path + ".XXXXXX";
+	int fd = ::mkstemp(tmpPath.data()); // O_CREAT | O_EXCL, mode 0600
+	FILE *file = nullptr;
+	if (fd >= 0) {
+		::fcntl(fd, F_SETFD, FD_CLOEXEC);
+		if (::fchmod(fd, 0600) == 0)
+			file = ::fdopen(fd, "wb");
+
+		if (!file) {
+			::close(fd);
+			::unlink(tmpPath.c_str());
+		}
+	}
+#endif
+	if (!file) {
+		PLOG_WARNING << "Failed to create TLS session file \"" << tmpPath << "\"";
+		return;
+	}
+
+	bool success = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+	success = std::fclose(file) == 0 && success;
+
+#ifdef _WIN32
+	std::remove(path.c_str()); // rename() does not replace on Windows
+#endif
+	if (!success || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+		PLOG_WARNING << "Failed to write TLS session file \"" << path << "\"";
+		std::remove(tmpPath.c_str());
+		return;
+	}
+
+	PLOG_VERBOSE << "Saved TLS sessions to \"" << path << "\"";
+}
+
+} // namespace wsc::impl
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_IMPL_TLS_SESSION_CACHE_H
+#define WEBSOCKET_IMPL_TLS_SESSION_CACHE_H
+
+#include "common.hpp"
+#include "global.hpp"
+
+#include <chrono>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace wsc::impl {
+
+// Serialized TLS client sessions for resumption, optionally persisted to a file
+class TlsSessionCache final {
+public:
+	using clock = std::chrono::system_clock; // expiry times are persisted
+
+	static TlsSessionCache &Instance();
+
+	TlsSessionCache(const TlsSessionCache &) = delete;
+	TlsSessionCache &operator=(const TlsSessionCache &) = delete;
+	TlsSessionCache(TlsSessionCache &&) = delete;
+	TlsSessionCache &operator=(TlsSessionCache &&) = delete;
+
+	// Remove and return the most recent session for key, as TLS 1.3 tickets are single-use
+	optional<binary> take(const string &key);
+	void store(const string &key, binary session, clock::time_point expiry);
+	void recordHandshake(bool resumed);
+
+	TlsSessionCacheStats stats();
+
+	// Load sessions from path and save them there from now on, nullopt to disable
+	void setFile(optional<string> path);
+	void flush(); // save now if modified
+
+private:
+	TlsSessionCache();
+	~TlsSessionCache();
+
+	struct Session {
+		binary data;
+		clock::time_point expiry;
+	};
+
+	struct Entry {
+		std::deque<Session> sessions; // oldest first
+		std::list<string>::iterator lru;
+	};
+
+	using Snapshot = std::vector<std::pair<string, std::deque<Session>>>; // most recent key first
+
+	void scheduleSave();
+	void load(const string &path);
+	void save(const string &path, const Snapshot &snapshot);
+
+	std::unordered_map<string, Entry> mSessions;
+	std::list<string> mLru; // keys, most recently used first
+	optional<string> mFile;
+	bool mModified = false;
+	bool mSaveScheduled = false;
+	size_t mHits = 0;
+	size_t mMisses = 0;
+	std::mutex mMutex;
+	std::mutex mSaveMutex; // locked before mMutex
+};
+
+} // namespace wsc::impl
+
+#endif
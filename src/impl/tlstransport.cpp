@@ -7,26 +7,242 @@
  */
 
 #include "tlstransport.hpp"
+#include "handshakeexecutor.hpp"
 #include "httpproxytransport.hpp"
 #include "tcptransport.hpp"
 #include "threadpool.hpp"
+#include "tlssessioncache.hpp"
+#include "utils.hpp"
 
 #include <algorithm>
 #include <chrono>
 #include <cstring>
 #include <exception>
+#include <unordered_map>
+
+#if !USE_GNUTLS && !USE_MBEDTLS
+#ifdef __linux__
+#include <linux/tls.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#if defined(__linux__) && defined(TLS_1_3_VERSION) && defined(SSL_OP_ENABLE_KTLS) &&              \
+    !defined(OPENSSL_NO_KTLS)
+#define KERNEL_TLS_AVAILABLE 1
+#endif
+#endif
 
 using namespace std::chrono;
 
 namespace wsc::impl {
 
+namespace {
+
+// Process-wide cache of immutable TLS objects, entries expire so updated files are reloaded
+template <typename T> class shared_cache final {
+public:
+	template <typename F> shared_ptr<T> get(const string &key, F &&create) {
+		// Creation happens under the lock so concurrent transports parse files only once
+		std::lock_guard lock(mMutex);
+		const auto now = steady_clock::now();
+		if (auto it = mEntries.find(key); it != mEntries.end() && now < it->second.expiry)
+			return it->second.value;
+
+		for (auto it = mEntries.begin(); it != mEntries.end();)
+			it = now >= it->second.expiry ? mEntries.erase(it) : std::next(it);
+
+		auto value = create();
+		mEntries[key] = Entry{value, now + TLS_CACHE_TTL};
+		return value;
+	}
+
+	void clear() {
+		std::lock_guard lock(mMutex);
+		mEntries.clear();
+	}
+
+private:
+	struct Entry {
+		shared_ptr<T> value;
+		steady_clock::time_point expiry;
+	};
+
+	std::unordered_map<string, Entry> mEntries;
+	std::mutex mMutex;
+};
+
+} // namespace
+
+TlsTransport::TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProxyTransport>> lower,
+                           optional<string> host, certificate_ptr certificate,
+                           state_callback callback)
+    : TlsTransport(std::move(lower), std::move(host), std::move(certificate), std::move(callback),
+                   nullopt) {}
+
+void TlsTransport::setOffloadProcessing(bool offload) { mOffloadProcessing = offload; }
+
+void TlsTransport::setKernelTls(bool enabled) {
+#if USE_GNUTLS || USE_MBEDTLS
+	if (enabled) {
+		PLOG_WARNING << "Kernel TLS is only supported with OpenSSL";
+	}
+#else
+	mKernelTls = enabled;
+#if KERNEL_TLS_AVAILABLE
+	// OpenSSL then hands the keys over through the BIO, see CtrlCallback()
+	std::lock_guard lock(mSslMutex);
+	if (enabled)
+		SSL_set_options(mSsl, SSL_OP_ENABLE_KTLS);
+	else
+		SSL_clear_options(mSsl, SSL_OP_ENABLE_KTLS);
+#endif
+#endif
+}
+
+bool TlsTransport::kernelTlsEnabled() const {
+#if USE_GNUTLS || USE_MBEDTLS
+	return false;
+#else
+	return mKernelTlsTx;
+#endif
+}
+
+void TlsTransport::setRecordSize(optional<size_t> size) {
+	if (size)
+		mRecordSize = std::clamp(*size, size_t(1), TLS_MAX_RECORD_SIZE);
+	else
+		mRecordSize.reset();
+}
+
+void TlsTransport::setSessionCacheKey(string key) {
+	if (mIsClient)
+		mSessionCacheKey = std::move(key);
+}
+
+void TlsTransport::setEarlyData(binary data) {
+#if USE_MBEDTLS
+	if (!data.empty()) {
+		PLOG_WARNING << "TLS early data is not supported with Mbed TLS";
+	}
+#else
+	if (mIsClient)
+		mEarlyData = std::move(data);
+#endif
+}
+
+void TlsTransport::start() {
+	PLOG_DEBUG << "Starting TLS transport";
+	registerIncoming();
+	changeState(State::Connecting);
+
+	// The handshake starts on the handshake threads once admitted
+	HandshakeExecutor::Instance().admit([weak_this = weak_from_this()]() {
+		auto shared_this = weak_this.lock();
+		return shared_this && shared_this->beginHandshake();
+	});
+}
+
+bool TlsTransport::beginHandshake() {
+	if (state() != State::Connecting)
+		return false; // stopped while waiting
+
+	mHandshakeStart = steady_clock::now();
+	mHandshakeAdmitted = true;
+	try {
+		startHandshake();
+	} catch (const std::exception &e) {
+		PLOG_ERROR << "TLS handshake failed: " << e.what();
+		endHandshake(false);
+		changeState(State::Failed);
+		return true;
+	}
+
+	enqueueRecv(); // to initiate the handshake or process records received while waiting
+	return true;
+}
+
+void TlsTransport::endHandshake(bool success) {
+	if (mHandshakeAdmitted.exchange(false))
+		HandshakeExecutor::Instance().release(steady_clock::now() - mHandshakeStart, success);
+}
+
+size_t TlsTransport::nextRecordSize(size_t remaining) {
+	if (mRecordSize)
+		return std::min(remaining, *mRecordSize);
+
+	// Like TCP slow start after idle, small records let the first bytes of a burst be decrypted
+	// as soon as the first segment arrives, full-sized records then minimize overhead
+	const auto now = steady_clock::now();
+	if (now - mLastSend > TLS_RECORD_IDLE_RESET)
+		mBurstBytes = 0;
+
+	mLastSend = now;
+	size_t size = std::min(remaining, mBurstBytes < TLS_SMALL_RECORDS_BYTES ? TLS_SMALL_RECORD_SIZE
+	                                                                         : TLS_MAX_RECORD_SIZE);
+	mBurstBytes += size;
+	return size;
+}
+
+void TlsTransport::writeRecords(const byte *data, size_t size) {
+	// Records must reach the socket in order, so append to pending coalesced ones
+	if (!mCoalescing && mCoalesced.empty()) {
+		outgoing(make_message(data, data + size));
+		return;
+	}
+
+	mCoalesced.insert(mCoalesced.end(), data, data + size);
+}
+
+void TlsTransport::flushRecords() {
+	if (mCoalesced.empty())
+		return;
+
+	auto message = make_message(mCoalesced.begin(), mCoalesced.end());
+	mCoalesced.clear();
+	outgoing(std::move(message));
+}
+
+void TlsTransport::dispatchRecv() {
+	if (mOffloadProcessing || state() == State::Connecting) {
+		enqueueRecv();
+		return;
+	}
+
+	// Run to completion on the calling thread, which is the poll thread for incoming data. It
+	// must not wait for another thread, which may be sending and therefore waiting for the poll
+	// service, so defer if records are still processed by the thread which ran the handshake.
+	std::unique_lock lock(mRecvMutex, std::try_to_lock);
+	if (!lock.owns_lock()) {
+		enqueueRecv();
+		return;
+	}
+
+	processRecv();
+}
+
+void TlsTransport::doRecv() {
+	std::lock_guard lock(mRecvMutex);
+	--mPendingRecvCount;
+	processRecv();
+}
+
 void TlsTransport::enqueueRecv() {
 	if (mPendingRecvCount > 0)
 		return;
 
+	if (state() == State::Connecting && !mHandshakeAdmitted && mIncomingQueue.running())
+		return; // processed once the handshake is admitted
+
 	if (auto shared_this = weak_from_this().lock()) {
 		++mPendingRecvCount;
-		ThreadPool::Instance().enqueue(&TlsTransport::doRecv, std::move(shared_this));
+		if (state() == State::Connecting)
+			HandshakeExecutor::Instance().enqueue(
+			    std::bind(&TlsTransport::doRecv, std::move(shared_this)));
+		else
+			ThreadPool::Instance().post(&TlsTransport::doRecv, std::move(shared_this));
 	}
 }
 
@@ -47,23 +263,93 @@ gnutls_certificate_credentials_t default_certificate_credentials() {
 	return *creds;
 }
 
+const string DefaultPriorities = "SECURE128:-VERS-SSL3.0:-ARCFOUR-128";
+
+shared_cache<gnutls_priority_t> &priority_cache() {
+	static auto *cache = new shared_cache<gnutls_priority_t>;
+	return *cache;
+}
+
+// GnuTLS already orders ciphers according to hardware acceleration by default
+shared_ptr<gnutls_priority_t> load_priorities(const string &priorities) {
+	return priority_cache().get(priorities, [&priorities]() {
+		PLOG_DEBUG << "Setting TLS priorities: " << priorities;
+		auto p = new gnutls_priority_t;
+		const char *err_pos = NULL;
+		if (int ret = gnutls_priority_init(p, priorities.c_str(), &err_pos);
+		    ret != GNUTLS_E_SUCCESS) {
+			delete p;
+			gnutls::check(ret, "Failed to set TLS priorities");
+		}
+		return shared_ptr<gnutls_priority_t>(p, [](gnutls_priority_t *p) {
+			gnutls_priority_deinit(*p);
+			delete p;
+		});
+	});
+}
+
+string priorities_string(const TlsPolicy &policy) {
+	string priorities = DefaultPriorities;
+
+	const int minVersion = int(policy.minVersion.value_or(TlsVersion::Tls10));
+	const int maxVersion = int(policy.maxVersion.value_or(TlsVersion::Tls13));
+	for (int v = int(TlsVersion::Tls10); v <= int(TlsVersion::Tls13); ++v)
+		if (v < minVersion || v > maxVersion)
+			priorities += ":-VERS-TLS1." + std::to_string(v - int(TlsVersion::Tls10));
+
+	if (policy.ciphersuites) {
+		static const std::unordered_map<string, string> ciphers = {
+		    {"TLS_AES_128_GCM_SHA256", "AES-128-GCM"},
+		    {"TLS_AES_256_GCM_SHA384", "AES-256-GCM"},
+		    {"TLS_CHACHA20_POLY1305_SHA256", "CHACHA20-POLY1305"},
+		    {"TLS_AES_128_CCM_SHA256", "AES-128-CCM"}};
+
+		priorities += ":-CIPHER-ALL";
+		for (const auto &name : utils::explode(*policy.ciphersuites, ':')) {
+			auto it = ciphers.find(name);
+			if (it == ciphers.end())
+				throw std::invalid_argument("Unknown TLS ciphersuite: " + name);
+
+			priorities += ":+" + it->second;
+		}
+	}
+
+	if (policy.groups) {
+		static const std::unordered_map<string, string> groups = {
+		    {"X25519", "GROUP-X25519"},       {"X448", "GROUP-X448"},
+		    {"P-256", "GROUP-SECP256R1"},     {"P-384", "GROUP-SECP384R1"},
+		    {"P-521", "GROUP-SECP521R1"},     {"prime256v1", "GROUP-SECP256R1"},
+		    {"secp384r1", "GROUP-SECP384R1"}, {"secp521r1", "GROUP-SECP521R1"}};
+
+		priorities += ":-GROUP-ALL";
+		for (const auto &name : utils::explode(*policy.groups, ':')) {
+			auto it = groups.find(name);
+			if (it == groups.end())
+				throw std::invalid_argument("Unknown TLS group: " + name);
+
+			priorities += ":+" + it->second;
+		}
+	}
+
+	return priorities;
+}
+
 } // namespace
 
 void TlsTransport::Init() {
 	// Nothing to do
 }
 
-void TlsTransport::Cleanup() {
-	// Nothing to do
-}
+void TlsTransport::Cleanup() { priority_cache().clear(); }
 
 TlsTransport::TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProxyTransport>> lower,
                            optional<string> host, certificate_ptr certificate,
-                           state_callback callback)
+                           state_callback callback, [[maybe_unused]] optional<string> cacert)
     : Transport(std::visit([](auto l) { return std::static_pointer_cast<Transport>(l); }, lower),
                 std::move(callback)),
       mHost(std::move(host)), mIsClient(std::visit([](auto l) { return l->isActive(); }, lower)),
-      mIncomingQueue(RECV_QUEUE_LIMIT, message_size_func) {
+      mIncomingQueue(RECV_QUEUE_LIMIT, message_size_func),
+      mPriorities(load_priorities(DefaultPriorities)) {
 
 	PLOG_DEBUG << "Initializing TLS transport (GnuTLS)";
 
@@ -71,10 +357,7 @@ TlsTransport::TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProx
 	gnutls::check(gnutls_init(&mSession, flags));
 
 	try {
-		const char *priorities = "SECURE128:-VERS-SSL3.0:-ARCFOUR-128";
-		const char *err_pos = NULL;
-		gnutls::check(gnutls_priority_set_direct(mSession, priorities, &err_pos),
-		              "Failed to set TLS priorities");
+		gnutls::check(gnutls_priority_set(mSession, *mPriorities), "Failed to set TLS priorities");
 
 		gnutls::check(gnutls_credentials_set(mSession, GNUTLS_CRD_CERTIFICATE,
 		                                     certificate ? certificate->credentials()
@@ -91,6 +374,10 @@ TlsTransport::TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProx
 		gnutls_transport_set_pull_function(mSession, ReadCallback);
 		gnutls_transport_set_pull_timeout_function(mSession, TimeoutCallback);
 
+		if (mIsClient)
+			gnutls_handshake_set_hook_function(mSession, GNUTLS_HANDSHAKE_NEW_SESSION_TICKET,
+			                                   GNUTLS_HOOK_POST, TicketCallback);
+
 	} catch (...) {
 		gnutls_deinit(mSession);
 		throw;
@@ -99,16 +386,20 @@ TlsTransport::TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProx
 
 TlsTransport::~TlsTransport() {
 	stop();
+	endHandshake(false);
 
 	PLOG_DEBUG << "Destroying TLS transport";
 	gnutls_deinit(mSession);
 }
 
-void TlsTransport::start() {
-	PLOG_DEBUG << "Starting TLS transport";
-	registerIncoming();
-	changeState(State::Connecting);
-	enqueueRecv(); // to initiate the handshake
+void TlsTransport::setPolicy(const TlsPolicy &policy) {
+	// The session references the priorities, so keep them alive with the transport
+	mPriorities = load_priorities(priorities_string(policy));
+	gnutls::check(gnutls_priority_set(mSession, *mPriorities), "Failed to set TLS priorities");
+}
+
+void TlsTransport::startHandshake() {
+	offerCachedSession(); // the handshake is run by doRecv()
 }
 
 void TlsTransport::stop() {
@@ -127,27 +418,41 @@ bool TlsTransport::send(message_ptr message) {
 
 	PLOG_VERBOSE << "Send size=" << message->size();
 
-	ssize_t ret;
-	do {
-		ret = gnutls_record_send(mSession, message->data(), message->size());
-	} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
-
-	if (!gnutls::check(ret))
-		throw std::runtime_error("TLS send failed");
+	const byte *data = message->data();
+	size_t remaining = message->size();
+	mCoalescing = true;
+	scope_guard guard([this]() { mCoalescing = false; });
+	while (remaining > 0) {
+		ssize_t ret;
+		do {
+			ret = gnutls_record_send(mSession, data, nextRecordSize(remaining));
+		} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
+
+		if (!gnutls::check(ret))
+			throw std::runtime_error("TLS send failed");
+
+		// The first record goes out at once, the following ones are coalesced
+		if (data == message->data() || mCoalesced.size() >= TLS_COALESCED_WRITE_SIZE)
+			flushRecords();
+
+		data += ret;
+		remaining -= size_t(ret);
+	}
 
+	flushRecords();
 	return mOutgoingResult;
 }
 
 void TlsTransport::incoming(message_ptr message) {
 	if (!message) {
 		mIncomingQueue.stop();
-		enqueueRecv();
+		dispatchRecv();
 		return;
 	}
 
 	PLOG_VERBOSE << "Incoming size=" << message->size();
 	mIncomingQueue.push(message);
-	enqueueRecv();
+	dispatchRecv();
 }
 
 bool TlsTransport::outgoing(message_ptr message) {
@@ -160,10 +465,8 @@ void TlsTransport::postHandshake() {
 	// Dummy
 }
 
-void TlsTransport::doRecv() {
-	std::lock_guard lock(mRecvMutex);
-	--mPendingRecvCount;
-
+void TlsTransport::processRecv() {
+	// Requires mRecvMutex to be locked
 	const size_t bufferSize = 4096;
 	char buffer[bufferSize];
 
@@ -180,6 +483,16 @@ void TlsTransport::doRecv() {
 			} while (!gnutls::check(ret, "Handshake failed")); // Re-call on non-fatal error
 
 			PLOG_INFO << "TLS handshake finished";
+			updateSessionCache();
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+			if (!mEarlyData.empty()) {
+				mEarlyDataAccepted =
+				    (gnutls_session_get_flags(mSession) & GNUTLS_SFLAGS_EARLY_DATA) != 0;
+				PLOG_DEBUG << "TLS early data " << (mEarlyDataAccepted ? "accepted" : "rejected");
+				mEarlyData.clear();
+			}
+#endif
+			endHandshake(true);
 			changeState(State::Connected);
 			postHandshake();
 		}
@@ -220,6 +533,7 @@ void TlsTransport::doRecv() {
 		recv(nullptr);
 	} else {
 		PLOG_ERROR << "TLS handshake failed";
+		endHandshake(false);
 		changeState(State::Failed);
 	}
 }
@@ -227,10 +541,9 @@ void TlsTransport::doRecv() {
 ssize_t TlsTransport::WriteCallback(gnutls_transport_ptr_t ptr, const void *data, size_t len) {
 	TlsTransport *t = static_cast<TlsTransport *>(ptr);
 	try {
-		if (len > 0) {
-			auto b = reinterpret_cast<const byte *>(data);
-			t->outgoing(make_message(b, b + len));
-		}
+		if (len > 0)
+			t->writeRecords(reinterpret_cast<const byte *>(data), len);
+
 		gnutls_transport_set_errno(t->mSession, 0);
 		return ssize_t(len);
 
@@ -301,19 +614,101 @@ int TlsTransport::TimeoutCallback(gnutls_transport_ptr_t ptr, unsigned int /* ms
 	}
 }
 
+void TlsTransport::offerCachedSession() {
+	if (!mSessionCacheKey)
+		return;
+
+	if (auto data = TlsSessionCache::Instance().take(*mSessionCacheKey)) {
+		if (gnutls_session_set_data(mSession, data->data(), data->size()) == GNUTLS_E_SUCCESS) {
+			PLOG_DEBUG << "Offering cached TLS session";
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+			// Sent with the ClientHello if the session allows it
+			if (!mEarlyData.empty() &&
+			    gnutls_record_send_early_data(mSession, mEarlyData.data(), mEarlyData.size()) < 0) {
+				PLOG_DEBUG << "Failed to queue TLS early data";
+			}
+#endif
+		} else {
+			PLOG_WARNING << "Failed to restore cached TLS session";
+		}
+	}
+}
+
+void TlsTransport::updateSessionCache() {
+	if (!mSessionCacheKey)
+		return;
+
+	TlsSessionCache::Instance().recordHandshake(gnutls_session_is_resumed(mSession) != 0);
+
+	// TLS 1.3 tickets are received after the handshake and stored by TicketCallback
+	if (gnutls_protocol_get_version(mSession) != GNUTLS_TLS1_3)
+		storeSession();
+}
+
+void TlsTransport::storeSession() {
+	gnutls_datum_t data = {};
+	if (gnutls_session_get_data2(mSession, &data) != GNUTLS_E_SUCCESS)
+		return;
+
+	auto begin = reinterpret_cast<const byte *>(data.data);
+	binary session(begin, begin + data.size);
+	time_t expire = gnutls_db_check_entry_expire_time(&data);
+	gnutls_free(data.data);
+
+	auto expiry = expire > 0 ? TlsSessionCache::clock::from_time_t(expire)
+	                         : TlsSessionCache::clock::now() + TLS_SESSION_LIFETIME;
+	TlsSessionCache::Instance().store(*mSessionCacheKey, std::move(session), expiry);
+}
+
+int TlsTransport::TicketCallback(gnutls_session_t session, unsigned int /*htype*/,
+                                 unsigned int /*when*/, unsigned int incoming,
+                                 const gnutls_datum_t * /*msg*/) {
+	TlsTransport *t = static_cast<TlsTransport *>(gnutls_session_get_ptr(session));
+	if (incoming && t->mSessionCacheKey)
+		t->storeSession();
+
+	return 0;
+}
+
 #elif USE_MBEDTLS
 
+namespace {
+
+const string PemBeginCertificateTag = "-----BEGIN CERTIFICATE-----";
+
+shared_cache<mbedtls_x509_crt> &ca_certificate_cache() {
+	static auto *cache = new shared_cache<mbedtls_x509_crt>;
+	return *cache;
+}
+
+} // namespace
+
 void TlsTransport::Init() {
 	// Nothing to do
 }
 
-void TlsTransport::Cleanup() {
-	// Nothing to do
+void TlsTransport::Cleanup() { ca_certificate_cache().clear(); }
+
+shared_ptr<mbedtls_x509_crt> TlsTransport::LoadCaCertificate(const string &cacert) {
+	return ca_certificate_cache().get(cacert, [&cacert]() {
+		PLOG_DEBUG << "Loading CA certificate";
+		auto crt = mbedtls::new_x509_crt();
+		if (cacert.find(PemBeginCertificateTag) == string::npos) {
+			// cacert is a file path
+			mbedtls::check(mbedtls_x509_crt_parse_file(crt.get(), cacert.c_str()));
+		} else {
+			// cacert is a PEM content
+			mbedtls::check(mbedtls_x509_crt_parse(
+			    crt.get(), reinterpret_cast<const unsigned char *>(cacert.c_str()),
+			    cacert.size() + 1));
+		}
+		return crt;
+	});
 }
 
 TlsTransport::TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProxyTransport>> lower,
                            optional<string> host, certificate_ptr certificate,
-                           state_callback callback)
+                           state_callback callback, [[maybe_unused]] optional<string> cacert)
     : Transport(std::visit([](auto l) { return std::static_pointer_cast<Transport>(l); }, lower),
                 std::move(callback)),
       mHost(std::move(host)), mIsClient(std::visit([](auto l) { return l->isActive(); }, lower)),
@@ -364,6 +759,7 @@ TlsTransport::TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProx
 
 TlsTransport::~TlsTransport() {
 	stop();
+	endHandshake(false);
 
 	PLOG_DEBUG << "Destroying TLS transport";
 	mbedtls_entropy_free(&mEntropy);
@@ -372,11 +768,56 @@ TlsTransport::~TlsTransport() {
 	mbedtls_ssl_config_free(&mConf);
 }
 
-void TlsTransport::start() {
-	PLOG_DEBUG << "Starting TLS transport";
-	registerIncoming();
-	changeState(State::Connecting);
-	enqueueRecv(); // to initiate the handshake
+void TlsTransport::setPolicy(const TlsPolicy &policy) {
+	std::lock_guard lock(mSslMutex);
+
+	// Only up to TLS 1.2 is enabled with Mbed TLS
+	if (policy.minVersion) {
+		if (*policy.minVersion > TlsVersion::Tls12)
+			throw std::invalid_argument("TLS 1.3 is not supported with Mbed TLS");
+
+		mbedtls_ssl_conf_min_version(&mConf, MBEDTLS_SSL_MAJOR_VERSION_3,
+		                             int(*policy.minVersion) - 0x0300);
+	}
+	if (policy.maxVersion && *policy.maxVersion < TlsVersion::Tls12)
+		mbedtls_ssl_conf_max_version(&mConf, MBEDTLS_SSL_MAJOR_VERSION_3,
+		                             int(*policy.maxVersion) - 0x0300);
+
+	if (policy.ciphersuites) {
+		PLOG_WARNING << "TLS 1.3 ciphersuites are not supported with Mbed TLS";
+	}
+
+	if (policy.groups) {
+#if MBEDTLS_VERSION_NUMBER >= 0x03010000
+		static const std::unordered_map<string, uint16_t> groups = {
+		    {"X25519", MBEDTLS_SSL_IANA_TLS_GROUP_X25519},
+		    {"X448", MBEDTLS_SSL_IANA_TLS_GROUP_X448},
+		    {"P-256", MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1},
+		    {"P-384", MBEDTLS_SSL_IANA_TLS_GROUP_SECP384R1},
+		    {"P-521", MBEDTLS_SSL_IANA_TLS_GROUP_SECP521R1},
+		    {"prime256v1", MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1},
+		    {"secp384r1", MBEDTLS_SSL_IANA_TLS_GROUP_SECP384R1},
+		    {"secp521r1", MBEDTLS_SSL_IANA_TLS_GROUP_SECP521R1}};
+
+		mGroups.clear();
+		for (const auto &name : utils::explode(*policy.groups, ':')) {
+			auto it = groups.find(name);
+			if (it == groups.end())
+				throw std::invalid_argument("Unknown TLS group: " + name);
+
+			mGroups.push_back(it->second);
+		}
+		mGroups.push_back(MBEDTLS_SSL_IANA_TLS_GROUP_NONE);
+		mbedtls_ssl_conf_groups(&mConf, mGroups.data());
+#else
+		PLOG_WARNING << "TLS groups are not supported with this version of Mbed TLS";
+#endif
+	}
+}
+
+void TlsTransport::startHandshake() {
+	std::lock_guard lock(mSslMutex);
+	offerCachedSession(); // the handshake is run by doRecv()
 }
 
 void TlsTransport::stop() {
@@ -395,29 +836,43 @@ bool TlsTransport::send(message_ptr message) {
 
 	PLOG_VERBOSE << "Send size=" << message->size();
 
-	int ret;
-	do {
-		std::lock_guard lock(mSslMutex);
-		ret = mbedtls_ssl_write(&mSsl, reinterpret_cast<const unsigned char *>(message->data()),
-		                        int(message->size()));
-	} while (ret == MBEDTLS_ERR_SSL_WANT_WRITE);
-
-	if (!mbedtls::check(ret))
-		throw std::runtime_error("TLS send failed");
+	auto data = reinterpret_cast<const unsigned char *>(message->data());
+	size_t remaining = message->size();
+	std::lock_guard lock(mSslMutex);
+	mCoalescing = true;
+	scope_guard guard([this]() { mCoalescing = false; });
+	while (remaining > 0) {
+		int ret;
+		do {
+			ret = mbedtls_ssl_write(&mSsl, data, nextRecordSize(remaining));
+		} while (ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+		if (!mbedtls::check(ret))
+			throw std::runtime_error("TLS send failed");
+
+		// The first record goes out at once, the following ones are coalesced
+		bool first = data == reinterpret_cast<const unsigned char *>(message->data());
+		if (first || mCoalesced.size() >= TLS_COALESCED_WRITE_SIZE)
+			flushRecords();
+
+		data += ret;
+		remaining -= size_t(ret);
+	}
 
+	flushRecords();
 	return mOutgoingResult;
 }
 
 void TlsTransport::incoming(message_ptr message) {
 	if (!message) {
 		mIncomingQueue.stop();
-		enqueueRecv();
+		dispatchRecv();
 		return;
 	}
 
 	PLOG_VERBOSE << "Incoming size=" << message->size();
 	mIncomingQueue.push(message);
-	enqueueRecv();
+	dispatchRecv();
 }
 
 bool TlsTransport::outgoing(message_ptr message) {
@@ -430,10 +885,8 @@ void TlsTransport::postHandshake() {
 	// Dummy
 }
 
-void TlsTransport::doRecv() {
-	std::lock_guard lock(mRecvMutex);
-	--mPendingRecvCount;
-
+void TlsTransport::processRecv() {
+	// Requires mRecvMutex to be locked
 	if (state() != State::Connecting && state() != State::Connected)
 		return;
 
@@ -456,6 +909,11 @@ void TlsTransport::doRecv() {
 
 				if (mbedtls::check(ret, "Handshake failed")) {
 					PLOG_INFO << "TLS handshake finished";
+					{
+						std::lock_guard lock(mSslMutex);
+						updateSessionCache();
+					}
+					endHandshake(true);
 					changeState(State::Connected);
 					postHandshake();
 					break;
@@ -501,14 +959,14 @@ void TlsTransport::doRecv() {
 		recv(nullptr);
 	} else {
 		PLOG_ERROR << "TLS handshake failed";
+		endHandshake(false);
 		changeState(State::Failed);
 	}
 }
 
 int TlsTransport::WriteCallback(void *ctx, const unsigned char *buf, size_t len) {
 	auto *t = static_cast<TlsTransport *>(ctx);
-	auto *b = reinterpret_cast<const byte *>(buf);
-	t->outgoing(make_message(b, b + len));
+	t->writeRecords(reinterpret_cast<const byte *>(buf), len);
 
 	return int(len);
 }
@@ -551,9 +1009,143 @@ int TlsTransport::ReadCallback(void *ctx, unsigned char *buf, size_t len) {
 	}
 }
 
+void TlsTransport::offerCachedSession() {
+	// Requires mSslMutex to be locked
+	if (!mSessionCacheKey)
+		return;
+
+	auto data = TlsSessionCache::Instance().take(*mSessionCacheKey);
+	if (!data)
+		return;
+
+	mbedtls_ssl_session session;
+	mbedtls_ssl_session_init(&session);
+	if (mbedtls_ssl_session_load(&session, reinterpret_cast<const unsigned char *>(data->data()),
+	                             data->size()) == 0 &&
+	    mbedtls_ssl_set_session(&mSsl, &session) == 0) {
+		PLOG_DEBUG << "Offering cached TLS session";
+		mSessionOffered = true;
+	} else {
+		PLOG_WARNING << "Failed to restore cached TLS session";
+	}
+	mbedtls_ssl_session_free(&session);
+}
+
+void TlsTransport::updateSessionCache() {
+	// Requires mSslMutex to be locked
+	if (!mSessionCacheKey)
+		return;
+
+	// Mbed TLS does not tell whether the session was resumed, count the offered ones
+	TlsSessionCache::Instance().recordHandshake(mSessionOffered);
+	storeSession();
+}
+
+void TlsTransport::storeSession() {
+	// Requires mSslMutex to be locked
+	mbedtls_ssl_session session;
+	mbedtls_ssl_session_init(&session);
+	try {
+		mbedtls::check(mbedtls_ssl_get_session(&mSsl, &session));
+
+		size_t len = 0;
+		mbedtls_ssl_session_save(&session, NULL, 0, &len); // get the size
+		binary data(len);
+		mbedtls::check(mbedtls_ssl_session_save(
+		    &session, reinterpret_cast<unsigned char *>(data.data()), data.size(), &len));
+
+		data.resize(len);
+		TlsSessionCache::Instance().store(*mSessionCacheKey, std::move(data),
+		                                  TlsSessionCache::clock::now() + TLS_SESSION_LIFETIME);
+	} catch (const std::exception &e) {
+		PLOG_DEBUG << "Failed to store TLS session: " << e.what();
+	}
+	mbedtls_ssl_session_free(&session);
+}
+
+#else
+
+namespace {
+
+#if KERNEL_TLS_AVAILABLE
+
+// Sent by OpenSSL to the BIO with the kernel crypto info once the traffic keys are set, num is
+// non-zero for transmission (BIO_CTRL_SET_KTLS is not exposed by the public headers)
+const int BioCtrlSetKernelTls = 72;
+
+// Size of the kernel crypto info structure for a cipher, 0 if unsupported
+size_t kernel_crypto_info_size(int cipherType) {
+	switch (cipherType) {
+	case TLS_CIPHER_AES_GCM_128:
+		return sizeof(tls12_crypto_info_aes_gcm_128);
+	case TLS_CIPHER_AES_GCM_256:
+		return sizeof(tls12_crypto_info_aes_gcm_256);
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case TLS_CIPHER_CHACHA20_POLY1305:
+		return sizeof(tls12_crypto_info_chacha20_poly1305);
+#endif
+	default:
+		return 0;
+	}
+}
+
+#endif
+
+const string PemBeginCertificateTag = "-----BEGIN CERTIFICATE-----";
+const string DefaultGroups = "X25519:P-256:P-384";
+
+bool has_aes_instructions() {
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+	return __builtin_cpu_supports("aes");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4] = {};
+	__cpuid(info, 1);
+	return (info[2] & (1 << 25)) != 0; // AES-NI
+#elif defined(__aarch64__) && defined(__APPLE__)
+	return true; // all Apple arm64 processors have the cryptography extensions
+#elif defined(__aarch64__) && defined(__linux__) && defined(HWCAP_AES)
+	return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
 #else
+	return false;
+#endif
+}
+
+// AES-GCM is only faster than ChaCha20-Poly1305 with hardware AES support
+const string &default_ciphersuites() {
+	static const string ciphersuites =
+	    has_aes_instructions()
+	        ? "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"
+	        : "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384";
+	return ciphersuites;
+}
+
+shared_cache<SSL_CTX> &context_cache() {
+	static auto *cache = new shared_cache<SSL_CTX>;
+	return *cache;
+}
+
+void store_session(const string &key, SSL_SESSION *session) {
+	if (!SSL_SESSION_is_resumable(session))
+		return;
+
+	int len = i2d_SSL_SESSION(session, NULL);
+	if (len <= 0)
+		return;
+
+	binary data(len);
+	auto p = reinterpret_cast<unsigned char *>(data.data());
+	if (i2d_SSL_SESSION(session, &p) != len)
+		return;
+
+	auto expiry = TlsSessionCache::clock::from_time_t(
+	    time_t(SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session)));
+	TlsSessionCache::Instance().store(key, std::move(data), expiry);
+}
+
+} // namespace
 
 int TlsTransport::TransportExIndex = -1;
+BIO_METHOD *TlsTransport::BioMethod = nullptr;
 
 void TlsTransport::Init() {
 	openssl::init();
@@ -561,60 +1153,107 @@ void TlsTransport::Init() {
 	if (TransportExIndex < 0) {
 		TransportExIndex = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
 	}
-}
 
-void TlsTransport::Cleanup() {
-	// Nothing to do
+	if (!BioMethod) {
+		// Never freed as transports may outlive Cleanup()
+		if (!(BioMethod = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "wsc")))
+			throw std::runtime_error("Failed to create BIO method");
+
+		BIO_meth_set_write(BioMethod, WriteCallback);
+		BIO_meth_set_read(BioMethod, ReadCallback);
+		BIO_meth_set_ctrl(BioMethod, CtrlCallback);
+	}
 }
 
-TlsTransport::TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProxyTransport>> lower,
-                           optional<string> host, certificate_ptr certificate,
-                           state_callback callback)
-    : Transport(std::visit([](auto l) { return std::static_pointer_cast<Transport>(l); }, lower),
-                std::move(callback)),
-      mHost(std::move(host)), mIsClient(std::visit([](auto l) { return l->isActive(); }, lower)),
-      mIncomingQueue(RECV_QUEUE_LIMIT, message_size_func) {
+void TlsTransport::Cleanup() { context_cache().clear(); }
 
-	PLOG_DEBUG << "Initializing TLS transport (OpenSSL)";
+shared_ptr<SSL_CTX> TlsTransport::GetContext(bool isClient, const certificate_ptr &certificate,
+                                             const optional<string> &cacert) {
+	string key = isClient ? "client" : "server";
+	if (certificate)
+		key += "|cert:" + certificate->fingerprint().value;
+	if (cacert)
+		key += "|ca:" + *cacert;
 
-	try {
-		if (!(mCtx = SSL_CTX_new(TLS_method()))) // version-flexible
+	return context_cache().get(key, [&]() {
+		PLOG_DEBUG << "Creating SSL context";
+		auto ctx = shared_ptr<SSL_CTX>(SSL_CTX_new(TLS_method()), SSL_CTX_free); // version-flexible
+		if (!ctx)
 			throw std::runtime_error("Failed to create SSL context");
 
-		openssl::check(SSL_CTX_set_cipher_list(mCtx, "ALL:!LOW:!EXP:!RC4:!MD5:@STRENGTH"),
+		openssl::check(SSL_CTX_set_cipher_list(ctx.get(), "ALL:!LOW:!EXP:!RC4:!MD5:@STRENGTH"),
 		               "Failed to set SSL priorities");
 
 #if OPENSSL_VERSION_NUMBER >= 0x30000000
-		openssl::check(SSL_CTX_set1_groups_list(mCtx, "P-256"), "Failed to set SSL groups");
+		openssl::check(SSL_CTX_set_ciphersuites(ctx.get(), default_ciphersuites().c_str()),
+		               "Failed to set SSL ciphersuites");
+		openssl::check(SSL_CTX_set1_groups_list(ctx.get(), DefaultGroups.c_str()),
+		               "Failed to set SSL groups");
 #else
 		auto ecdh = unique_ptr<EC_KEY, decltype(&EC_KEY_free)>(
 		    EC_KEY_new_by_curve_name(NID_X9_62_prime256v1), EC_KEY_free);
-		SSL_CTX_set_tmp_ecdh(mCtx, ecdh.get());
+		SSL_CTX_set_tmp_ecdh(ctx.get(), ecdh.get());
 #endif
 
-		if (mIsClient) {
-			if (!SSL_CTX_set_default_verify_paths(mCtx)) {
+		if (isClient) {
+			if (!SSL_CTX_set_default_verify_paths(ctx.get())) {
 				PLOG_WARNING << "SSL root CA certificates unavailable";
 			}
+
+			// Sessions are kept in the TLS session cache instead of the context
+			SSL_CTX_set_session_cache_mode(ctx.get(),
+			                               SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+			SSL_CTX_sess_set_new_cb(ctx.get(), NewSessionCallback);
+		}
+
+		if (cacert) {
+			if (cacert->find(PemBeginCertificateTag) == string::npos) {
+				// *cacert is a file path
+				openssl::check(SSL_CTX_load_verify_locations(ctx.get(), cacert->c_str(), NULL),
+				               "Failed to load CA certificate");
+			} else {
+				// *cacert is a PEM content
+				PLOG_WARNING << "CA certificate as PEM is not supported for OpenSSL";
+			}
 		}
 
 		if (certificate) {
 			auto [x509, pkey] = certificate->credentials();
-			SSL_CTX_use_certificate(mCtx, x509);
-			SSL_CTX_use_PrivateKey(mCtx, pkey);
+			SSL_CTX_use_certificate(ctx.get(), x509);
+			SSL_CTX_use_PrivateKey(ctx.get(), pkey);
 
 			for (auto c : certificate->chain())
-				SSL_CTX_add1_chain_cert(mCtx, c); // add1 increments reference count
+				SSL_CTX_add1_chain_cert(ctx.get(), c); // add1 increments reference count
 		}
 
-		SSL_CTX_set_options(mCtx, SSL_OP_NO_SSLv3 | SSL_OP_NO_RENEGOTIATION);
-		SSL_CTX_set_min_proto_version(mCtx, TLS1_VERSION);
-		SSL_CTX_set_read_ahead(mCtx, 1);
-		SSL_CTX_set_quiet_shutdown(mCtx, 0); // send the close_notify alert
-		SSL_CTX_set_info_callback(mCtx, InfoCallback);
-		SSL_CTX_set_verify(mCtx, SSL_VERIFY_NONE, NULL);
+		SSL_CTX_set_options(ctx.get(), SSL_OP_NO_SSLv3 | SSL_OP_NO_RENEGOTIATION);
+		SSL_CTX_set_min_proto_version(ctx.get(), TLS1_VERSION);
+		SSL_CTX_set_read_ahead(ctx.get(), 1);
+		SSL_CTX_set_quiet_shutdown(ctx.get(), 0); // send the close_notify alert
+		SSL_CTX_set_info_callback(ctx.get(), InfoCallback);
+		SSL_CTX_set_verify(ctx.get(), SSL_VERIFY_NONE, NULL);
+		return ctx;
+	});
+}
+
+TlsTransport::TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProxyTransport>> lower,
+                           optional<string> host, certificate_ptr certificate,
+                           state_callback callback, optional<string> cacert)
+    : Transport(std::visit([](auto l) { return std::static_pointer_cast<Transport>(l); }, lower),
+                std::move(callback)),
+      mHost(std::move(host)), mIsClient(std::visit([](auto l) { return l->isActive(); }, lower)),
+      mIncomingQueue(RECV_QUEUE_LIMIT, message_size_func) {
+
+	PLOG_DEBUG << "Initializing TLS transport (OpenSSL)";
+
+	if (auto tcp = std::get_if<shared_ptr<TcpTransport>>(&lower))
+		mTcpLower = *tcp;
+
+	try {
+		// The shared context must not be modified from here on
+		mCtx = GetContext(mIsClient, certificate, cacert);
 
-		if (!(mSsl = SSL_new(mCtx)))
+		if (!(mSsl = SSL_new(mCtx.get())))
 			throw std::runtime_error("Failed to create SSL instance");
 
 		SSL_set_ex_data(mSsl, TransportExIndex, this);
@@ -632,42 +1271,69 @@ TlsTransport::TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProx
 		else
 			SSL_set_accept_state(mSsl);
 
-		if (!(mInBio = BIO_new(BIO_s_mem())) || !(mOutBio = BIO_new(BIO_s_mem())))
+		BIO *bio = BIO_new(BioMethod);
+		if (!bio)
 			throw std::runtime_error("Failed to create BIO");
 
-		BIO_set_mem_eof_return(mInBio, BIO_EOF);
-		BIO_set_mem_eof_return(mOutBio, BIO_EOF);
-		SSL_set_bio(mSsl, mInBio, mOutBio);
+		BIO_set_data(bio, this);
+		BIO_set_init(bio, 1);
+		SSL_set_bio(mSsl, bio, bio); // takes ownership of a single reference
 
 	} catch (...) {
 		if (mSsl)
 			SSL_free(mSsl);
-		if (mCtx)
-			SSL_CTX_free(mCtx);
 		throw;
 	}
 }
 
 TlsTransport::~TlsTransport() {
 	stop();
+	endHandshake(false);
 
 	PLOG_DEBUG << "Destroying TLS transport";
 	SSL_free(mSsl);
-	SSL_CTX_free(mCtx);
 }
 
-void TlsTransport::start() {
-	PLOG_DEBUG << "Starting TLS transport";
-	registerIncoming();
-	changeState(State::Connecting);
+void TlsTransport::setPolicy(const TlsPolicy &policy) {
+	std::lock_guard lock(mSslMutex);
+	if (policy.minVersion)
+		openssl::check(SSL_set_min_proto_version(mSsl, int(*policy.minVersion)),
+		               "Failed to set minimum TLS version");
+	if (policy.maxVersion)
+		openssl::check(SSL_set_max_proto_version(mSsl, int(*policy.maxVersion)),
+		               "Failed to set maximum TLS version");
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (policy.ciphersuites)
+		openssl::check(SSL_set_ciphersuites(mSsl, policy.ciphersuites->c_str()),
+		               "Failed to set SSL ciphersuites");
+	if (policy.groups)
+		openssl::check(SSL_set1_groups_list(mSsl, policy.groups->c_str()),
+		               "Failed to set SSL groups");
+#else
+	if (policy.ciphersuites || policy.groups) {
+		PLOG_WARNING << "TLS ciphersuites and groups require OpenSSL 1.1.1 or later";
+	}
+#endif
+}
 
+void TlsTransport::startHandshake() {
 	// Initiate the handshake
 	int ret, err;
 	{
 		std::lock_guard lock(mSslMutex);
-		ret = SSL_do_handshake(mSsl);
+		offerCachedSession();
+
+		SSL_SESSION *session = SSL_get0_session(mSsl);
+		if (!mEarlyData.empty() && session &&
+		    mEarlyData.size() <= SSL_SESSION_get_max_early_data(session)) {
+			PLOG_DEBUG << "Sending TLS early data";
+			size_t written = 0;
+			ret = SSL_write_early_data(mSsl, mEarlyData.data(), mEarlyData.size(), &written);
+		} else {
+			ret = SSL_do_handshake(mSsl);
+		}
 		err = SSL_get_error(mSsl, ret);
-		flushOutput();
 	}
 
 	openssl::check_error(err, "Handshake failed");
@@ -689,50 +1355,60 @@ bool TlsTransport::send(message_ptr message) {
 
 	PLOG_VERBOSE << "Send size=" << message->size();
 
-	int err;
-	bool result;
-	{
-		std::lock_guard lock(mSslMutex);
-		int ret = SSL_write(mSsl, message->data(), int(message->size()));
-		err = SSL_get_error(mSsl, ret);
-		result = flushOutput();
+	if (mKernelTlsTx)
+		return outgoing(message); // encrypted by the kernel
+
+	const byte *data = message->data();
+	size_t remaining = message->size();
+	std::lock_guard lock(mSslMutex);
+	mCoalescing = true;
+	scope_guard guard([this]() { mCoalescing = false; });
+	while (remaining > 0) {
+		size_t size = nextRecordSize(remaining);
+		int ret = SSL_write(mSsl, data, int(size));
+		if (!openssl::check_error(SSL_get_error(mSsl, ret)))
+			throw std::runtime_error("TLS send failed");
+
+		// The first record goes out at once, the following ones are coalesced
+		if (data == message->data() || mCoalesced.size() >= TLS_COALESCED_WRITE_SIZE)
+			flushRecords();
+
+		data += size; // partial writes are not enabled
+		remaining -= size;
 	}
 
-	if (!openssl::check_error(err))
-		throw std::runtime_error("TLS send failed");
-
-	return result;
+	flushRecords();
+	return mOutgoingResult;
 }
 
 void TlsTransport::incoming(message_ptr message) {
 	if (!message) {
 		mIncomingQueue.stop();
-		enqueueRecv();
+		dispatchRecv();
 		return;
 	}
 
 	PLOG_VERBOSE << "Incoming size=" << message->size();
 	mIncomingQueue.push(message);
-	enqueueRecv();
+	dispatchRecv();
 }
 
-bool TlsTransport::outgoing(message_ptr message) { return Transport::outgoing(std::move(message)); }
+bool TlsTransport::outgoing(message_ptr message) {
+	bool result = Transport::outgoing(std::move(message));
+	mOutgoingResult = result;
+	return result;
+}
 
 void TlsTransport::postHandshake() {
 	// Dummy
 }
 
-void TlsTransport::doRecv() {
-	std::lock_guard lock(mRecvMutex);
-	--mPendingRecvCount;
-
+void TlsTransport::processRecv() {
+	// Requires mRecvMutex to be locked
 	if (state() != State::Connecting && state() != State::Connected)
 		return;
 
 	try {
-		const size_t bufferSize = 4096;
-		byte buffer[bufferSize];
-
 		// Read incoming messages
 		while (mIncomingQueue.running()) {
 			auto next = mIncomingQueue.pop();
@@ -740,10 +1416,17 @@ void TlsTransport::doRecv() {
 				return;
 
 			message_ptr message = std::move(*next);
-			if (message->size() > 0)
-				BIO_write(mInBio, message->data(), int(message->size())); // Input
-			else
+			if (message->size() == 0) {
 				recv(message); // Pass zero-sized messages through
+				continue;
+			}
+
+			{
+				// The BIO reads the message in place until it is consumed
+				std::lock_guard lock(mSslMutex);
+				mIncomingMessage = std::move(message);
+				mIncomingMessagePosition = 0;
+			}
 
 			if (state() == State::Connecting) {
 				// Continue the handshake
@@ -752,11 +1435,25 @@ void TlsTransport::doRecv() {
 					std::lock_guard lock(mSslMutex);
 					ret = SSL_do_handshake(mSsl);
 					err = SSL_get_error(mSsl, ret);
-					flushOutput();
 				}
 
 				if (openssl::check_error(err, "Handshake failed")) {
 					PLOG_INFO << "TLS handshake finished";
+					{
+						std::lock_guard lock(mSslMutex);
+						updateSessionCache();
+						if (!mEarlyData.empty()) {
+							mEarlyDataAccepted =
+							    SSL_get_early_data_status(mSsl) == SSL_EARLY_DATA_ACCEPTED;
+							PLOG_DEBUG << "TLS early data "
+							           << (mEarlyDataAccepted ? "accepted" : "rejected");
+							mEarlyData.clear();
+						}
+						if (mKernelTls && !mKernelTlsTx) {
+							PLOG_INFO << "Kernel TLS unavailable, using user space encryption";
+						}
+					}
+					endHandshake(true);
 					changeState(State::Connected);
 					postHandshake();
 				}
@@ -765,20 +1462,30 @@ void TlsTransport::doRecv() {
 			if (state() == State::Connected) {
 				int ret, err;
 				while (true) {
+					message_ptr plaintext;
 					{
 						std::lock_guard lock(mSslMutex);
-						ret = SSL_read(mSsl, buffer, bufferSize);
+						// Peek to process the next record, then read its plaintext into a message
+						// of the exact size
+						char first;
+						ret = SSL_peek(mSsl, &first, 1);
 						err = SSL_get_error(mSsl, ret);
-						flushOutput(); // SSL_read() can also cause write operations
+						if (ret > 0) {
+							plaintext = make_message(size_t(SSL_pending(mSsl)));
+							ret = SSL_read(mSsl, plaintext->data(), int(plaintext->size()));
+							err = SSL_get_error(mSsl, ret);
+						}
 					}
 
 					if (err == SSL_ERROR_ZERO_RETURN)
 						break;
 
-					if (openssl::check_error(err))
-						recv(make_message(buffer, buffer + ret));
-					else
+					if (openssl::check_error(err)) {
+						plaintext->resize(size_t(ret));
+						recv(std::move(plaintext));
+					} else {
 						break;
+					}
 				}
 
 				if (err == SSL_ERROR_ZERO_RETURN) {
@@ -801,20 +1508,151 @@ void TlsTransport::doRecv() {
 		recv(nullptr);
 	} else {
 		PLOG_ERROR << "TLS handshake failed";
+		endHandshake(false);
 		changeState(State::Failed);
 	}
 }
 
-bool TlsTransport::flushOutput() {
+bool TlsTransport::enableKernelTls(bool transmit, const void *cryptoInfo) {
+	// Called by OpenSSL with mSslMutex locked when it installs the application traffic keys
+#if KERNEL_TLS_AVAILABLE
+	// Reception is not offloaded: records are read ahead and queued in user space, so ciphertext
+	// following the handshake may already have been received, and the kernel would return
+	// post-handshake messages like session tickets as control messages to handle.
+	if (!transmit || !mKernelTls)
+		return false;
+
+	// As a server or with TLS 1.2, OpenSSL still writes handshake records after switching keys
+	auto tcp = mTcpLower.lock();
+	if (!tcp || !mIsClient || SSL_version(mSsl) != TLS1_3_VERSION) {
+		PLOG_DEBUG << "Kernel TLS requires a TLS 1.3 client directly over TCP";
+		return false;
+	}
+
+	// The crypto info from OpenSSL holds the keys and the current record sequence number
+	auto info = static_cast<const struct tls_crypto_info *>(cryptoInfo);
+	size_t size = kernel_crypto_info_size(info->cipher_type);
+	if (size == 0) {
+		PLOG_DEBUG << "Kernel TLS does not support cipher " << info->cipher_type;
+		return false;
+	}
+
+	if (!tcp->enableKernelTls(cryptoInfo, size))
+		return false;
+
+	PLOG_INFO << "TLS encryption offloaded to the kernel";
+	SSL_set_quiet_shutdown(mSsl, 1); // close_notify can't be sent by OpenSSL anymore
+	mKernelTlsTx = true;
+	return true;
+#else
+	(void)transmit;
+	(void)cryptoInfo;
+	return false;
+#endif
+}
+
+void TlsTransport::offerCachedSession() {
 	// Requires mSslMutex to be locked
-	bool result = true;
-	const size_t bufferSize = 4096;
-	byte buffer[bufferSize];
-	int len;
-	while ((len = BIO_read(mOutBio, buffer, bufferSize)) > 0)
-		result = outgoing(make_message(buffer, buffer + len));
+	if (!mSessionCacheKey)
+		return;
 
-	return result;
+	auto data = TlsSessionCache::Instance().take(*mSessionCacheKey);
+	if (!data)
+		return;
+
+	auto p = reinterpret_cast<const unsigned char *>(data->data());
+	auto session = unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)>(
+	    d2i_SSL_SESSION(NULL, &p, long(data->size())), SSL_SESSION_free);
+	if (session && SSL_set_session(mSsl, session.get())) {
+		PLOG_DEBUG << "Offering cached TLS session";
+	} else {
+		PLOG_WARNING << "Failed to restore cached TLS session";
+	}
+}
+
+void TlsTransport::updateSessionCache() {
+	// Requires mSslMutex to be locked
+	if (!mSessionCacheKey)
+		return;
+
+	bool resumed = SSL_session_reused(mSsl) == 1;
+	TlsSessionCache::Instance().recordHandshake(resumed);
+
+	// New sessions go through NewSessionCallback, but not resumed TLS 1.2 sessions
+	if (resumed && SSL_version(mSsl) != TLS1_3_VERSION)
+		if (SSL_SESSION *session = SSL_get_session(mSsl))
+			store_session(*mSessionCacheKey, session);
+}
+
+int TlsTransport::WriteCallback(BIO *bio, const char *data, int len) {
+	// Called with mSslMutex locked
+	TlsTransport *t = static_cast<TlsTransport *>(BIO_get_data(bio));
+	BIO_clear_retry_flags(bio);
+
+	if (t->mKernelTlsTx) {
+		// Records from OpenSSL can't be interleaved with records encrypted by the kernel, this
+		// happens only if the peer requests a key update or sends an alert
+		PLOG_WARNING << "Unexpected TLS record after kernel offload, closing";
+		t->mIncomingQueue.stop();
+		return len;
+	}
+
+	try {
+		if (len > 0)
+			t->writeRecords(reinterpret_cast<const byte *>(data), size_t(len));
+
+		return len;
+
+	} catch (const std::exception &e) {
+		PLOG_WARNING << e.what();
+		return -1;
+	}
+}
+
+int TlsTransport::ReadCallback(BIO *bio, char *data, int len) {
+	// Called with mSslMutex locked
+	TlsTransport *t = static_cast<TlsTransport *>(BIO_get_data(bio));
+	BIO_clear_retry_flags(bio);
+
+	message_ptr &message = t->mIncomingMessage;
+	size_t &position = t->mIncomingMessagePosition;
+	if (!message || position >= message->size()) {
+		message.reset();
+		BIO_set_retry_read(bio); // wait for the next message
+		return -1;
+	}
+
+	size_t size = std::min(size_t(len), message->size() - position);
+	std::memcpy(data, message->data() + position, size);
+	position += size;
+	return int(size);
+}
+
+long TlsTransport::CtrlCallback(BIO *bio, int cmd, long num, void *ptr) {
+	// Called with mSslMutex locked
+	TlsTransport *t = static_cast<TlsTransport *>(BIO_get_data(bio));
+	switch (cmd) {
+	case BIO_CTRL_FLUSH:
+		return 1; // messages are sent as soon as they are written
+#if KERNEL_TLS_AVAILABLE
+	case BioCtrlSetKernelTls:
+		return t->enableKernelTls(num != 0, ptr) ? 1 : 0;
+	case BIO_CTRL_GET_KTLS_SEND:
+		return t->mKernelTlsTx ? 1 : 0;
+#endif
+	default:
+		return 0;
+	}
+}
+
+int TlsTransport::NewSessionCallback(SSL *ssl, SSL_SESSION *session) {
+	TlsTransport *t =
+	    static_cast<TlsTransport *>(SSL_get_ex_data(ssl, TlsTransport::TransportExIndex));
+
+	if (t && t->mSessionCacheKey)
+		store_session(*t->mSessionCacheKey, session);
+
+	return 0; // the session is not kept
 }
 
 void TlsTransport::InfoCallback(const SSL *ssl, int where, int ret) {
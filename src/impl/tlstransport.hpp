@@ -11,12 +11,15 @@
 
 #include "certificate.hpp"
 #include "common.hpp"
-#include "queue.hpp"
+#include "configuration.hpp" // for TlsPolicy
+#include "ringqueue.hpp"
 #include "tls.hpp"
 #include "transport.hpp"
 
 #include <atomic>
+#include <chrono>
 #include <thread>
+#include <vector>
 
 namespace wsc::impl {
 
@@ -38,23 +41,75 @@ public:
 
 	bool isClient() const { return mIsClient; }
 
+	// Process incoming records on the thread pool instead of the calling thread
+	void setOffloadProcessing(bool offload);
+
+	// Offload encryption to the kernel after the handshake when possible, must be called before
+	// start(). Only sending is offloaded, for TLS 1.3 clients directly over TCP with OpenSSL.
+	void setKernelTls(bool enabled);
+	bool kernelTlsEnabled() const; // true once encryption is offloaded
+
+	// Send records of the given payload size, or size records dynamically if nullopt: small
+	// records fitting in a TCP segment at the start of each burst, then full-sized records
+	void setRecordSize(optional<size_t> size);
+
+	// Restrict protocol versions, ciphersuites and groups, must be called before start()
+	void setPolicy(const TlsPolicy &policy);
+
+	// Resume and store client sessions in the session cache under key, must be called before
+	// start()
+	void setSessionCacheKey(string key);
+
+	// Send data as TLS 1.3 early data if the resumed session allows it, must be called before
+	// start(). Whether the server accepted it is known once connected.
+	void setEarlyData(binary data);
+	bool earlyDataAccepted() const { return mEarlyDataAccepted; }
+
 protected:
+	// cacert is loaded in the shared context with OpenSSL, it is ignored by other backends
+	TlsTransport(variant<shared_ptr<TcpTransport>, shared_ptr<HttpProxyTransport>> lower,
+	             optional<string> host, certificate_ptr certificate, state_callback callback,
+	             optional<string> cacert);
+
 	virtual void incoming(message_ptr message) override;
 	virtual bool outgoing(message_ptr message) override;
 	virtual void postHandshake();
 
+	bool beginHandshake(); // called once admitted by the handshake executor
+	void startHandshake();
+	void endHandshake(bool success);
+	size_t nextRecordSize(size_t remaining); // requires sends to be serialized
+	void writeRecords(const byte *data, size_t size); // called by the TLS library to write
+	void flushRecords(); // writes the coalesced records, requires sends to be serialized
+	void dispatchRecv();
 	void enqueueRecv();
 	void doRecv();
+	void processRecv(); // requires mRecvMutex to be locked
+	void offerCachedSession();
+	void updateSessionCache();
 
 	const optional<string> mHost;
 	const bool mIsClient;
 
-	Queue<message_ptr> mIncomingQueue;
+	RingQueue<message_ptr> mIncomingQueue; // consumed with mRecvMutex locked
 	std::atomic<int> mPendingRecvCount = 0;
+	std::atomic<bool> mOffloadProcessing = false;
+	std::atomic<bool> mKernelTls = false;
+	optional<string> mSessionCacheKey; // client sessions are cached if set
+	binary mEarlyData;
+	std::atomic<bool> mEarlyDataAccepted = false;
+	std::atomic<bool> mHandshakeAdmitted = false; // holds a slot in the handshake executor
+	std::chrono::steady_clock::time_point mHandshakeStart;
+	optional<size_t> mRecordSize; // fixed record size, dynamic if not set
+	size_t mBurstBytes = 0;       // bytes sent since the start of the burst
+	std::chrono::steady_clock::time_point mLastSend;
+	bool mCoalescing = false; // records written during a send are coalesced
+	binary mCoalesced;
 	std::mutex mRecvMutex;
 
 #if USE_GNUTLS
 	gnutls_session_t mSession;
+	shared_ptr<gnutls_priority_t> mPriorities; // shared between transports with the same policy
 
 	message_ptr mIncomingMessage;
 	size_t mIncomingMessagePosition = 0;
@@ -64,6 +119,11 @@ protected:
 	static ssize_t ReadCallback(gnutls_transport_ptr_t ptr, void *data, size_t maxlen);
 	static int TimeoutCallback(gnutls_transport_ptr_t ptr, unsigned int ms);
 
+	void storeSession();
+
+	static int TicketCallback(gnutls_session_t session, unsigned int htype, unsigned int when,
+	                          unsigned int incoming, const gnutls_datum_t *msg);
+
 #elif USE_MBEDTLS
 	mbedtls_entropy_context mEntropy;
 	mbedtls_ctr_drbg_context mDrbg;
@@ -76,20 +136,42 @@ protected:
 	message_ptr mIncomingMessage;
 	size_t mIncomingMessagePosition = 0;
 
+	bool mSessionOffered = false;
+	void storeSession();
+
+	std::vector<uint16_t> mGroups; // referenced by mConf, terminated by zero
+
 	static int WriteCallback(void *ctx, const unsigned char *buf, size_t len);
 	static int ReadCallback(void *ctx, unsigned char *buf, size_t len);
 
+	// Parsed CA certificates shared between transports, cacert is a file path or PEM content
+	static shared_ptr<mbedtls_x509_crt> LoadCaCertificate(const string &cacert);
+
 #else
-	SSL_CTX *mCtx;
-	SSL *mSsl;
-	BIO *mInBio, *mOutBio;
+	shared_ptr<SSL_CTX> mCtx; // shared between transports with the same configuration
+	SSL *mSsl = nullptr;
 	std::mutex mSslMutex;
+	std::atomic<bool> mOutgoingResult = true;
 
-	bool flushOutput();
+	message_ptr mIncomingMessage; // read in place by the BIO
+	size_t mIncomingMessagePosition = 0;
+
+	weak_ptr<TcpTransport> mTcpLower; // for kernel TLS, null if not directly over TCP
+	std::atomic<bool> mKernelTlsTx = false;
+
+	bool enableKernelTls(bool transmit, const void *cryptoInfo); // requested through the BIO
 
 	static int TransportExIndex;
+	static BIO_METHOD *BioMethod; // reads and writes messages directly, without memory BIOs
+
+	static shared_ptr<SSL_CTX> GetContext(bool isClient, const certificate_ptr &certificate,
+	                                      const optional<string> &cacert);
 
+	static int WriteCallback(BIO *bio, const char *data, int len);
+	static int ReadCallback(BIO *bio, char *data, int len);
+	static long CtrlCallback(BIO *bio, int cmd, long num, void *ptr);
 	static void InfoCallback(const SSL *ssl, int where, int ret);
+	static int NewSessionCallback(SSL *ssl, SSL_SESSION *session);
 #endif
 };
 
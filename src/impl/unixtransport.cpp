@@ -0,0 +1,48 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "unixtransport.hpp"
+
+#ifndef _WIN32
+
+#include <sys/un.h>
+
+#include <cstddef>
+#include <cstring>
+
+namespace wsc::impl {
+
+UnixTransport::UnixTransport(string path, state_callback callback)
+    : TcpTransport(std::move(path), "", std::move(callback)) {
+
+	PLOG_DEBUG << "Initializing Unix transport";
+}
+
+UnixTransport::~UnixTransport() {}
+
+string UnixTransport::remoteAddress() const { return "unix:" + mHostname; }
+
+void UnixTransport::resolve() {
+	struct sockaddr_storage addr = {};
+	auto *un = reinterpret_cast<struct sockaddr_un *>(&addr);
+	if (mHostname.empty() || mHostname.size() >= sizeof(un->sun_path)) {
+		PLOG_WARNING << "Invalid Unix socket path \"" << mHostname << "\"";
+		processResolution(nullopt);
+		return;
+	}
+
+	un->sun_family = AF_UNIX;
+	std::memcpy(un->sun_path, mHostname.c_str(), mHostname.size() + 1);
+
+	socklen_t addrlen = socklen_t(offsetof(struct sockaddr_un, sun_path) + mHostname.size() + 1);
+	processResolution(Resolver::address_list{{addr, addrlen}});
+}
+
+} // namespace wsc::impl
+
+#endif
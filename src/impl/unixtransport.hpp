@@ -0,0 +1,35 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_IMPL_UNIX_TRANSPORT_H
+#define WEBSOCKET_IMPL_UNIX_TRANSPORT_H
+
+#include "common.hpp"
+#include "tcptransport.hpp"
+
+#ifndef _WIN32
+
+namespace wsc::impl {
+
+// Stream transport over a Unix domain socket, sharing the TCP transport poll and send machinery
+class UnixTransport final : public TcpTransport {
+public:
+	UnixTransport(string path, state_callback callback);
+	~UnixTransport();
+
+	string remoteAddress() const override;
+
+private:
+	void resolve() override;
+};
+
+} // namespace wsc::impl
+
+#endif
+
+#endif
@@ -12,9 +12,13 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
 #include <chrono>
+#include <cmath>
+#include <fstream>
 #include <functional>
 #include <iterator>
+#include <mutex>
 #include <sstream>
 #include <thread>
 
@@ -24,7 +28,12 @@
 typedef HRESULT(WINAPI *pfnSetThreadDescription)(HANDLE, PCWSTR);
 #endif
 #if defined(__linux__)
+#include <pthread.h> // for pthread_setaffinity_np()
+#include <sched.h> // for sched_getaffinity()
 #include <sys/prctl.h> // for prctl(PR_SET_NAME)
+#include <sys/resource.h> // for setpriority()
+#include <sys/syscall.h> // for SYS_gettid
+#include <unistd.h>
 #endif
 #if defined(__FreeBSD__)
 #include <pthread_np.h> // for pthread_set_name_np
@@ -142,6 +151,74 @@ std::seed_seq random_seed() {
 
 namespace {
 
+#if defined(__linux__)
+optional<double> cgroup_cpu_limit() {
+	// cgroup v2: the quota may be set on any ancestor of the process cgroup, the lowest applies
+	string path;
+	std::ifstream cgroup("/proc/self/cgroup");
+	for (string line; std::getline(cgroup, line);)
+		if (line.rfind("0::", 0) == 0)
+			path = line.substr(3);
+
+	optional<double> limit;
+	bool found = false;
+	while (true) {
+		std::ifstream file("/sys/fs/cgroup" + path + "/cpu.max");
+		string quota;
+		long period = 0;
+		if (file >> quota >> period) {
+			found = true;
+			if (quota != "max" && period > 0) {
+				double value = std::stod(quota) / double(period);
+				limit = limit ? std::min(*limit, value) : value;
+			}
+		}
+		if (path.empty() || path == "/")
+			break;
+
+		path.resize(path.find_last_of('/'));
+	}
+	if (found)
+		return limit;
+
+	// cgroup v1
+	std::ifstream quotaFile("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+	std::ifstream periodFile("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+	long quota = 0, period = 0;
+	if (quotaFile >> quota && periodFile >> period && quota > 0 && period > 0)
+		return double(quota) / double(period);
+
+	return nullopt;
+}
+#endif
+
+} // namespace
+
+int available_concurrency() {
+	int count = int(std::thread::hardware_concurrency());
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		count = CPU_COUNT(&set);
+
+	try {
+		if (auto limit = cgroup_cpu_limit()) {
+			PLOG_DEBUG << "CPU quota is " << *limit << " CPUs";
+			count = std::min(count, int(std::ceil(*limit)));
+		}
+	} catch (const std::exception &e) {
+		PLOG_WARNING << "Unable to read the cgroup CPU quota: " << e.what();
+	}
+#endif
+	return std::max(count, 1);
+}
+
+namespace {
+
+std::mutex thread_name_mutex;
+string thread_name_prefix = "wsc";
+
 void thread_set_name_self(const char *name) {
 #if defined(_WIN32)
 	int name_length = (int)strlen(name);
@@ -176,7 +253,64 @@ void thread_set_name_self(const char *name) {
 
 namespace this_thread {
 
-void set_name(const string &name) { thread_set_name_self(name.c_str()); }
+void set_name(const string &name) {
+	std::unique_lock lock(thread_name_mutex);
+	string fullname = !thread_name_prefix.empty() ? thread_name_prefix + ' ' + name : name;
+	lock.unlock();
+
+	thread_set_name_self(fullname.c_str());
+}
+
+void set_name_prefix(string prefix) {
+	std::lock_guard lock(thread_name_mutex);
+	thread_name_prefix = std::move(prefix);
+}
+
+void set_affinity(const std::vector<int> &cpus) {
+	if (cpus.empty())
+		return;
+
+#if defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for (int cpu : cpus)
+		if (cpu >= 0 && cpu < int(sizeof(mask) * CHAR_BIT))
+			mask |= DWORD_PTR(1) << cpu;
+
+	if (!SetThreadAffinityMask(GetCurrentThread(), mask))
+		PLOG_WARNING << "Failed to set thread affinity, error=" << GetLastError();
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus)
+		if (cpu >= 0 && cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+
+	if (int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		PLOG_WARNING << "Failed to set thread affinity, errno=" << err;
+#else
+	PLOG_WARNING << "Thread affinity is not supported on this platform";
+#endif
+}
+
+void set_priority(int priority) {
+#if defined(_WIN32)
+	if (!SetThreadPriority(GetCurrentThread(), priority))
+		PLOG_WARNING << "Failed to set thread priority, error=" << GetLastError();
+#elif defined(__linux__)
+	// On Linux, the nice value is a per-thread attribute
+	if (setpriority(PRIO_PROCESS, id_t(syscall(SYS_gettid)), priority) != 0)
+		PLOG_WARNING << "Failed to set thread priority, errno=" << errno;
+#else
+	(void)priority;
+	PLOG_WARNING << "Thread priority is not supported on this platform";
+#endif
+}
+
+void apply(const thread_options &options) {
+	set_affinity(options.cpus);
+	if (options.priority)
+		set_priority(*options.priority);
+}
 
 } // namespace this_thread
 
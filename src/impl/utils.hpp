@@ -77,9 +77,21 @@ template <typename T> uint32_t to_uint32(T i) {
 		throw std::invalid_argument("Integer out of range");
 }
 
+// Return the number of CPUs the process may run on, limited by its affinity mask and cgroup quota
+int available_concurrency();
+
+struct thread_options {
+	std::vector<int> cpus;  // CPUs the thread may run on, empty for any
+	optional<int> priority; // nice value on POSIX, thread priority on Windows
+};
+
 namespace this_thread {
 
-void set_name(const string &name);
+void set_name(const string &name); // prefixed with the name prefix, "wsc" by default
+void set_name_prefix(string prefix);
+void set_affinity(const std::vector<int> &cpus);
+void set_priority(int priority);
+void apply(const thread_options &options);
 
 } // namespace this_thread
 
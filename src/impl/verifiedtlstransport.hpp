@@ -22,7 +22,7 @@ public:
 
 private:
 #if USE_MBEDTLS
-	mbedtls_x509_crt mCaCert;
+	shared_ptr<mbedtls_x509_crt> mCaCert; // shared between transports
 #endif
 };
 
@@ -8,13 +8,15 @@
 
 #include "websocketimpl.hpp"
 #include "common.hpp"
+#include "connectionpool.hpp"
 #include "internals.hpp"
-#include "processor.hpp"
+#include "threadpool.hpp"
 #include "utils.hpp"
 
 #include "httpproxytransport.hpp"
 #include "tcptransport.hpp"
 #include "tlstransport.hpp"
+#include "unixtransport.hpp"
 #include "verifiedtlstransport.hpp"
 #include "wstransport.hpp"
 
@@ -32,8 +34,6 @@ using namespace std::placeholders;
 using namespace std::chrono_literals;
 using std::chrono::milliseconds;
 
-const string PemBeginCertificateTag = "-----BEGIN CERTIFICATE-----";
-
 WebSocket::WebSocket(optional<Configuration> optConfig, certificate_ptr certificate)
     : config(optConfig ? std::move(*optConfig) : Configuration()),
       mRecvQueue(RECV_QUEUE_LIMIT, message_size_func) {
@@ -42,11 +42,8 @@ WebSocket::WebSocket(optional<Configuration> optConfig, certificate_ptr certific
 	if (certificate) {
 		mCertificate = std::move(certificate);
 	} else if (config.certificatePemFile && config.keyPemFile) {
-		mCertificate = std::make_shared<Certificate>(
-		    config.certificatePemFile->find(PemBeginCertificateTag) != string::npos
-		        ? Certificate::FromString(*config.certificatePemFile, *config.keyPemFile)
-		        : Certificate::FromFile(*config.certificatePemFile, *config.keyPemFile,
-		                                config.keyPemPass.value_or("")));
+		mCertificate = load_certificate(*config.certificatePemFile, *config.keyPemFile,
+		                                config.keyPemPass.value_or(""));
 	} else if (config.certificatePemFile || config.keyPemFile) {
 		throw std::invalid_argument(
 		    "Either none or both certificate and key PEM files must be specified");
@@ -66,11 +63,44 @@ WebSocket::WebSocket(optional<Configuration> optConfig, certificate_ptr certific
 
 WebSocket::~WebSocket() { PLOG_VERBOSE << "Destroying WebSocket"; }
 
-void WebSocket::open(const string &url) {
-	PLOG_VERBOSE << "Opening WebSocket to URL: " << url;
+namespace {
+
+struct ParsedUrl {
+	bool isSecure;
+	string host; // for the Host header
+	string hostname;
+	string service;
+	string path;
+	bool isUnix = false; // hostname is a Unix socket path
+};
+
+ParsedUrl parse_url(const string &url) {
+	// Unix domain socket, as in ws+unix:///path/to.sock:/ws/path. The socket path ends at the first
+	// ':' followed by '/' or by the end of the URL, so a ":/" in the socket path must be
+	// percent-encoded as "%3A/".
+	static const string unixPrefix = "ws+unix://";
+	if (url.compare(0, unixPrefix.size(), unixPrefix) == 0) {
+		string rest = url.substr(unixPrefix.size());
+		size_t pos = rest.find(':');
+		while (pos != string::npos && pos + 1 < rest.size() && rest[pos + 1] != '/')
+			pos = rest.find(':', pos + 1);
+
+		string socketPath, path;
+		if (pos != string::npos) {
+			socketPath = utils::url_decode(rest.substr(0, pos));
+			path = rest.substr(pos + 1);
+		} else {
+			socketPath = utils::url_decode(rest);
+		}
 
-	if (state != State::Closed)
-		throw std::logic_error("WebSocket must be closed before opening");
+		if (socketPath.empty())
+			throw std::invalid_argument("Invalid WebSocket URL: " + url);
+
+		if (path.empty() || path.front() != '/')
+			path.insert(path.begin(), '/');
+
+		return ParsedUrl{false, "localhost", std::move(socketPath), "", std::move(path), true};
+	}
 
 	// Modified regex from RFC 3986, see https://www.rfc-editor.org/rfc/rfc3986.html#appendix-B
 	static const char *rs =
@@ -89,7 +119,7 @@ void WebSocket::open(const string &url) {
 	if (scheme != "ws" && scheme != "wss")
 		throw std::invalid_argument("Invalid WebSocket scheme: " + scheme);
 
-	mIsSecure = (scheme != "ws");
+	bool isSecure = (scheme != "ws");
 
 	string username = utils::url_decode(m[6]);
 	string password = utils::url_decode(m[8]);
@@ -101,7 +131,7 @@ void WebSocket::open(const string &url) {
 	string hostname = m[10];
 	string service = m[12];
 	if (service.empty()) {
-		service = mIsSecure ? "443" : "80";
+		service = isSecure ? "443" : "80";
 		host = hostname;
 	} else {
 		host = hostname + ':' + service;
@@ -122,18 +152,119 @@ void WebSocket::open(const string &url) {
 	if (string query = m[15]; !query.empty())
 		path += "?" + query;
 
+	return ParsedUrl{isSecure, std::move(host), std::move(hostname), std::move(service),
+	                 std::move(path)};
+}
+
+// Pooled connections are only available for direct connections without client certificate
+optional<ConnectionPool::Endpoint> make_endpoint(const WebSocket::Configuration &config,
+                                                 const string &hostname, const string &service,
+                                                 bool isSecure, bool hasCertificate) {
+	if (config.proxyServer || hasCertificate || hostname.empty() || service.empty())
+		return nullopt;
+
+	ConnectionPool::Endpoint endpoint;
+	endpoint.hostname = hostname;
+	endpoint.service = service;
+	endpoint.isSecure = isSecure;
+	if (isSecure) {
+#ifdef _WIN32
+		endpoint.verify = false; // See WebSocket::initTlsTransport()
+#else
+		endpoint.verify = !config.disableTlsVerification;
+#endif
+		endpoint.caCertificatePemFile = config.caCertificatePemFile;
+		endpoint.tlsPolicy = config.tlsPolicy;
+		endpoint.kernelTls = config.enableKernelTls;
+	}
+	endpoint.fastOpen = config.enableTcpFastOpen;
+	endpoint.connectionTimeout = config.connectionTimeout;
+	return endpoint;
+}
+
+// Resumed sessions skip certificate verification, so they are only shared between connections
+// with the same verification settings and client certificate
+string session_cache_key(const WebSocket::Configuration &config, const string &hostname,
+                         const string &service, bool verify, const certificate_ptr &certificate) {
+	ConnectionPool::Endpoint endpoint;
+	endpoint.hostname = hostname;
+	endpoint.service = service;
+	endpoint.isSecure = true;
+	endpoint.verify = verify;
+	endpoint.caCertificatePemFile = config.caCertificatePemFile;
+	endpoint.tlsPolicy = config.tlsPolicy;
+
+	string key = endpoint.sessionKey(); // same as pooled connections
+	if (certificate)
+		key += "|cert:" + certificate->fingerprint().value;
+
+	return key;
+}
+
+} // namespace
+
+void WebSocket::open(const string &url) {
+	PLOG_VERBOSE << "Opening WebSocket to URL: " << url;
+
+	if (state != State::Closed)
+		throw std::logic_error("WebSocket must be closed before opening");
+
+	{
+		// Drop file transfers interrupted by a previous close
+		std::lock_guard lock(mFileTransfersMutex);
+		mFileTransfers = {};
+		mFileTransfersPending = false;
+	}
+
+	auto [isSecure, host, hostname, service, path, isUnix] = parse_url(url);
+	mIsSecure = isSecure;
+
+	if (isUnix) {
+#ifdef _WIN32
+		throw std::invalid_argument("Unix domain sockets are not supported on Windows");
+#endif
+		if (config.proxyServer)
+			throw std::invalid_argument("Proxy server is not supported for Unix domain sockets");
+	}
+
 	mHostname = hostname; // for TLS SNI and Proxy
 	mService = service;   // For proxy
 	std::atomic_store(&mWsHandshake, std::make_shared<WsHandshake>(host, path, config.protocols));
 
 	changeState(State::Connecting);
 
+#ifndef _WIN32
+	if (isUnix) {
+		setTcpTransport(std::make_shared<UnixTransport>(hostname, nullptr));
+		return;
+	}
+#endif
+
 	if (config.proxyServer) {
 		setTcpTransport(std::make_shared<TcpTransport>(
 		    config.proxyServer->hostname, std::to_string(config.proxyServer->port), nullptr));
-	} else {
-		setTcpTransport(std::make_shared<TcpTransport>(hostname, service, nullptr));
+		return;
 	}
+
+	if (auto endpoint = make_endpoint(config, hostname, service, isSecure, mCertificate != nullptr))
+		if (auto connection = ConnectionPool::Instance().claim(*endpoint)) {
+			setPooledConnection(std::move(*connection));
+			return;
+		}
+
+	setTcpTransport(std::make_shared<TcpTransport>(hostname, service, nullptr));
+}
+
+void WebSocket::Preconnect(const string &url, size_t count, const Configuration &config) {
+	auto parsed = parse_url(url);
+	bool hasCertificate = config.certificatePemFile || config.keyPemFile;
+	auto endpoint =
+	    make_endpoint(config, parsed.hostname, parsed.service, parsed.isSecure, hasCertificate);
+	if (!endpoint)
+		throw std::invalid_argument("Preconnecting is not supported with a proxy server, a client "
+		                            "certificate or a Unix domain socket");
+
+	ConnectionPool::Instance().preconnect(std::move(*endpoint), count);
 }
 
 void WebSocket::close() {
@@ -163,11 +294,13 @@ size_t WebSocket::maxMessageSize() const {
 }
 
 optional<message_variant> WebSocket::receive() {
+	std::lock_guard lock(mRecvMutex);
 	auto next = mRecvQueue.pop();
 	return next ? std::make_optional(to_variant(std::move(**next))) : nullopt;
 }
 
 optional<message_variant> WebSocket::peek() {
+	std::lock_guard lock(mRecvMutex);
 	auto next = mRecvQueue.peek();
 	return next ? std::make_optional(to_variant(std::move(**next))) : nullopt;
 }
@@ -186,6 +319,80 @@ bool WebSocket::outgoing(message_ptr message) {
 	return mWsTransport->send(message);
 }
 
+bool WebSocket::outgoing(message_ptr message, std::function<void(bool written)> callback) {
+	auto tcp = getTcpTransport();
+	if (state != State::Open || !mWsTransport || !tcp)
+		throw std::runtime_error("WebSocket is not open");
+
+	if (message->size() > maxMessageSize())
+		throw std::runtime_error("Message size exceeds limit");
+
+	// Fail fast rather than piling up data the producer will wait for anyway
+	if (auto limit = config.maxBufferedAmount;
+	    limit && bufferedAmount.load() + message->size() > *limit) {
+		mStrand->post(callback, false);
+		return false;
+	}
+
+	// The frame may be held back while a file is being sent, so wait for it to reach TCP. Data
+	// sent concurrently by another thread may be counted too, this can only delay the call.
+	mWsTransport->send(message, [tcp = std::move(tcp), strand = mStrand,
+	                             callback = std::move(callback)](bool sent) {
+		if (!sent) {
+			strand->post(callback, false);
+			return;
+		}
+
+		tcp->onWritten([strand, callback](bool written) { strand->post(callback, written); });
+	});
+	return true;
+}
+
+bool WebSocket::sendFile(const string &path, size_t offset, optional<size_t> length) {
+	if (state != State::Open || !mWsTransport)
+		throw std::runtime_error("WebSocket is not open");
+
+	auto file = std::make_unique<MappedFile>(path, offset, length);
+	PLOG_DEBUG << "Sending file \"" << path << "\", size=" << file->size();
+	{
+		std::lock_guard lock(mFileTransfersMutex);
+		mFileTransfers.push({std::move(file), 0});
+		mFileTransfersPending = true;
+	}
+
+	return flushFileTransfers();
+}
+
+void WebSocket::triggerBufferedAmount(size_t amount) {
+	// Called with the TCP send mutex locked, so the callback, which may send, and the flush are
+	// delegated
+	mTcpBufferedAmount = amount;
+	publishBufferedAmount();
+
+	if (amount <= FILE_SEND_BUFFER_LOW && mFileTransfersPending &&
+	    !mFileFlushScheduled.exchange(true)) {
+		mStrand->post([weak_this = weak_from_this()]() {
+			if (auto shared_this = weak_this.lock()) {
+				shared_this->mFileFlushScheduled = false;
+				shared_this->flushFileTransfers();
+			}
+		});
+	}
+}
+
+void WebSocket::triggerHeldBackAmount(size_t amount) {
+	// Called with the WebSocket transport fragment mutex locked
+	mHeldBackAmount = amount;
+	publishBufferedAmount();
+}
+
+void WebSocket::publishBufferedAmount() {
+	// The last caller publishes the sum of the latest amounts
+	std::lock_guard lock(mBufferedAmountMutex);
+	if (updateBufferedAmount(mTcpBufferedAmount.load() + mHeldBackAmount.load()))
+		mStrand->post(weak_bind(&WebSocket::triggerBufferedAmountLow, this));
+}
+
 void WebSocket::incoming(message_ptr message) {
 	if (!message) {
 		remoteClose();
@@ -225,45 +432,23 @@ shared_ptr<TcpTransport> WebSocket::setTcpTransport(shared_ptr<TcpTransport> tra
 	if (!transport)
 		throw std::logic_error("TCP transport is null");
 
-	using State = TcpTransport::State;
 	try {
 		if (std::atomic_load(&mTcpTransport))
 			throw std::logic_error("TCP transport is already set");
 
 		transport->onBufferedAmount(weak_bind(&WebSocket::triggerBufferedAmount, this, _1));
 
-		transport->onStateChange([this, weak_this = weak_from_this()](State transportState) {
-			auto shared_this = weak_this.lock();
-			if (!shared_this)
-				return;
-			switch (transportState) {
-			case State::Connected:
-				if (config.proxyServer)
-					initProxyTransport();
-				else if (mIsSecure)
-					initTlsTransport();
-				else
-					initWsTransport();
-				break;
-			case State::Failed:
-				triggerError("TCP connection failed");
-				remoteClose();
-				break;
-			case State::Disconnected:
-				if (state == WebSocket::State::Connecting)
-					remoteClose();
-				break;
-			default:
-				// Ignore
-				break;
-			}
-		});
+		transport->onStateChange(weak_bind(&WebSocket::processTcpStateChange, this, _1));
 
 		// WS transport sends a ping on read timeout
 		auto pingInterval = config.pingInterval.value_or(10000ms);
 		if (pingInterval > milliseconds::zero())
 			transport->setReadTimeout(pingInterval);
 
+		transport->setFastOpen(config.enableTcpFastOpen);
+		transport->setReadBudget(config.readBudget.value_or(DEFAULT_READ_BUDGET),
+		                         config.readMessageBudget.value_or(DEFAULT_READ_MESSAGE_BUDGET));
+
 		scheduleConnectionTimeout();
 
 		return emplaceTransport(this, &mTcpTransport, std::move(transport));
@@ -274,6 +459,135 @@ shared_ptr<TcpTransport> WebSocket::setTcpTransport(shared_ptr<TcpTransport> tra
 	}
 }
 
+void WebSocket::setPooledConnection(ConnectionPool::Connection connection) {
+	PLOG_VERBOSE << "Using pooled connection";
+
+	auto tcp = std::move(connection.tcp);
+	auto tls = std::move(connection.tls);
+	try {
+		if (std::atomic_load(&mTcpTransport))
+			throw std::logic_error("TCP transport is already set");
+
+		tcp->onBufferedAmount(weak_bind(&WebSocket::triggerBufferedAmount, this, _1));
+		tcp->onStateChange(weak_bind(&WebSocket::processTcpStateChange, this, _1));
+
+		auto pingInterval = config.pingInterval.value_or(10000ms);
+		if (pingInterval > milliseconds::zero())
+			tcp->setReadTimeout(pingInterval);
+
+		tcp->setReadBudget(config.readBudget.value_or(DEFAULT_READ_BUDGET),
+		                   config.readMessageBudget.value_or(DEFAULT_READ_MESSAGE_BUDGET));
+
+		if (tls) {
+			tls->onStateChange(weak_bind(&WebSocket::processTlsStateChange, this, _1));
+			tls->setOffloadProcessing(config.offloadTlsProcessing);
+			tls->setRecordSize(config.tlsRecordSize);
+		}
+
+		std::atomic_store(&mTcpTransport, tcp);
+		std::atomic_store(&mTlsTransport, tls);
+
+		scheduleConnectionTimeout();
+
+	} catch (const std::exception &e) {
+		PLOG_ERROR << e.what();
+		remoteClose();
+		throw std::runtime_error("Pooled connection initialization failed");
+	}
+
+	// The connection might have been lost before the state callbacks were replaced
+	auto s = tls ? tls->state() : tcp->state();
+	if (s != Transport::State::Connected) {
+		PLOG_WARNING << "Pooled connection lost";
+		triggerError("Pooled connection lost");
+		remoteClose();
+		return;
+	}
+
+	initWsTransport();
+}
+
+void WebSocket::processTcpStateChange(TcpTransport::State transportState) {
+	using State = TcpTransport::State;
+	switch (transportState) {
+	case State::Connected:
+		if (config.proxyServer)
+			initProxyTransport();
+		else if (mIsSecure)
+			initTlsTransport();
+		else
+			initWsTransport();
+		break;
+	case State::Failed:
+		triggerError("TCP connection failed");
+		remoteClose();
+		break;
+	case State::Disconnected:
+		if (state == WebSocket::State::Connecting)
+			remoteClose();
+		break;
+	default:
+		// Ignore
+		break;
+	}
+}
+
+void WebSocket::processTlsStateChange(TlsTransport::State transportState) {
+	using State = TlsTransport::State;
+	switch (transportState) {
+	case State::Connected:
+		initWsTransport();
+		break;
+	case State::Failed:
+		triggerError("TLS connection failed");
+		remoteClose();
+		break;
+	case State::Disconnected:
+		if (state == WebSocket::State::Connecting)
+			remoteClose();
+		break;
+	default:
+		// Ignore
+		break;
+	}
+}
+
+bool WebSocket::flushFileTransfers() {
+	std::lock_guard lock(mFileTransfersMutex);
+	try {
+		auto transport = std::atomic_load(&mWsTransport);
+		if (!transport)
+			throw std::runtime_error("WebSocket is closed");
+
+		while (!mFileTransfers.empty()) {
+			// Wait for the buffered amount to decrease, at most one fragment overshoots. Messages
+			// held back until the end of the file are not counted.
+			if (mTcpBufferedAmount >= FILE_SEND_BUFFER_HIGH)
+				return false;
+
+			auto &transfer = mFileTransfers.front();
+			const size_t size = transfer.file->size();
+			const size_t length = std::min(size - transfer.sent, FILE_SEND_FRAGMENT_SIZE);
+			const bool first = transfer.sent == 0;
+			const bool fin = transfer.sent + length == size;
+			transport->sendFragment(transfer.file->data() + transfer.sent, length, first, fin);
+			transfer.sent += length;
+
+			if (fin)
+				mFileTransfers.pop(); // unmaps the file
+		}
+
+		mFileTransfersPending = false;
+		return true;
+
+	} catch (const std::exception &e) {
+		PLOG_WARNING << "File sending interrupted: " << e.what();
+		mFileTransfers = {};
+		mFileTransfersPending = false;
+		return false;
+	}
+}
+
 shared_ptr<HttpProxyTransport> WebSocket::initProxyTransport() {
 	PLOG_VERBOSE << "Starting Tcp Proxy transport";
 	using State = HttpProxyTransport::State;
@@ -323,7 +637,6 @@ shared_ptr<HttpProxyTransport> WebSocket::initProxyTransport() {
 
 shared_ptr<TlsTransport> WebSocket::initTlsTransport() {
 	PLOG_VERBOSE << "Starting TLS transport";
-	using State = TlsTransport::State;
 	try {
 		if (auto transport = std::atomic_load(&mTlsTransport))
 			return transport;
@@ -343,27 +656,7 @@ shared_ptr<TlsTransport> WebSocket::initTlsTransport() {
 			lower = transport;
 		}
 
-		auto stateChangeCallback = [this, weak_this = weak_from_this()](State transportState) {
-			auto shared_this = weak_this.lock();
-			if (!shared_this)
-				return;
-			switch (transportState) {
-			case State::Connected:
-				initWsTransport();
-				break;
-			case State::Failed:
-				triggerError("TLS connection failed");
-				remoteClose();
-				break;
-			case State::Disconnected:
-				if (state == WebSocket::State::Connecting)
-					remoteClose();
-				break;
-			default:
-				// Ignore
-				break;
-			}
-		};
+		auto stateChangeCallback = weak_bind(&WebSocket::processTlsStateChange, this, _1);
 
 		bool verify = mHostname.has_value() && !config.disableTlsVerification;
 
@@ -382,6 +675,23 @@ shared_ptr<TlsTransport> WebSocket::initTlsTransport() {
 			transport =
 			    std::make_shared<TlsTransport>(lower, mHostname, mCertificate, stateChangeCallback);
 
+		transport->setOffloadProcessing(config.offloadTlsProcessing);
+		transport->setKernelTls(config.enableKernelTls);
+		transport->setRecordSize(config.tlsRecordSize);
+		if (config.tlsPolicy)
+			transport->setPolicy(*config.tlsPolicy);
+
+		if (mHostname && mService && !mService->empty())
+			transport->setSessionCacheKey(
+			    session_cache_key(config, *mHostname, *mService, verify, mCertificate));
+
+		auto handshake = std::atomic_load(&mWsHandshake);
+		if (config.enableTlsEarlyData && handshake) {
+			const string request = handshake->generateHttpRequest();
+			auto data = reinterpret_cast<const byte *>(request.data());
+			transport->setEarlyData(binary(data, data + request.size()));
+		}
+
 		return emplaceTransport(this, &mTlsTransport, std::move(transport));
 	} catch (const std::exception &e) {
 		PLOG_ERROR << e.what();
@@ -450,6 +760,12 @@ shared_ptr<WsTransport> WebSocket::initWsTransport() {
 		auto transport = std::make_shared<WsTransport>(lower, mWsHandshake, config,
 		                                               weak_bind(&WebSocket::incoming, this, _1),
 		                                               stateChangeCallback);
+		transport->onBufferedAmount(weak_bind(&WebSocket::triggerHeldBackAmount, this, _1));
+
+		// If rejected, the early data is replayed by sending the request again
+		auto tls = std::atomic_load(&mTlsTransport);
+		if (mIsSecure && tls && tls->earlyDataAccepted())
+			transport->setHttpRequestSent();
 
 		return emplaceTransport(this, &mWsTransport, std::move(transport));
 	} catch (const std::exception &e) {
@@ -486,8 +802,10 @@ void WebSocket::closeTransports() {
 	auto tls = std::atomic_exchange(&mTlsTransport, decltype(mTlsTransport)(nullptr));
 	auto tcp = std::atomic_exchange(&mTcpTransport, decltype(mTcpTransport)(nullptr));
 
-	if (ws)
+	if (ws) {
 		ws->onRecv(nullptr);
+		ws->onBufferedAmount(nullptr);
+	}
 
 	if (tcp)
 		tcp->onBufferedAmount(nullptr);
@@ -499,18 +817,18 @@ void WebSocket::closeTransports() {
 		if (t)
 			t->onStateChange(nullptr);
 
-	TearDownProcessor::Instance().enqueue(
-	    [transports = std::move(transports), token = Init::Instance().token()]() mutable {
-		    for (const auto &t : transports) {
-			    if (t) {
-				    t->stop();
-				    break;
-			    }
-		    }
+	// Connections are torn down in parallel, after the tasks already posted for this one
+	mStrand->post([transports = std::move(transports), token = Init::Instance().token()]() mutable {
+		for (const auto &t : transports) {
+			if (t) {
+				t->stop();
+				break;
+			}
+		}
 
-		    for (auto &t : transports)
-			    t.reset();
-	    });
+		for (auto &t : transports)
+			t.reset();
+	});
 
 	triggerClosed();
 }
@@ -519,14 +837,18 @@ void WebSocket::scheduleConnectionTimeout() {
 	auto defaultTimeout = 30s;
 	auto timeout = config.connectionTimeout.value_or(milliseconds(defaultTimeout));
 	if (timeout > milliseconds::zero()) {
-		ThreadPool::Instance().schedule(timeout, [weak_this = weak_from_this()]() {
-			if (auto locked = weak_this.lock()) {
-				if (locked->state == WebSocket::State::Connecting) {
-					PLOG_WARNING << "WebSocket connection timed out";
-					locked->triggerError("Connection timed out");
-					locked->remoteClose();
-				}
-			}
+		// Run on the strand, so the timeout is ordered with the other tasks for this connection
+		ThreadPool::Instance().post(timeout, [weak_this = weak_from_this()]() {
+			if (auto locked = weak_this.lock())
+				locked->mStrand->post([weak_this]() {
+					if (auto locked = weak_this.lock()) {
+						if (locked->state == WebSocket::State::Connecting) {
+							PLOG_WARNING << "WebSocket connection timed out";
+							locked->triggerError("Connection timed out");
+							locked->remoteClose();
+						}
+					}
+				});
 		});
 	}
 }
@@ -11,10 +11,13 @@
 
 #include "channel.hpp"
 #include "common.hpp"
+#include "connectionpool.hpp"
 #include "httpproxytransport.hpp"
 #include "init.hpp"
+#include "mappedfile.hpp"
 #include "message.hpp"
-#include "queue.hpp"
+#include "ringqueue.hpp"
+#include "strand.hpp"
 #include "tcptransport.hpp"
 #include "tlstransport.hpp"
 #include "wstransport.hpp"
@@ -22,6 +25,7 @@
 #include "websocket.hpp"
 
 #include <atomic>
+#include <queue>
 #include <thread>
 
 namespace wsc::impl {
@@ -33,15 +37,20 @@ struct WebSocket final : public Channel, public std::enable_shared_from_this<Web
 	WebSocket(optional<Configuration> optConfig = nullopt, certificate_ptr certificate = nullptr);
 	~WebSocket();
 
+	static void Preconnect(const string &url, size_t count, const Configuration &config);
+
 	void open(const string &url);
 	void close();
 	void remoteClose();
 	bool outgoing(message_ptr message);
+	bool outgoing(message_ptr message, std::function<void(bool written)> callback);
 	void incoming(message_ptr message);
+	bool sendFile(const string &path, size_t offset, optional<size_t> length);
 
 	optional<message_variant> receive() override;
 	optional<message_variant> peek() override;
 	size_t availableAmount() const override;
+	void triggerBufferedAmount(size_t amount) override;
 
 	bool isOpen() const;
 	bool isClosed() const;
@@ -50,6 +59,7 @@ struct WebSocket final : public Channel, public std::enable_shared_from_this<Web
 	bool changeState(State state);
 
 	shared_ptr<TcpTransport> setTcpTransport(shared_ptr<TcpTransport> transport);
+	void setPooledConnection(ConnectionPool::Connection connection);
 	shared_ptr<HttpProxyTransport> initProxyTransport();
 	shared_ptr<TlsTransport> initTlsTransport();
 	shared_ptr<WsTransport> initWsTransport();
@@ -68,8 +78,14 @@ private:
 	static certificate_ptr loadCertificate(const Configuration &config);
 
 	void scheduleConnectionTimeout();
+	void processTcpStateChange(TcpTransport::State transportState);
+	void processTlsStateChange(TlsTransport::State transportState);
+	void triggerHeldBackAmount(size_t amount);
+	void publishBufferedAmount();
+	bool flushFileTransfers();
 
 	const init_token mInitToken = Init::Instance().token();
+	const shared_ptr<Strand> mStrand = std::make_shared<Strand>(); // orders tasks for this socket
 
 	certificate_ptr mCertificate;
 	bool mIsSecure;
@@ -83,7 +99,24 @@ private:
 	shared_ptr<WsTransport> mWsTransport;
 	shared_ptr<WsHandshake> mWsHandshake;
 
-	Queue<message_ptr> mRecvQueue;
+	RingQueue<message_ptr> mRecvQueue; // the producer is the transport
+	std::mutex mRecvMutex;             // serializes application consumers
+
+	struct FileTransfer {
+		unique_ptr<MappedFile> file;
+		size_t sent = 0;
+	};
+
+	std::queue<FileTransfer> mFileTransfers;
+	std::atomic<bool> mFileTransfersPending = false; // readable without locking the mutex
+	std::atomic<bool> mFileFlushScheduled = false;
+	std::mutex mFileTransfersMutex;
+
+	// bufferedAmount is the sum of the amount buffered by TCP and the messages held back by the
+	// WebSocket transport during a file transfer
+	std::atomic<size_t> mTcpBufferedAmount = 0;
+	std::atomic<size_t> mHeldBackAmount = 0;
+	std::mutex mBufferedAmountMutex;
 };
 
 } // namespace wsc::impl
@@ -59,19 +59,33 @@ WsTransport::WsTransport(LowerTransport lower, shared_ptr<WsHandshake> handshake
 	PLOG_DEBUG << "Initializing WebSocket transport";
 }
 
-WsTransport::~WsTransport() { unregisterIncoming(); }
+WsTransport::~WsTransport() {
+	unregisterIncoming();
+
+	std::lock_guard lock(mFragmentMutex);
+	while (!mHeldBack.empty()) {
+		if (auto &callback = std::get<1>(mHeldBack.front()))
+			callback(false);
+
+		mHeldBack.pop();
+	}
+}
 
 void WsTransport::start() {
 	registerIncoming();
 
 	changeState(State::Connecting);
-	if (mIsClient)
+	if (mIsClient && !mHttpRequestSent)
 		sendHttpRequest();
 }
 
+void WsTransport::setHttpRequestSent() { mHttpRequestSent = true; }
+
 void WsTransport::stop() { close(); }
 
-bool WsTransport::send(message_ptr message) {
+bool WsTransport::send(message_ptr message) { return send(std::move(message), nullptr); }
+
+bool WsTransport::send(message_ptr message, sent_callback callback) {
 	if (state() != State::Connected)
 		throw std::runtime_error("WebSocket is not open");
 
@@ -79,8 +93,62 @@ bool WsTransport::send(message_ptr message) {
 		return false;
 
 	PLOG_VERBOSE << "Send size=" << message->size();
-	return sendFrame({message->type == Message::String ? TEXT_FRAME : BINARY_FRAME, message->data(),
-	                  message->size(), true, mIsClient});
+
+	std::lock_guard lock(mFragmentMutex);
+	if (mFragmenting) {
+		mHeldBackAmount += message->size();
+		mHeldBack.emplace(std::move(message), std::move(callback));
+		if (mBufferedAmountCallback)
+			mBufferedAmountCallback(mHeldBackAmount);
+
+		return false;
+	}
+
+	bool result = sendFrame({message->type == Message::String ? TEXT_FRAME : BINARY_FRAME,
+	                         message->data(), message->size(), true, mIsClient});
+	if (callback)
+		callback(true);
+
+	return result;
+}
+
+void WsTransport::onBufferedAmount(amount_callback callback) {
+	std::lock_guard lock(mFragmentMutex);
+	mBufferedAmountCallback = std::move(callback);
+}
+
+bool WsTransport::sendFragment(const byte *data, size_t size, bool first, bool fin) {
+	if (state() != State::Connected)
+		throw std::runtime_error("WebSocket is not open");
+
+	PLOG_VERBOSE << "Send fragment size=" << size << (fin ? " (fin)" : "");
+
+	std::lock_guard lock(mFragmentMutex);
+	if (first == mFragmenting)
+		throw std::logic_error(first ? "A fragmented message is already being sent"
+		                             : "No fragmented message is being sent");
+
+	// sendFrame() does not modify the payload
+	bool result = sendFrame({first ? BINARY_FRAME : CONTINUATION, const_cast<byte *>(data), size,
+	                         fin, mIsClient});
+
+	mFragmenting = !fin;
+	if (fin && !mHeldBack.empty()) {
+		while (!mHeldBack.empty()) {
+			auto [message, callback] = std::move(mHeldBack.front());
+			mHeldBack.pop();
+			result = sendFrame({message->type == Message::String ? TEXT_FRAME : BINARY_FRAME,
+			                    message->data(), message->size(), true, mIsClient});
+			if (callback)
+				callback(true);
+		}
+
+		mHeldBackAmount = 0;
+		if (mBufferedAmountCallback)
+			mBufferedAmountCallback(0);
+	}
+
+	return result;
 }
 
 void WsTransport::close() {
@@ -100,13 +168,12 @@ void WsTransport::close() {
 		return;
 	}
 
-	ThreadPool::Instance().schedule(std::chrono::seconds(10),
-	                                [this, weak_this = weak_from_this()]() {
-		                                if (auto shared_this = weak_this.lock()) {
-			                                PLOG_DEBUG << "WebSocket close timeout";
-			                                changeState(State::Disconnected);
-		                                }
-	                                });
+	ThreadPool::Instance().post(std::chrono::seconds(10), [this, weak_this = weak_from_this()]() {
+		if (auto shared_this = weak_this.lock()) {
+			PLOG_DEBUG << "WebSocket close timeout";
+			changeState(State::Disconnected);
+		}
+	});
 }
 
 void WsTransport::incoming(message_ptr message) {
@@ -390,15 +457,13 @@ bool WsTransport::sendFrame(const Frame &frame) {
 		cur += 8;
 	}
 
+	byte *maskingKey = nullptr;
 	if (frame.mask) {
-		byte *maskingKey = reinterpret_cast<byte *>(cur);
+		maskingKey = reinterpret_cast<byte *>(cur);
 
 		auto u = reinterpret_cast<uint8_t *>(maskingKey);
 		std::generate(u, u + 4, utils::random_bytes_engine());
 		cur += 4;
-
-		for (size_t i = 0; i < frame.length; ++i)
-			frame.payload[i] ^= maskingKey[i % 4];
 	}
 
 	const size_t length = cur - buffer; // header length
@@ -407,6 +472,13 @@ bool WsTransport::sendFrame(const Frame &frame) {
 	std::copy(frame.payload, frame.payload + frame.length,
 	          message->begin() + length); // payload
 
+	// Mask the copy so the payload is left untouched
+	if (maskingKey) {
+		byte *payload = message->data() + length;
+		for (size_t i = 0; i < frame.length; ++i)
+			payload[i] ^= maskingKey[i % 4];
+	}
+
 	return outgoing(std::move(message));
 }
 
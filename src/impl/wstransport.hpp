@@ -15,6 +15,8 @@
 #include "wshandshake.hpp"
 
 #include <atomic>
+#include <queue>
+#include <tuple>
 
 namespace wsc::impl {
 
@@ -26,6 +28,8 @@ class WsTransport final : public Transport, public std::enable_shared_from_this<
 public:
 	using LowerTransport =
 	    variant<shared_ptr<TcpTransport>, shared_ptr<HttpProxyTransport>, shared_ptr<TlsTransport>>;
+	using amount_callback = std::function<void(size_t amount)>;
+	using sent_callback = std::function<void(bool sent)>;
 
 	WsTransport(LowerTransport lower, shared_ptr<WsHandshake> handshake,
 	            const WebSocketConfiguration &config, message_callback recvCallback,
@@ -36,10 +40,23 @@ public:
 	void stop() override;
 	bool send(message_ptr message) override;
 	void close();
+
+	// Call back once the frame is passed to the lower transport, possibly after being held back,
+	// or with false if it is dropped. Called with the fragment mutex locked.
+	bool send(message_ptr message, sent_callback callback);
+
+	// Amount of data held back while a fragmented message is being sent
+	void onBufferedAmount(amount_callback callback);
+
+	// Send a binary message in fragments, data messages sent meanwhile are held until fin
+	bool sendFragment(const byte *data, size_t size, bool first, bool fin);
 	void incoming(message_ptr message) override;
 
 	bool isClient() const { return mIsClient; }
 
+	// The HTTP request was already sent, as TLS early data, must be called before start()
+	void setHttpRequestSent();
+
 private:
 	enum Opcode : uint8_t {
 		CONTINUATION = 0,
@@ -78,8 +95,16 @@ private:
 	Opcode mPartialOpcode;
 	size_t mIgnoreLength = 0;
 	std::mutex mSendMutex;
+	std::mutex mFragmentMutex; // held across data frames, locked before mSendMutex
+	bool mFragmenting = false; // a fragmented message is being sent
+
+	// Data messages waiting for the end of the fragments
+	std::queue<std::tuple<message_ptr, sent_callback>> mHeldBack;
+	size_t mHeldBackAmount = 0;
+	amount_callback mBufferedAmountCallback;
 	int mOutstandingPings = 0;
 	std::atomic<bool> mCloseSent = false;
+	bool mHttpRequestSent = false;
 };
 
 } // namespace wsc::impl
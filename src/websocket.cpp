@@ -41,6 +41,10 @@ bool WebSocket::isClosed() const { return impl()->state.load() == State::Closed;
 
 size_t WebSocket::maxMessageSize() const { return impl()->maxMessageSize(); }
 
+void WebSocket::Preconnect(const string &url, size_t count, Configuration config) {
+	impl::WebSocket::Preconnect(url, count, config);
+}
+
 void WebSocket::open(const string &url) { impl()->open(url); }
 
 void WebSocket::close() { impl()->close(); }
@@ -55,6 +59,21 @@ bool WebSocket::send(const byte *data, size_t size) {
 	return impl()->outgoing(make_message(data, data + size, Message::Binary));
 }
 
+bool WebSocket::sendAsync(message_variant data, std::function<void(bool written)> callback) {
+	return impl()->outgoing(make_message(std::move(data)), std::move(callback));
+}
+
+std::future<bool> WebSocket::sendAsync(message_variant data) {
+	auto promise = std::make_shared<std::promise<bool>>();
+	auto future = promise->get_future();
+	sendAsync(std::move(data), [promise](bool written) { promise->set_value(written); });
+	return future;
+}
+
+bool WebSocket::sendFile(const string &path, size_t offset, optional<size_t> length) {
+	return impl()->sendFile(path, offset, length);
+}
+
 optional<string> WebSocket::remoteAddress() const {
 	auto tcpTransport = impl()->getTcpTransport();
 	return tcpTransport ? make_optional(tcpTransport->remoteAddress()) : nullopt;
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "client.hpp"
+#include "server.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+namespace {
+
+// Counts the allocations of the whole benchmark executable, except on the threads of the test
+// server, which run in the same process
+atomic<size_t> Allocations = 0;
+thread_local bool Untracked = false;
+
+const size_t MessageSize = 64;
+const size_t WarmupCount = 100;
+const size_t MessageCount = 10000;
+
+} // namespace
+
+void *operator new(size_t size) {
+	if (!Untracked)
+		Allocations.fetch_add(1, memory_order_relaxed);
+
+	if (void *ptr = std::malloc(size ? size : 1))
+		return ptr;
+
+	throw bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+// C++ allocations per echoed message, including the send path, over ws, wss with records
+// processed inline, and wss with records processed on the thread pool. Allocations of the TLS
+// library through malloc() are not counted.
+void benchmark_allocations() {
+	TestServer::Options options;
+	options.onMessageBegin = []() { Untracked = true; }; // on the connection thread
+	TestServer server(options);
+
+	options.tls = true;
+	TestServer tlsServer(std::move(options));
+
+	struct Run {
+		const char *name;
+		const TestServer &server;
+		bool offload;
+	};
+	const Run runs[] = {
+	    {"ws", server, false},
+	    {"wss", tlsServer, false},
+	    {"wss offloaded", tlsServer, true},
+	};
+
+	for (const auto &run : runs) {
+		wsc::WebSocket::Configuration config;
+		config.disableTlsVerification = true;
+		config.offloadTlsProcessing = run.offload;
+		BenchmarkClient client(run.server.url(), config);
+		for (size_t i = 0; i < WarmupCount; ++i)
+			client.roundTrip(MessageSize);
+
+		size_t before = Allocations.load();
+		for (size_t i = 0; i < MessageCount; ++i)
+			client.roundTrip(MessageSize);
+
+		size_t count = Allocations.load() - before;
+		cout << run.name << ": " << fixed << setprecision(1)
+		     << double(count) / double(MessageCount) << " allocations per echoed message of "
+		     << MessageSize << " bytes" << endl;
+	}
+}
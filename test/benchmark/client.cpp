@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "client.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <variant>
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+const auto Timeout = 30s;
+
+} // namespace
+
+BenchmarkClient::BenchmarkClient(const string &url, wsc::WebSocket::Configuration config)
+    : mWebSocket(make_unique<wsc::WebSocket>(std::move(config))) {
+	mWebSocket->onOpen([this]() {
+		lock_guard lock(mMutex);
+		mOpen = true;
+		mCondition.notify_all();
+	});
+	mWebSocket->onError([this](string) {
+		lock_guard lock(mMutex);
+		mFailed = true;
+		mCondition.notify_all();
+	});
+	mWebSocket->onClosed([this]() {
+		lock_guard lock(mMutex);
+		mFailed = !mOpen;
+		mOpen = false;
+		mCondition.notify_all();
+	});
+	mWebSocket->onMessage([this](wsc::message_variant data) {
+		size_t size = std::visit([](const auto &d) { return d.size(); }, data);
+		lock_guard lock(mMutex);
+		++mReceived;
+		mReceivedBytes += size;
+		mCondition.notify_all();
+	});
+
+	auto start = clock::now();
+	mWebSocket->open(url);
+
+	unique_lock lock(mMutex);
+	if (!mCondition.wait_for(lock, Timeout, [this]() { return mOpen || mFailed; }) || !mOpen)
+		throw runtime_error("WebSocket did not open to " + url);
+
+	mOpenDuration = clock::now() - start;
+}
+
+BenchmarkClient::~BenchmarkClient() {
+	mWebSocket->close();
+	{
+		unique_lock lock(mMutex);
+		mCondition.wait_for(lock, 5s, [this]() { return !mOpen; });
+	}
+	mWebSocket->resetCallbacks();
+	mWebSocket.reset();
+}
+
+size_t BenchmarkClient::receivedBytes() const {
+	lock_guard lock(mMutex);
+	return mReceivedBytes;
+}
+
+BenchmarkClient::clock::duration BenchmarkClient::roundTrip(size_t size) {
+	return echo(size, 1);
+}
+
+BenchmarkClient::clock::duration BenchmarkClient::echo(size_t size, size_t count) {
+	wsc::binary payload(size, std::byte{'b'});
+	size_t expected;
+	{
+		lock_guard lock(mMutex);
+		expected = mReceived + count;
+	}
+
+	auto start = mLastSendTime = clock::now();
+	for (size_t i = 0; i < count; ++i)
+		mWebSocket->send(payload); // queued if it can't be sent immediately
+
+	waitReceived(expected);
+	return clock::now() - start;
+}
+
+void BenchmarkClient::waitReceived(size_t count) {
+	unique_lock lock(mMutex);
+	if (!mCondition.wait_for(lock, Timeout,
+	                         [this, count]() { return mReceived >= count || mFailed; }) ||
+	    mFailed)
+		throw runtime_error("Echo not received");
+}
+
+string describe_latencies(vector<BenchmarkClient::clock::duration> latencies) {
+	if (latencies.empty())
+		return "no samples";
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](size_t p) {
+		auto index = std::min(latencies.size() * p / 100, latencies.size() - 1);
+		return chrono::duration<double, std::micro>(latencies[index]).count();
+	};
+
+	ostringstream out;
+	out << fixed << setprecision(1) << "p50 " << percentile(50) << " us, p99 " << percentile(99)
+	    << " us";
+	return out.str();
+}
+
+string describe_throughput(size_t bytes, BenchmarkClient::clock::duration duration) {
+	double seconds = chrono::duration<double>(duration).count();
+	ostringstream out;
+	out << fixed << setprecision(1) << (seconds > 0 ? double(bytes) / seconds / 1e6 : 0.0)
+	    << " MB/s";
+	return out.str();
+}
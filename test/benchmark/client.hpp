@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_CLIENT_BENCHMARK_CLIENT_H
+#define WEBSOCKET_CLIENT_BENCHMARK_CLIENT_H
+
+#include "websocketclient.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// WebSocket client waiting synchronously for the messages echoed by TestServer. Every message
+// received counts, so it also measures what a "/flood" connection receives.
+class BenchmarkClient final {
+public:
+	using clock = std::chrono::steady_clock;
+
+	BenchmarkClient(const std::string &url, wsc::WebSocket::Configuration config = {});
+	~BenchmarkClient();
+
+	BenchmarkClient(const BenchmarkClient &) = delete;
+	BenchmarkClient &operator=(const BenchmarkClient &) = delete;
+
+	clock::duration openDuration() const { return mOpenDuration; }  // from open() to onOpen
+	clock::time_point lastSendTime() const { return mLastSendTime; } // of the last echo
+	size_t receivedBytes() const;
+
+	clock::duration roundTrip(size_t size);          // sends a message, waits for the echo
+	clock::duration echo(size_t size, size_t count); // sends all, then waits for all echoes
+
+private:
+	void waitReceived(size_t count); // throws on failure or timeout
+
+	std::unique_ptr<wsc::WebSocket> mWebSocket;
+	clock::duration mOpenDuration{};
+	clock::time_point mLastSendTime;
+	size_t mReceived = 0;
+	size_t mReceivedBytes = 0;
+	bool mOpen = false;
+	bool mFailed = false;
+	mutable std::mutex mMutex;
+	std::condition_variable mCondition;
+};
+
+// Formats the median and 99th percentile, like "p50 41.2 us, p99 87.0 us"
+std::string describe_latencies(std::vector<BenchmarkClient::clock::duration> latencies);
+
+// Formats a throughput, like "312.4 MB/s"
+std::string describe_throughput(size_t bytes, BenchmarkClient::clock::duration duration);
+
+#endif
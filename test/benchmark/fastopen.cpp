@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "client.hpp"
+#include "server.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const size_t ConnectionCount = 200;
+
+// Reads a TcpExt counter from /proc/net/netstat, where a header line names the values of the
+// following line
+long read_tcpext(const string &name) {
+	ifstream file("/proc/net/netstat");
+	string header, values;
+	while (getline(file, header) && getline(file, values)) {
+		if (header.rfind("TcpExt:", 0) != 0)
+			continue;
+
+		istringstream names(header), counts(values);
+		string key, count;
+		while (names >> key && counts >> count)
+			if (key == name)
+				return stol(count);
+	}
+	return -1;
+}
+
+// Duration of plain blocking connect() calls, which is the handshake round trip Fast Open saves
+vector<BenchmarkClient::clock::duration> connect_durations(uint16_t port) {
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	vector<BenchmarkClient::clock::duration> durations;
+	durations.reserve(ConnectionCount);
+	for (size_t i = 0; i < ConnectionCount; ++i) {
+		int sock = ::socket(AF_INET, SOCK_STREAM, 0);
+		auto start = BenchmarkClient::clock::now();
+		int ret = ::connect(sock, reinterpret_cast<const struct sockaddr *>(&addr), sizeof(addr));
+		auto duration = BenchmarkClient::clock::now() - start;
+		::close(sock);
+		if (ret == 0)
+			durations.push_back(duration);
+	}
+	return durations;
+}
+
+string read_sysctl() {
+	ifstream file("/proc/sys/net/ipv4/tcp_fastopen");
+	string value;
+	return getline(file, value) ? value : "unknown";
+}
+
+} // namespace
+
+// Time from open() to the open callback with and without TCP Fast Open, against a server
+// accepting it. The kernel only sends data in the SYN when net.ipv4.tcp_fastopen has the client
+// bit (1) and the listener has the server bit (2), so both are reported with the number of Fast
+// Open connections. The TCP handshake round trip is the most Fast Open can save on each.
+void benchmark_fast_open() {
+	auto sysctl = read_sysctl();
+	cout << "net.ipv4.tcp_fastopen: " << sysctl << endl;
+	if (sysctl == "unknown" || (stoi(sysctl) & 0x3) != 0x3)
+		cout << "Set net.ipv4.tcp_fastopen=3 for client and server Fast Open" << endl;
+
+	for (bool tls : {false, true}) {
+		TestServer::Options options;
+		options.tls = tls;
+		options.fastOpen = true;
+		TestServer server(std::move(options));
+		if (!tls)
+			cout << "TCP handshake: " << describe_latencies(connect_durations(server.port()))
+			     << endl;
+
+		for (bool fastOpen : {false, true}) {
+			wsc::WebSocket::Configuration config;
+			config.disableTlsVerification = true;
+			config.enableTcpFastOpen = fastOpen;
+
+			BenchmarkClient warmup(server.url(), config); // caches the cookie and the session
+			long before = read_tcpext("TCPFastOpenActive");
+			vector<BenchmarkClient::clock::duration> durations;
+			durations.reserve(ConnectionCount);
+			for (size_t i = 0; i < ConnectionCount; ++i) {
+				BenchmarkClient client(server.url(), config);
+				durations.push_back(client.openDuration());
+			}
+			long after = read_tcpext("TCPFastOpenActive");
+
+			cout << (tls ? "wss" : "ws") << (fastOpen ? " with" : " without")
+			     << " Fast Open: " << describe_latencies(std::move(durations));
+			if (before >= 0 && after >= 0)
+				cout << ", " << after - before << " of " << ConnectionCount << " in the SYN";
+
+			cout << endl;
+		}
+	}
+}
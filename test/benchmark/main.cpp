@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "websocketclient.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+using namespace std;
+using namespace chrono_literals;
+
+void benchmark_ringqueue();
+void benchmark_unix();
+void benchmark_tls_offload();
+void benchmark_fast_open();
+void benchmark_read_budget();
+void benchmark_tls_records();
+void benchmark_tls_policy();
+void benchmark_threadpool();
+void benchmark_allocations();
+
+namespace {
+
+struct Benchmark {
+	const char *name;
+	std::function<void()> run;
+};
+
+// Benchmarks run in order in the same process, pass a name to run only this one
+const Benchmark Benchmarks[] = {
+    {"ringqueue", benchmark_ringqueue},
+    {"unix", benchmark_unix},
+    {"tls_offload", benchmark_tls_offload},
+    {"fast_open", benchmark_fast_open},
+    {"read_budget", benchmark_read_budget},
+    {"tls_records", benchmark_tls_records},
+    {"tls_policy", benchmark_tls_policy},
+    {"threadpool", benchmark_threadpool},
+    {"allocations", benchmark_allocations},
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+	wsc::InitLogger(wsc::LogLevel::Warning);
+
+	int failed = 0;
+	for (const auto &benchmark : Benchmarks) {
+		if (argc > 1 && std::strcmp(argv[1], benchmark.name) != 0)
+			continue;
+
+		cout << "*** Running " << benchmark.name << " benchmark..." << endl;
+		try {
+			benchmark.run();
+		} catch (const exception &e) {
+			cerr << "*** " << benchmark.name << " benchmark failed: " << e.what() << endl;
+			++failed;
+		}
+	}
+
+	if (wsc::Cleanup().wait_for(10s) != future_status::ready) {
+		cerr << "Cleanup timed out" << endl;
+		return -1;
+	}
+
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "client.hpp"
+#include "server.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+const size_t ProbeCount = 8;
+const size_t LatencyCount = 500; // per probe
+const auto MaxDuration = 10s;     // per budget, as starved probes are slow
+const size_t LatencyMessageSize = 64;
+
+string describe_budget(optional<size_t> budget) {
+	if (!budget)
+		return "default budget";
+
+	return *budget ? to_string(*budget / 1024) + " KiB budget" : "unlimited budget";
+}
+
+} // namespace
+
+// Round trip latency of echo connections sharing the poll thread with a connection receiving as
+// fast as the server sends, for different read budgets
+void benchmark_read_budget() {
+	TestServer server;
+	const optional<size_t> budgets[] = {0, nullopt, 64 * 1024}; // zero is unlimited
+
+	// With the default single poll thread, the probes and the flood share it
+	for (auto budget : budgets) {
+		wsc::WebSocket::Configuration config;
+		config.readBudget = budget;
+		if (budget == 0)
+			config.readMessageBudget = 0; // or the default message budget still applies
+
+		vector<unique_ptr<BenchmarkClient>> probes;
+		for (size_t i = 0; i < ProbeCount; ++i)
+			probes.push_back(make_unique<BenchmarkClient>(server.url(), config));
+
+		BenchmarkClient flood(server.url("/flood"), config);
+		auto start = BenchmarkClient::clock::now();
+		vector<BenchmarkClient::clock::duration> latencies;
+		latencies.reserve(LatencyCount * ProbeCount);
+		for (size_t i = 0; i < LatencyCount && BenchmarkClient::clock::now() < start + MaxDuration;
+		     ++i)
+			for (auto &probe : probes)
+				latencies.push_back(probe->roundTrip(LatencyMessageSize));
+
+		auto flooded = flood.receivedBytes();
+		auto elapsed = BenchmarkClient::clock::now() - start;
+		auto samples = latencies.size();
+		cout << "With " << describe_budget(budget) << ": round trip of " << samples
+		     << " probes: " << describe_latencies(std::move(latencies))
+		     << ", flood: " << describe_throughput(flooded, elapsed) << endl;
+	}
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "message.hpp"
+
+#include "impl/queue.hpp"
+#include "impl/ringqueue.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using wsc::message_ptr;
+
+namespace {
+
+const size_t QueueLimit = 1024; // elements, like the receive queues
+const size_t ContendedCount = 2000000;
+const size_t BurstSize = 16;
+const size_t BurstCount = 200000;
+
+size_t message_amount(const message_ptr &message) { return message->size(); }
+
+// One producer thread pushes while one consumer thread pops, returns ns per message
+template <class Q> double contended(Q &queue, const vector<message_ptr> &messages) {
+	auto start = chrono::steady_clock::now();
+	thread producer([&]() {
+		for (size_t i = 0; i < ContendedCount; ++i)
+			queue.push(messages[i % messages.size()]);
+	});
+
+	size_t received = 0;
+	while (received < ContendedCount) {
+		if (queue.pop())
+			++received;
+		else
+			this_thread::yield();
+	}
+	producer.join();
+
+	auto elapsed = chrono::duration<double, std::nano>(chrono::steady_clock::now() - start);
+	return elapsed.count() / double(ContendedCount);
+}
+
+// Pushes then pops bursts on one thread, returns ns per message
+template <class Q> double bursts(Q &queue, const vector<message_ptr> &messages) {
+	auto start = chrono::steady_clock::now();
+	for (size_t b = 0; b < BurstCount; ++b) {
+		for (size_t i = 0; i < BurstSize; ++i)
+			queue.push(messages[i]);
+
+		for (size_t i = 0; i < BurstSize; ++i)
+			if (!queue.pop())
+				throw runtime_error("Queue is unexpectedly empty");
+	}
+
+	auto elapsed = chrono::duration<double, std::nano>(chrono::steady_clock::now() - start);
+	return elapsed.count() / double(BurstCount * BurstSize);
+}
+
+} // namespace
+
+// Queue<T> behind its mutex against the lock-free RingQueue<T>, with the limit and the amount
+// function of the receive paths
+void benchmark_ringqueue() {
+	vector<message_ptr> messages;
+	for (size_t i = 0; i < 64; ++i)
+		messages.push_back(wsc::make_message(64 + i));
+
+	cout << fixed << setprecision(1);
+	{
+		wsc::impl::Queue<message_ptr> queue(QueueLimit, message_amount);
+		cout << "Queue contended: " << contended(queue, messages) << " ns/msg" << endl;
+		cout << "Queue bursts of " << BurstSize << ": " << bursts(queue, messages) << " ns/msg"
+		     << endl;
+	}
+	{
+		wsc::impl::RingQueue<message_ptr> queue(QueueLimit, message_amount);
+		cout << "RingQueue contended: " << contended(queue, messages) << " ns/msg" << endl;
+		cout << "RingQueue bursts of " << BurstSize << ": " << bursts(queue, messages)
+		     << " ns/msg" << endl;
+	}
+}
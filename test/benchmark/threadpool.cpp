@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "client.hpp"
+
+#include "impl/internals.hpp"
+#include "impl/threadpool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using clock = wsc::impl::ThreadPool::clock;
+
+const size_t ExternalCount = 1000000;
+const size_t SpawnerCount = 1000;
+const size_t SpawnedCount = 1000; // per spawner
+const size_t LatencyCount = 20000;
+
+// The thread pool before work stealing, as a baseline: a single queue of tasks ordered by time
+// behind one mutex and condition variable, and tasks wrapped in a packaged_task since enqueue()
+// was the only way to submit them
+class SingleQueuePool final {
+public:
+	explicit SingleQueuePool(int count) {
+		while (count-- > 0)
+			mWorkers.emplace_back([this]() { run(); });
+	}
+
+	~SingleQueuePool() {
+		{
+			lock_guard lock(mMutex);
+			mJoining = true;
+			mCondition.notify_all();
+		}
+		for (auto &w : mWorkers)
+			w.join();
+	}
+
+	template <class F> void enqueue(F &&f) {
+		lock_guard lock(mMutex);
+		auto task = make_shared<packaged_task<void()>>(std::forward<F>(f));
+		mTasks.push({clock::now(), [task = std::move(task)]() { return (*task)(); }});
+		mCondition.notify_one();
+	}
+
+private:
+	void run() {
+		unique_lock lock(mMutex);
+		while (!mJoining) {
+			if (mTasks.empty()) {
+				mCondition.wait(lock);
+				continue;
+			}
+			auto time = mTasks.top().time;
+			if (time > clock::now()) {
+				mCondition.wait_until(lock, time);
+				continue;
+			}
+			auto func = std::move(mTasks.top().func);
+			mTasks.pop();
+			lock.unlock();
+			func();
+			lock.lock();
+		}
+	}
+
+	struct Task {
+		clock::time_point time;
+		function<void()> func;
+		bool operator>(const Task &other) const { return time > other.time; }
+	};
+	priority_queue<Task, deque<Task>, greater<Task>> mTasks;
+	condition_variable mCondition;
+	mutex mMutex;
+	bool mJoining = false;
+	vector<thread> mWorkers;
+};
+
+void wait_for(const atomic<size_t> &counter, size_t count) {
+	while (counter.load(memory_order_acquire) < count)
+		this_thread::yield();
+}
+
+void print_rate(const char *pool, const char *name, size_t count,
+                chrono::duration<double> elapsed) {
+	cout << pool << ", " << name << ": " << fixed << setprecision(0)
+	     << double(count) / elapsed.count() << " tasks/s" << endl;
+}
+
+// Runs the scenarios with submit(f) queuing task f on the pool
+template <class Submit> void run_scenarios(const char *pool, Submit submit) {
+	{
+		atomic<size_t> counter = 0;
+		auto start = clock::now();
+		for (size_t i = 0; i < ExternalCount; ++i)
+			submit([&counter]() { counter.fetch_add(1, memory_order_release); });
+
+		wait_for(counter, ExternalCount);
+		print_rate(pool, "posted from outside", ExternalCount, clock::now() - start);
+	}
+	{
+		atomic<size_t> counter = 0;
+		auto start = clock::now();
+		for (size_t i = 0; i < SpawnerCount; ++i)
+			submit([&submit, &counter]() {
+				for (size_t j = 0; j < SpawnedCount; ++j)
+					submit([&counter]() { counter.fetch_add(1, memory_order_release); });
+			});
+
+		wait_for(counter, SpawnerCount * SpawnedCount);
+		print_rate(pool, "spawned by workers", SpawnerCount * SpawnedCount,
+		           clock::now() - start);
+	}
+	{
+		vector<clock::duration> latencies;
+		latencies.reserve(LatencyCount);
+		for (size_t i = 0; i < LatencyCount; ++i) {
+			atomic<size_t> done = 0;
+			clock::duration latency;
+			auto posted = clock::now();
+			submit([&done, &latency, posted]() {
+				latency = clock::now() - posted;
+				done.store(1, memory_order_release);
+			});
+			wait_for(done, 1);
+			latencies.push_back(latency);
+		}
+		cout << pool << ", post to run: " << describe_latencies(std::move(latencies)) << endl;
+	}
+}
+
+} // namespace
+
+// Throughput for tasks submitted from outside the pool and spawned by workers, and the delay
+// until an idle pool runs a task. The previous single-queue pool runs first as a baseline with the
+// workers it spawned at startup, then ThreadPool through enqueue(), which allocates a future like
+// the baseline, and through post(). ThreadPool spawns workers on demand, so their number is
+// reported afterwards.
+void benchmark_threadpool() {
+	using wsc::MIN_THREADPOOL_SIZE;
+	{
+		int count = std::max(int(thread::hardware_concurrency()), MIN_THREADPOOL_SIZE);
+		SingleQueuePool baseline(count);
+		cout << "Single queue (before): " << count << " workers" << endl;
+		run_scenarios("Single queue (before)",
+		              [&baseline](auto f) { baseline.enqueue(std::move(f)); });
+	}
+
+	wsc::Preload(); // spawns the workers
+	auto &pool = wsc::impl::ThreadPool::Instance();
+	run_scenarios("Work stealing, enqueue()", [&pool](auto f) { pool.enqueue(std::move(f)); });
+	run_scenarios("Work stealing, post()", [&pool](auto f) { pool.post(std::move(f)); });
+	cout << "Work stealing: " << pool.count() << " workers at the end" << endl;
+}
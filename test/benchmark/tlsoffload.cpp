@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "client.hpp"
+#include "server.hpp"
+
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const size_t MessageSizes[] = {64, 4096};
+const size_t LatencyCount = 5000;
+
+} // namespace
+
+// Round trip latency over wss with incoming TLS records processed inline on the poll thread, the
+// default, against offloaded to the thread pool
+void benchmark_tls_offload() {
+	TestServer::Options options;
+	options.tls = true;
+	TestServer server(std::move(options));
+
+	for (bool offload : {false, true}) {
+		wsc::WebSocket::Configuration config;
+		config.disableTlsVerification = true;
+		config.offloadTlsProcessing = offload;
+		BenchmarkClient client(server.url(), config);
+
+		for (size_t size : MessageSizes) {
+			vector<BenchmarkClient::clock::duration> latencies;
+			latencies.reserve(LatencyCount);
+			for (size_t i = 0; i < LatencyCount; ++i)
+				latencies.push_back(client.roundTrip(size));
+
+			cout << (offload ? "Offloaded" : "Inline") << " round trip of " << size
+			     << " bytes: " << describe_latencies(std::move(latencies)) << endl;
+		}
+	}
+}
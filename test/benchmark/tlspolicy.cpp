@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "client.hpp"
+#include "server.hpp"
+
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+const char *const Ciphersuites[] = {
+    "TLS_AES_128_GCM_SHA256",
+    "TLS_AES_256_GCM_SHA384",
+    "TLS_CHACHA20_POLY1305_SHA256",
+};
+
+const size_t HandshakeCount = 100;
+const size_t BulkMessageSize = 64 * 1024;
+const size_t BulkCount = 512;
+
+} // namespace
+
+// Handshake rate and bulk echo throughput over wss for each TLS 1.3 ciphersuite. Sessions are
+// cached per policy, so handshakes after the first of each policy are resumptions.
+void benchmark_tls_policy() {
+	using clock = BenchmarkClient::clock;
+	TestServer::Options options;
+	options.tls = true;
+	TestServer server(std::move(options));
+
+	{
+		// Initialize the library beforehand, so the first policy is not penalized
+		wsc::WebSocket::Configuration config;
+		config.disableTlsVerification = true;
+		BenchmarkClient warmup(server.url(), config);
+	}
+
+	for (const char *ciphersuite : Ciphersuites) {
+		wsc::TlsPolicy policy;
+		policy.minVersion = wsc::TlsVersion::Tls13;
+		policy.ciphersuites = ciphersuite;
+
+		wsc::WebSocket::Configuration config;
+		config.disableTlsVerification = true;
+		config.tlsPolicy = policy;
+
+		auto before = wsc::GetTlsSessionCacheStats();
+		auto start = clock::now();
+		for (size_t i = 0; i < HandshakeCount; ++i)
+			BenchmarkClient client(server.url(), config);
+
+		double seconds = chrono::duration<double>(clock::now() - start).count();
+		auto after = wsc::GetTlsSessionCacheStats();
+
+		BenchmarkClient client(server.url(), config);
+		auto elapsed = client.echo(BulkMessageSize, BulkCount);
+		cout << ciphersuite << ": " << fixed << setprecision(1) << double(HandshakeCount) / seconds
+		     << " connections/s (" << after.hits - before.hits << " resumed), echo of "
+		     << BulkMessageSize << " bytes: "
+		     << describe_throughput(BulkMessageSize * BulkCount, elapsed) << endl;
+	}
+}
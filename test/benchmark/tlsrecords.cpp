@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "client.hpp"
+#include "server.hpp"
+
+#include <atomic>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const size_t MessageSize = 256 * 1024;
+const size_t BurstCount = 8;
+const size_t BurstMessageCount = 16;
+const auto IdleGap = chrono::milliseconds(1100); // longer than TLS_RECORD_IDLE_RESET
+
+string describe_record_size(optional<size_t> size) {
+	return size ? to_string(*size) + " byte records" : "dynamic records";
+}
+
+} // namespace
+
+// Bursts of messages over wss separated by idle gaps, with dynamic and fixed TLS record sizes.
+// Dynamic sizing restarts with small records after each gap, so it should match small records on
+// the time to first byte of the first message of a burst, from the send call until the server
+// parsed its first frame header, and full records on the throughput of the rest of the burst.
+// On loopback, sending a full record takes microseconds, so the time to first byte only differs
+// on a slower link, for instance with "ip link set lo mtu 1500" and a tbf qdisc limiting the rate.
+void benchmark_tls_records() {
+	using clock = BenchmarkClient::clock;
+	atomic<clock::rep> begin = 0;
+	TestServer::Options options;
+	options.tls = true;
+	options.onMessageBegin = [&begin]() { begin = clock::now().time_since_epoch().count(); };
+	TestServer server(std::move(options));
+
+	{
+		// Warm up the library and the server beforehand, so the first record size is not penalized
+		wsc::WebSocket::Configuration config;
+		config.disableTlsVerification = true;
+		config.maxMessageSize = MessageSize;
+		BenchmarkClient warmup(server.url(), config);
+		warmup.echo(MessageSize, BurstMessageCount);
+	}
+
+	const optional<size_t> recordSizes[] = {nullopt, 1369, 16384};
+	for (auto recordSize : recordSizes) {
+		wsc::WebSocket::Configuration config;
+		config.disableTlsVerification = true;
+		config.maxMessageSize = MessageSize;
+		config.tlsRecordSize = recordSize;
+		BenchmarkClient client(server.url(), config);
+
+		vector<clock::duration> firstBytes;
+		firstBytes.reserve(BurstCount);
+		clock::duration elapsed{};
+		for (size_t i = 0; i < BurstCount; ++i) {
+			this_thread::sleep_for(IdleGap);
+			client.roundTrip(MessageSize);
+			firstBytes.push_back(clock::time_point(clock::duration(begin.load())) -
+			                     client.lastSendTime());
+			elapsed += client.echo(MessageSize, BurstMessageCount);
+		}
+
+		cout << "With " << describe_record_size(recordSize)
+		     << ": time to first byte after idle: " << describe_latencies(std::move(firstBytes))
+		     << ", burst echo: "
+		     << describe_throughput(MessageSize * BurstMessageCount * BurstCount, elapsed) << endl;
+	}
+}
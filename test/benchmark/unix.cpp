@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "client.hpp"
+#include "server.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const size_t LatencyMessageSize = 64;
+const size_t LatencyCount = 5000;
+const size_t BulkMessageSize = 64 * 1024;
+const size_t BulkCount = 512;
+
+void run(const char *name, const TestServer &server) {
+	BenchmarkClient client(server.url());
+	vector<BenchmarkClient::clock::duration> latencies;
+	latencies.reserve(LatencyCount);
+	for (size_t i = 0; i < LatencyCount; ++i)
+		latencies.push_back(client.roundTrip(LatencyMessageSize));
+
+	auto elapsed = client.echo(BulkMessageSize, BulkCount);
+	cout << name << " round trip of " << LatencyMessageSize
+	     << " bytes: " << describe_latencies(std::move(latencies)) << endl;
+	cout << name << " echo of " << BulkMessageSize << " bytes: "
+	     << describe_throughput(BulkMessageSize * BulkCount, elapsed) << endl;
+}
+
+} // namespace
+
+// ws+unix:// against ws:// on loopback TCP to the same server, for small message round trips and
+// bulk echo throughput
+void benchmark_unix() {
+	{
+		TestServer server;
+		run("TCP", server);
+	}
+	{
+		TestServer::Options options;
+		options.unixPath = "/tmp/wsc-benchmark-" + to_string(::getpid()) + ".sock";
+		TestServer server(std::move(options));
+		run("Unix", server);
+	}
+}
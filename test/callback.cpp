@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "utils.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+using namespace chrono_literals;
+
+// A replacement returns while the previous function is still running on another thread, but a
+// reset waits for it to return. A callback may also reset itself.
+void test_callback() {
+	wsc::synchronized_callback<int> callback;
+	promise<void> entered;
+	promise<void> release;
+	auto released = release.get_future().share();
+	atomic<bool> returned = false;
+	atomic<int> replaced = 0;
+
+	callback = [&entered, released, &returned](int) {
+		entered.set_value();
+		released.wait();
+		returned = true;
+	};
+
+	thread caller([&callback]() { callback(1); });
+	entered.get_future().wait();
+
+	callback = [&replaced](int value) { replaced = value; };
+	if (returned)
+		throw runtime_error("Replacement waited for the previous function");
+
+	callback(2);
+	if (replaced != 2)
+		throw runtime_error("Replacement not called");
+
+	auto reset = async(launch::async, [&callback]() { callback = nullptr; });
+	if (reset.wait_for(100ms) != future_status::timeout)
+		throw runtime_error("Reset did not wait for the call in progress");
+
+	release.set_value();
+	caller.join();
+	if (reset.wait_for(5s) != future_status::ready)
+		throw runtime_error("Reset did not return");
+
+	if (callback(3))
+		throw runtime_error("Called after reset");
+
+	callback = [&callback](int) { callback = nullptr; };
+	callback(4);
+	if (callback)
+		throw runtime_error("Callback did not reset itself");
+}
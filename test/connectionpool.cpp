@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "server.hpp"
+
+#include "impl/connectionpool.hpp"
+#include "websocketclient.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace chrono_literals;
+
+using wsc::impl::ConnectionPool;
+
+namespace {
+
+template <class F> bool wait_until(F &&condition, chrono::milliseconds timeout = 10s) {
+	auto deadline = chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		if (chrono::steady_clock::now() >= deadline)
+			return false;
+
+		this_thread::sleep_for(10ms);
+	}
+	return true;
+}
+
+// Opens a WebSocket, checks a message is echoed, then closes it
+void open_and_echo(const string &url, wsc::WebSocket::Configuration config) {
+	atomic<bool> opened = false;
+	atomic<bool> closed = false;
+	atomic<bool> received = false;
+	wsc::WebSocket ws(std::move(config));
+	ws.onOpen([&]() { opened = true; });
+	ws.onClosed([&]() { closed = true; });
+	ws.onMessage([&](auto) { received = true; });
+	ws.open(url);
+	if (!wait_until([&]() { return opened || closed; }) || !opened)
+		throw runtime_error("WebSocket did not open");
+
+	ws.send("hello");
+	if (!wait_until([&]() { return received || closed; }) || !received)
+		throw runtime_error("Echo not received");
+
+	ws.close();
+	if (!wait_until([&]() { return closed.load(); }))
+		throw runtime_error("WebSocket did not close");
+}
+
+} // namespace
+
+// Preconnect() keeps a TLS connection ready, open() claims it only with a configuration of the
+// same key, and the pool is refilled afterwards
+void test_connection_pool() {
+	mutex upgradedMutex;
+	vector<size_t> upgraded;
+	TestServer::Options options;
+	options.tls = true;
+	options.onUpgrade = [&](size_t index) {
+		lock_guard lock(upgradedMutex);
+		upgraded.push_back(index);
+	};
+	TestServer server(std::move(options));
+
+	wsc::WebSocket::Configuration config;
+	config.disableTlsVerification = true;
+	wsc::WebSocket::Preconnect(server.url(), 1, config);
+
+	auto &pool = ConnectionPool::Instance();
+	ConnectionPool::Endpoint endpoint;
+	endpoint.hostname = "127.0.0.1";
+	endpoint.service = to_string(server.port());
+	endpoint.isSecure = true;
+	if (!wait_until([&]() { return pool.available(endpoint) == 1; }))
+		throw runtime_error("Pooled connection not established");
+
+	// Settings only used while establishing do not split the pool, kernel TLS does
+	auto establishing = endpoint;
+	establishing.fastOpen = true;
+	establishing.connectionTimeout = 1s;
+	auto kernelTls = endpoint;
+	kernelTls.kernelTls = true;
+	if (pool.available(establishing) != 1 || pool.available(kernelTls) != 0)
+		throw runtime_error("Wrong pool key");
+
+	auto other = config;
+	other.enableKernelTls = true;
+	open_and_echo(server.url(), other); // connects directly
+	open_and_echo(server.url(), config);
+	{
+		lock_guard lock(upgradedMutex);
+		if (upgraded != vector<size_t>{2, 1})
+			throw runtime_error("Pooled connection not claimed by the matching configuration");
+	}
+
+	if (!wait_until([&]() { return pool.available(endpoint) == 1 && server.accepted() == 3; }))
+		throw runtime_error("Pool not refilled");
+
+	wsc::WebSocket::Preconnect(server.url(), 0, config);
+	if (pool.available(endpoint) != 0)
+		throw runtime_error("Pool not emptied");
+}
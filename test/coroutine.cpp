@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "server.hpp"
+
+#include "coroutine.hpp"
+#include "websocketclient.hpp"
+
+#include <chrono>
+#include <coroutine>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#ifndef WSC_HAS_COROUTINES
+#error "The coroutine tests must be compiled as C++20"
+#endif
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+const int MessageCount = 100;
+
+// Eager coroutine reporting its completion or its exception through a future
+struct Task {
+	struct promise_type {
+		promise<void> done;
+
+		Task get_return_object() { return Task{done.get_future()}; }
+		suspend_never initial_suspend() noexcept { return {}; }
+		suspend_never final_suspend() noexcept { return {}; }
+		void return_void() { done.set_value(); }
+		void unhandled_exception() { done.set_exception(current_exception()); }
+	};
+
+	future<void> done;
+};
+
+void wait(Task task) {
+	if (task.done.wait_for(10s) != future_status::ready)
+		throw runtime_error("Coroutine did not complete");
+
+	task.done.get(); // rethrows
+}
+
+// Echoes messages with the test server, then checks receive() returns nullopt once closed. The
+// coroutine continues on a library thread, or on the calling thread if the local connection opened
+// before it could suspend.
+Task echo(wsc::AsyncWebSocket &ws, string url) {
+	co_await ws.open(std::move(url));
+	if (!ws.socket().isOpen())
+		throw runtime_error("Open resumed before the WebSocket was open");
+
+	for (int i = 0; i < MessageCount; ++i) {
+		string text = "message " + to_string(i);
+		if (!co_await ws.send(text))
+			throw runtime_error("WebSocket closed while sending");
+
+		auto message = co_await ws.receive();
+		if (!message || !holds_alternative<string>(*message) || get<string>(*message) != text)
+			throw runtime_error("Unexpected echo");
+	}
+
+	ws.close();
+	if (co_await ws.receive())
+		throw runtime_error("Message received after close");
+}
+
+// Awaiting open throws when the connection fails
+Task refused(wsc::AsyncWebSocket &ws, string url) {
+	try {
+		co_await ws.open(std::move(url));
+	} catch (const runtime_error &) {
+		co_return;
+	}
+	throw runtime_error("Open did not throw on connection failure");
+}
+
+void test_echo() {
+	TestServer server;
+	wsc::AsyncWebSocket ws;
+	wait(echo(ws, server.url()));
+}
+
+void test_refused() {
+	uint16_t port;
+	{
+		TestServer server; // nothing listens on its port afterwards
+		port = server.port();
+	}
+	wsc::AsyncWebSocket ws;
+	wait(refused(ws, "ws://127.0.0.1:" + to_string(port) + "/"));
+}
+
+struct Test {
+	const char *name;
+	std::function<void()> run;
+};
+
+const Test Tests[] = {
+    {"echo", test_echo},
+    {"refused", test_refused},
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+	wsc::InitLogger(wsc::LogLevel::Warning);
+
+	int failed = 0;
+	for (const auto &test : Tests) {
+		if (argc > 1 && std::strcmp(argv[1], test.name) != 0)
+			continue;
+
+		cout << "*** Running coroutine " << test.name << " test..." << endl;
+		try {
+			test.run();
+			cout << "*** Finished coroutine " << test.name << " test" << endl;
+		} catch (const exception &e) {
+			cerr << "*** Coroutine " << test.name << " test failed: " << e.what() << endl;
+			++failed;
+		}
+	}
+
+	if (wsc::Cleanup().wait_for(10s) != future_status::ready) {
+		cerr << "Cleanup timed out" << endl;
+		return -1;
+	}
+
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "server.hpp"
+
+#include "impl/tlstransport.hpp"
+#include "impl/websocketimpl.hpp"
+#include "websocketclient.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+template <class F> bool wait_until(F &&condition, chrono::milliseconds timeout = 10s) {
+	auto deadline = chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		if (chrono::steady_clock::now() >= deadline)
+			return false;
+
+		this_thread::sleep_for(10ms);
+	}
+	return true;
+}
+
+// Opens a WebSocket with early data enabled, checks a message is echoed, then closes it. Returns
+// whether the server accepted the early data.
+bool open_and_echo(const string &url) {
+	wsc::WebSocket::Configuration config;
+	config.disableTlsVerification = true;
+	config.enableTlsEarlyData = true;
+	auto impl = std::make_shared<wsc::impl::WebSocket>(std::move(config));
+	wsc::WebSocket ws(impl);
+
+	atomic<bool> opened = false;
+	atomic<bool> closed = false;
+	atomic<bool> received = false;
+	ws.onOpen([&]() { opened = true; });
+	ws.onClosed([&]() { closed = true; });
+	ws.onMessage(nullptr, [&](string data) { received = data == "hello"; });
+	ws.open(url);
+	if (!wait_until([&]() { return opened || closed; }) || !opened)
+		throw runtime_error("WebSocket did not open");
+
+	auto tls = impl->getTlsTransport();
+	bool accepted = tls && tls->earlyDataAccepted();
+
+	ws.send("hello");
+	if (!wait_until([&]() { return received || closed; }) || !received)
+		throw runtime_error("Echo not received");
+
+	ws.close();
+	if (!wait_until([&]() { return closed.load(); }))
+		throw runtime_error("WebSocket did not close");
+
+	return accepted;
+}
+
+} // namespace
+
+// The first connection gets a session ticket allowing early data, then the resumed connection
+// sends the upgrade request as early data. If the server accepts it, the request is not sent
+// again. If the server rejects it, the request is replayed after the handshake.
+void test_tls_early_data() {
+	for (bool reject : {false, true}) {
+		TestServer::Options options;
+		options.tls = true;
+		options.allowEarlyData = true;
+		options.rejectEarlyData = reject;
+		TestServer server(std::move(options));
+
+		if (open_and_echo(server.url()))
+			throw runtime_error("Early data accepted without a session");
+
+		if (open_and_echo(server.url()) == reject)
+			throw runtime_error(reject ? "Rejected early data reported as accepted"
+			                           : "Early data not accepted on resumption");
+
+		if (server.earlyRequests() != (reject ? 0 : 1))
+			throw runtime_error("Unexpected number of requests received as early data");
+	}
+}
@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "server.hpp"
+
+#include "websocketclient.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include <poll.h>
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+// Waits on the poll descriptor like another event loop would, then processes with RunOnce()
+template <class F> bool run_until(F &&condition, chrono::milliseconds timeout = 10s) {
+	auto deadline = chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		auto now = chrono::steady_clock::now();
+		if (now >= deadline)
+			return false;
+
+		auto delay = chrono::ceil<chrono::milliseconds>(deadline - now);
+		if (auto next = wsc::GetPollTimeout())
+			delay = min(delay, *next);
+
+		struct pollfd pfd = {};
+		pfd.fd = wsc::GetPollDescriptor();
+		pfd.events = POLLIN;
+		::poll(&pfd, 1, int(delay.count()));
+		wsc::RunOnce();
+	}
+	return true;
+}
+
+} // namespace
+
+// With an external event loop, the application thread drives I/O, timers and callbacks through
+// Poll(), RunOnce() and the poll descriptor, and no library thread runs a callback.
+void test_external_loop() {
+	// Settings apply on the next initialization, so release the library first
+	if (wsc::Cleanup().wait_for(10s) != future_status::ready)
+		throw runtime_error("Cleanup timed out before switching to the external loop");
+
+	TestServer server;
+	wsc::ThreadingSettings settings;
+	settings.externalEventLoop = true;
+	wsc::SetThreadingSettings(settings);
+	wsc::Preload();
+
+	const auto mainThread = this_thread::get_id();
+	atomic<bool> otherThread = false;
+	atomic<bool> opened = false;
+	atomic<bool> closed = false;
+	atomic<bool> failed = false;
+	atomic<int> received = 0;
+	{
+		auto ws = make_unique<wsc::WebSocket>();
+		auto check = [&]() {
+			if (this_thread::get_id() != mainThread)
+				otherThread = true;
+		};
+		ws->onOpen([&]() {
+			check();
+			opened = true;
+		});
+		ws->onClosed([&]() {
+			check();
+			closed = true;
+		});
+		ws->onError([&](string) {
+			check();
+			failed = true;
+		});
+		ws->onMessage([&](auto) {
+			check();
+			++received;
+		});
+
+		if (wsc::GetPollDescriptor() < 0)
+			throw runtime_error("No poll descriptor in external mode");
+
+		ws->open(server.url());
+		if (!run_until([&]() { return opened || failed; }) || !opened)
+			throw runtime_error("WebSocket did not open");
+
+		const int count = 10;
+		for (int i = 0; i < count; ++i)
+			ws->send("hello");
+
+		if (!run_until([&]() { return received == count || failed; }) || received != count)
+			throw runtime_error("Echoes not received");
+
+		ws->close();
+
+		// Poll() waits on its own instead of the descriptor
+		auto deadline = chrono::steady_clock::now() + 10s;
+		while (!closed && chrono::steady_clock::now() < deadline)
+			wsc::Poll(100ms);
+
+		if (!closed)
+			throw runtime_error("WebSocket did not close");
+	}
+
+	if (otherThread)
+		throw runtime_error("Callback called from another thread");
+
+	// Cleanup only completes while the loop is running
+	auto cleanup = wsc::Cleanup();
+	auto deadline = chrono::steady_clock::now() + 10s;
+	while (cleanup.wait_for(0s) != future_status::ready && chrono::steady_clock::now() < deadline)
+		wsc::Poll(10ms);
+
+	wsc::SetThreadingSettings({});
+	if (cleanup.wait_for(0s) != future_status::ready)
+		throw runtime_error("Cleanup did not complete");
+}
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "server.hpp"
+
+#include "impl/internals.hpp"
+#include "websocketclient.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+const auto StallDuration = 300ms;
+
+template <class F> bool wait_until(F &&condition, chrono::milliseconds timeout = 10s) {
+	auto deadline = chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		if (chrono::steady_clock::now() >= deadline)
+			return false;
+
+		this_thread::sleep_for(10ms);
+	}
+	return true;
+}
+
+// Listening socket which never accepts, so TLS handshakes with it stall after the TCP handshake
+class StalledServer final {
+public:
+	StalledServer() {
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t addrlen = sizeof(addr);
+		mSock = ::socket(AF_INET, SOCK_STREAM, 0);
+		if (mSock < 0 ||
+		    ::bind(mSock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+		    ::listen(mSock, 8) < 0 ||
+		    ::getsockname(mSock, reinterpret_cast<struct sockaddr *>(&addr), &addrlen) < 0)
+			throw runtime_error("Failed to listen");
+
+		mPort = ntohs(addr.sin_port);
+	}
+
+	~StalledServer() { ::close(mSock); }
+
+	string url() const { return "wss://127.0.0.1:" + to_string(mPort) + "/"; }
+
+private:
+	int mSock = -1;
+	uint16_t mPort = 0;
+};
+
+wsc::WebSocket::Configuration make_config() {
+	wsc::WebSocket::Configuration config;
+	config.disableTlsVerification = true;
+	return config;
+}
+
+} // namespace
+
+// With one handshake allowed at a time, a handshake waits in the queue while another one stalls,
+// and is admitted once the stalled one is abandoned. Without a limit, it proceeds immediately.
+void test_handshake_admission() {
+	TestServer::Options options;
+	options.tls = true;
+	TestServer server(std::move(options));
+	StalledServer stalledServer;
+	const auto before = wsc::GetHandshakeStats();
+
+	wsc::SetMaxConcurrentHandshakes(1);
+	{
+		wsc::WebSocket stalled(make_config());
+		stalled.open(stalledServer.url());
+		if (!wait_until([&]() { return wsc::GetHandshakeStats().active == before.active + 1; }))
+			throw runtime_error("Stalled handshake not active");
+
+		atomic<bool> opened = false;
+		wsc::WebSocket ws(make_config());
+		ws.onOpen([&]() { opened = true; });
+		ws.open(server.url());
+		if (!wait_until([&]() { return wsc::GetHandshakeStats().queued == 1; }))
+			throw runtime_error("Handshake not queued");
+
+		this_thread::sleep_for(StallDuration);
+		if (opened)
+			throw runtime_error("Handshake admitted above the limit");
+
+		stalled.close(); // releases the slot
+		if (!wait_until([&]() { return opened.load(); }))
+			throw runtime_error("Queued handshake not admitted");
+
+		auto stats = wsc::GetHandshakeStats();
+		if (stats.active != before.active || stats.queued != 0 ||
+		    stats.completed != before.completed + 1 || stats.failed != before.failed + 1 ||
+		    stats.maxDuration < StallDuration)
+			throw runtime_error("Unexpected handshake stats");
+
+		ws.close();
+	}
+
+	wsc::SetMaxConcurrentHandshakes(0); // unlimited
+	{
+		wsc::WebSocket stalled(make_config());
+		stalled.open(stalledServer.url());
+
+		atomic<bool> opened = false;
+		wsc::WebSocket ws(make_config());
+		ws.onOpen([&]() { opened = true; });
+		ws.open(server.url());
+		if (!wait_until([&]() { return opened.load(); }))
+			throw runtime_error("Handshake not admitted without limit");
+
+		auto stats = wsc::GetHandshakeStats();
+		if (stats.active != before.active + 1 || stats.queued != 0)
+			throw runtime_error("Unexpected handshake stats without limit");
+
+		stalled.close();
+		ws.close();
+	}
+
+	wsc::SetMaxConcurrentHandshakes(wsc::HANDSHAKE_MAX_CONCURRENT);
+}
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "server.hpp"
+
+#include "impl/tlstransport.hpp"
+#include "impl/websocketimpl.hpp"
+#include "websocketclient.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+const size_t MessageSizes[] = {5, 100000}; // the latter spans several records
+
+template <class F> bool wait_until(F &&condition, chrono::milliseconds timeout = 10s) {
+	auto deadline = chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		if (chrono::steady_clock::now() >= deadline)
+			return false;
+
+		this_thread::sleep_for(10ms);
+	}
+	return true;
+}
+
+// Whether the kernel accepts the TLS upper layer protocol on a connected TCP socket
+bool kernel_tls_supported() {
+#ifdef TCP_ULP
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addrlen = sizeof(addr);
+
+	int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+	int sock = ::socket(AF_INET, SOCK_STREAM, 0);
+	bool supported =
+	    listener >= 0 && sock >= 0 &&
+	    ::bind(listener, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0 &&
+	    ::listen(listener, 1) == 0 &&
+	    ::getsockname(listener, reinterpret_cast<struct sockaddr *>(&addr), &addrlen) == 0 &&
+	    ::connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0 &&
+	    ::setsockopt(sock, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0;
+
+	if (sock >= 0)
+		::close(sock);
+	if (listener >= 0)
+		::close(listener);
+
+	return supported;
+#else
+	return false;
+#endif
+}
+
+} // namespace
+
+// With kernel TLS enabled, sending is offloaded after the handshake if the kernel supports it,
+// otherwise encryption falls back to user space. The server only decrypts the echoed messages if
+// the keys and the record sequence number handed over by OpenSSL are right.
+void test_kernel_tls() {
+	const bool supported = kernel_tls_supported();
+	if (!supported)
+		cout << "Kernel TLS is not supported, only checking the fallback" << endl;
+
+	TestServer::Options options;
+	options.tls = true;
+	TestServer server(std::move(options));
+
+	for (bool enabled : {false, true}) {
+		wsc::WebSocket::Configuration config;
+		config.disableTlsVerification = true;
+		config.enableKernelTls = enabled;
+		auto impl = std::make_shared<wsc::impl::WebSocket>(std::move(config));
+		wsc::WebSocket ws(impl);
+
+		atomic<bool> opened = false;
+		atomic<bool> closed = false;
+		mutex receivedMutex;
+		vector<wsc::binary> received;
+		ws.onOpen([&]() { opened = true; });
+		ws.onClosed([&]() { closed = true; });
+		ws.onMessage([&](wsc::binary data) {
+			lock_guard lock(receivedMutex);
+			received.push_back(std::move(data));
+		}, nullptr);
+
+		ws.open(server.url());
+		if (!wait_until([&]() { return opened || closed; }) || !opened)
+			throw runtime_error("WebSocket did not open");
+
+		auto tls = impl->getTlsTransport();
+		if (!tls || tls->kernelTlsEnabled() != (enabled && supported))
+			throw runtime_error(enabled && supported ? "Kernel TLS not used"
+			                                         : "Kernel TLS used unexpectedly");
+
+		vector<wsc::binary> sent;
+		for (size_t size : MessageSizes) {
+			wsc::binary data(size);
+			for (size_t i = 0; i < size; ++i)
+				data[i] = wsc::byte(i * 7);
+
+			ws.send(data);
+			sent.push_back(std::move(data));
+		}
+
+		auto allReceived = [&]() {
+			lock_guard lock(receivedMutex);
+			return received.size() == sent.size();
+		};
+		if (!wait_until([&]() { return allReceived() || closed; }) || received != sent)
+			throw runtime_error("Echo not received");
+
+		ws.close();
+		if (!wait_until([&]() { return closed.load(); }))
+			throw runtime_error("WebSocket did not close");
+	}
+}
@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "websocketclient.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+using namespace std;
+using namespace chrono_literals;
+
+void test_callback();
+void test_ringqueue();
+void test_tcp_fallback();
+void test_send_async_file();
+void test_connection_pool();
+void test_external_loop();
+void test_kernel_tls();
+void test_tls_session_cache();
+void test_tls_early_data();
+void test_handshake_admission();
+void test_strand();
+void test_resolver();
+void test_unix_socket();
+
+namespace {
+
+struct Test {
+	const char *name;
+	std::function<void()> run;
+};
+
+// Tests run in order in the same process, pass a name to run only this one
+const Test Tests[] = {
+    {"callback", test_callback},
+    {"ringqueue", test_ringqueue},
+    {"tcp_fallback", test_tcp_fallback},
+    {"send_async_file", test_send_async_file},
+    {"connection_pool", test_connection_pool},
+    {"external_loop", test_external_loop},
+    {"kernel_tls", test_kernel_tls},
+    {"tls_session_cache", test_tls_session_cache},
+    {"tls_early_data", test_tls_early_data},
+    {"handshake_admission", test_handshake_admission},
+    {"strand", test_strand},
+    {"resolver", test_resolver},
+    {"unix_socket", test_unix_socket},
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+	wsc::InitLogger(wsc::LogLevel::Warning);
+
+	int failed = 0;
+	for (const auto &test : Tests) {
+		if (argc > 1 && std::strcmp(argv[1], test.name) != 0)
+			continue;
+
+		cout << "*** Running " << test.name << " test..." << endl;
+		try {
+			test.run();
+			cout << "*** Finished " << test.name << " test" << endl;
+		} catch (const exception &e) {
+			cerr << "*** " << test.name << " test failed: " << e.what() << endl;
+			++failed;
+		}
+	}
+
+	if (wsc::Cleanup().wait_for(10s) != future_status::ready) {
+		cerr << "Cleanup timed out" << endl;
+		return -1;
+	}
+
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "impl/internals.hpp"
+#include "impl/resolver.hpp"
+#include "websocketclient.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+using namespace chrono_literals;
+
+using wsc::impl::Resolver;
+
+namespace {
+
+const auto CacheTtl = 500ms;
+const auto NegativeCacheTtl = 100ms;
+
+const string ValidHostname = "resolver-test.invalid";
+const string InvalidHostname = "resolver-negative-test.invalid";
+
+template <class F> bool wait_until(F &&condition, chrono::milliseconds timeout = 10s) {
+	auto deadline = chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		if (chrono::steady_clock::now() >= deadline)
+			return false;
+
+		this_thread::sleep_for(10ms);
+	}
+	return true;
+}
+
+// Resolves hostname, checks whether it succeeded and whether it was looked up or served from the
+// cache. The callback must not be called from within resolve().
+void expect_resolution(const string &hostname, bool success, bool cached) {
+	auto &resolver = Resolver::Instance();
+	const size_t lookups = resolver.lookupCount();
+
+	const auto caller = this_thread::get_id();
+	atomic<bool> called = false;
+	atomic<bool> synchronous = false;
+	atomic<bool> succeeded = false;
+	resolver.resolve(hostname, "80", [&](optional<Resolver::address_list> result) {
+		synchronous = this_thread::get_id() == caller;
+		succeeded = result && result->size() == 1;
+		called = true;
+	});
+
+	if (!wait_until([&]() { return called.load(); }))
+		throw runtime_error("Resolution callback not called for " + hostname);
+
+	if (synchronous)
+		throw runtime_error("Resolution callback called synchronously for " + hostname);
+
+	if (succeeded != success)
+		throw runtime_error("Unexpected resolution result for " + hostname);
+
+	if ((resolver.lookupCount() == lookups) != cached)
+		throw runtime_error(cached ? "Resolution not cached for " + hostname
+		                           : "Resolution cached unexpectedly for " + hostname);
+}
+
+} // namespace
+
+// Successful and failed resolutions are served from the cache until their respective time to
+// live expires, then looked up again
+void test_resolver() {
+	wsc::Preload(); // starts the resolver
+
+	auto &resolver = Resolver::Instance();
+	resolver.setCacheTtl(CacheTtl, NegativeCacheTtl);
+	resolver.setOverride(ValidHostname, {"127.0.0.1"});
+	resolver.setOverride(InvalidHostname, {"not an address"});
+
+	expect_resolution(ValidHostname, true, false);
+	expect_resolution(ValidHostname, true, true);
+	expect_resolution(InvalidHostname, false, false);
+	expect_resolution(InvalidHostname, false, true);
+
+	this_thread::sleep_for(NegativeCacheTtl * 2);
+	expect_resolution(InvalidHostname, false, false);
+	expect_resolution(ValidHostname, true, true);
+
+	this_thread::sleep_for(CacheTtl);
+	expect_resolution(ValidHostname, true, false);
+	expect_resolution(ValidHostname, true, true);
+
+	resolver.setOverride(ValidHostname, {});
+	resolver.setOverride(InvalidHostname, {});
+	resolver.setCacheTtl(wsc::RESOLVER_CACHE_TTL, wsc::RESOLVER_NEGATIVE_CACHE_TTL);
+}
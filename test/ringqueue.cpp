@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "impl/ringqueue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+size_t element_amount(const size_t &element) { return element % 10; }
+
+} // namespace
+
+// Elements keep their order under a concurrent consumer, and a producer blocks while the queue
+// is at its limit until an element is popped or the queue is stopped
+void test_ringqueue() {
+	const size_t limit = 1000;
+	const size_t count = 200000;
+	wsc::impl::RingQueue<size_t> queue(limit, element_amount);
+
+	// Fill up to the limit from a single thread first
+	for (size_t i = 0; i < limit; ++i)
+		queue.push(i);
+
+	if (!queue.full() || queue.size() != limit)
+		throw runtime_error("Queue is not full at the limit");
+
+	size_t amount = 0;
+	for (size_t i = 0; i < limit; ++i)
+		amount += element_amount(i);
+
+	if (queue.amount() != amount)
+		throw runtime_error("Wrong amount");
+
+	atomic<bool> pushed = false;
+	thread blocked([&queue, &pushed, limit]() {
+		queue.push(limit);
+		pushed = true;
+	});
+	this_thread::sleep_for(chrono::milliseconds(50));
+	if (pushed || queue.size() != limit)
+		throw runtime_error("Push did not block at the limit");
+
+	if (queue.pop() != 0)
+		throw runtime_error("Wrong element order");
+
+	blocked.join();
+	if (!queue.full())
+		throw runtime_error("Blocked push was lost");
+
+	for (size_t i = 1; i <= limit; ++i)
+		if (queue.pop() != i)
+			throw runtime_error("Wrong element order");
+
+	if (!queue.empty() || queue.amount() != 0 || queue.pop())
+		throw runtime_error("Queue is not empty");
+
+	thread producer([&queue]() {
+		for (size_t i = 0; i < count; ++i)
+			queue.push(i);
+	});
+
+	size_t expected = 0;
+	while (expected < count) {
+		if (queue.size() > limit)
+			throw runtime_error("Queue exceeds its limit");
+
+		auto peeked = queue.peek();
+		auto element = queue.pop();
+		if (!element) {
+			this_thread::yield();
+			continue;
+		}
+		if (peeked != element || *element != expected)
+			throw runtime_error("Wrong element order");
+
+		++expected;
+	}
+	producer.join();
+
+	if (!queue.empty() || queue.amount() != 0)
+		throw runtime_error("Queue is not empty");
+
+	for (size_t i = 0; i < limit; ++i)
+		queue.push(i);
+
+	thread stopped([&queue, limit]() { queue.push(limit); });
+	this_thread::sleep_for(chrono::milliseconds(50));
+	queue.stop(); // releases the blocked producer, which drops its element
+	stopped.join();
+	if (queue.size() != limit)
+		throw runtime_error("Element pushed after stop");
+}
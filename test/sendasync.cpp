@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "server.hpp"
+
+#include "websocketclient.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+const size_t FileSize = 16 * 1024 * 1024;
+const size_t MessageSize = 64 * 1024;
+const size_t MaxBufferedAmount = 4 * 1024 * 1024;
+
+template <class F> bool wait_until(F &&condition, chrono::milliseconds timeout = 10s) {
+	auto deadline = chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		if (chrono::steady_clock::now() >= deadline)
+			return false;
+
+		this_thread::sleep_for(10ms);
+	}
+	return true;
+}
+
+} // namespace
+
+// Messages sent asynchronously during a file transfer are held back until its last fragment.
+// Their bytes count in the buffered amount, and they complete only once written after the file.
+// The message exceeding the maximum buffered amount is rejected and called back with false.
+void test_send_async_file() {
+	mutex serverMutex;
+	vector<size_t> serverSizes;
+	promise<void> resume;
+	auto resumed = resume.get_future().share();
+	TestServer::Options options;
+	options.onMessageBegin = [resumed]() {
+		// Stall the first message so the file transfer stays in progress
+		resumed.wait_for(10s);
+	};
+	options.onMessage = [&](size_t size) {
+		lock_guard lock(serverMutex);
+		serverSizes.push_back(size);
+	};
+	TestServer server(std::move(options));
+
+	char path[] = "/tmp/wsc-test-XXXXXX";
+	int fd = ::mkstemp(path);
+	if (fd < 0)
+		throw runtime_error("Failed to create the temporary file");
+
+	vector<char> content(FileSize, 'f');
+	bool written = ::write(fd, content.data(), content.size()) == ssize_t(content.size());
+	::close(fd);
+	if (!written) {
+		::unlink(path);
+		throw runtime_error("Failed to write the temporary file");
+	}
+
+	wsc::WebSocket::Configuration config;
+	config.maxMessageSize = 2 * FileSize;
+	config.maxBufferedAmount = MaxBufferedAmount;
+	auto ws = make_shared<wsc::WebSocket>(config);
+	ws->open(server.url());
+	if (!wait_until([ws]() { return ws->isOpen(); })) {
+		::unlink(path);
+		throw runtime_error("WebSocket did not open");
+	}
+
+	ws->sendFile(path);
+	::unlink(path); // the file is mapped
+
+	// Completions may run after a failure, so they only reference shared state
+	struct Counters {
+		atomic<size_t> completed = 0;
+		atomic<size_t> failed = 0;
+		atomic<size_t> early = 0;
+		atomic<size_t> heldBack = 0;
+	};
+	auto counters = make_shared<Counters>();
+	auto callback = [counters, weak_ws = weak_ptr<wsc::WebSocket>(ws)](bool success) {
+		// Completing while the message is still held back, the amount would include it
+		auto ws = weak_ws.lock();
+		if (success && ws && ws->bufferedAmount() >= counters->heldBack)
+			++counters->early;
+
+		++(success ? counters->completed : counters->failed);
+	};
+
+	size_t accepted = 0;
+	while (ws->sendAsync(wsc::binary(MessageSize, std::byte{'m'}), callback)) {
+		counters->heldBack = ++accepted * MessageSize;
+		if (accepted * MessageSize > 2 * MaxBufferedAmount)
+			throw runtime_error("Held back messages are not counted in the buffered amount");
+	}
+	resume.set_value();
+
+	// The rejected message is called back too
+	if (!wait_until([&]() { return counters->completed + counters->failed == accepted + 1; }))
+		throw runtime_error("Send completions missing");
+
+	if (counters->failed != 1)
+		throw runtime_error("Send failed or rejection not called back");
+
+	if (counters->early)
+		throw runtime_error("Send completed before the message was written");
+
+	if (!wait_until([&]() {
+		    lock_guard lock(serverMutex);
+		    return serverSizes.size() == accepted + 1;
+	    }))
+		throw runtime_error("Messages not received by the server");
+
+	{
+		lock_guard lock(serverMutex);
+		if (serverSizes.front() != FileSize)
+			throw runtime_error("Held back messages overtook the file");
+	}
+
+	ws->close();
+	wait_until([ws]() { return ws->isClosed(); });
+}
@@ -0,0 +1,388 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "server.hpp"
+
+#include "impl/certificate.hpp"
+#include "impl/sha.hpp"
+#include "impl/utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const string WebSocketGuid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+const size_t FloodMessageSize = 65536;
+
+} // namespace
+
+class TestServer::Connection final {
+public:
+	Connection(int sock, SSL_CTX *ctx) : mSock(sock) {
+		if (ctx) {
+			mSsl = SSL_new(ctx);
+			SSL_set_fd(mSsl, sock);
+		}
+	}
+
+	~Connection() {
+		if (mSsl) {
+			// Without close_notify, OpenSSL removes the session from the cache, and anti-replay
+			// protection then prevents resuming it with early data
+			SSL_shutdown(mSsl);
+			SSL_free(mSsl);
+		}
+
+		::close(mSock);
+	}
+
+	int sock() const { return mSock; }
+
+	bool accept(bool readEarlyData) {
+		if (!mSsl)
+			return true;
+
+		if (readEarlyData) {
+			char buffer[4096];
+			size_t len = 0;
+			int ret;
+			while ((ret = SSL_read_early_data(mSsl, buffer, sizeof(buffer), &len)) !=
+			       SSL_READ_EARLY_DATA_FINISH) {
+				if (ret == SSL_READ_EARLY_DATA_ERROR)
+					return false;
+
+				mEarlyData.insert(mEarlyData.end(), buffer, buffer + len);
+			}
+		}
+		return SSL_accept(mSsl) == 1;
+	}
+
+	bool receivedEarlyData() const { return mEarlyDataPosition > 0 || !mEarlyData.empty(); }
+
+	size_t read(void *data, size_t size) {
+		if (mEarlyDataPosition < mEarlyData.size()) {
+			size = std::min(size, mEarlyData.size() - mEarlyDataPosition);
+			std::memcpy(data, mEarlyData.data() + mEarlyDataPosition, size);
+			mEarlyDataPosition += size;
+			return size;
+		}
+		if (mSsl) {
+			int ret = SSL_read(mSsl, data, int(size));
+			return ret > 0 ? size_t(ret) : 0;
+		}
+		ssize_t ret = ::recv(mSock, data, size, 0);
+		return ret > 0 ? size_t(ret) : 0;
+	}
+
+	bool readExactly(void *data, size_t size) {
+		auto *p = static_cast<uint8_t *>(data);
+		while (size > 0) {
+			size_t len = read(p, size);
+			if (len == 0)
+				return false;
+
+			p += len;
+			size -= len;
+		}
+		return true;
+	}
+
+	bool write(const void *data, size_t size) {
+		auto *p = static_cast<const uint8_t *>(data);
+		while (size > 0) {
+			ssize_t ret = mSsl ? SSL_write(mSsl, p, int(size))
+			                   : ::send(mSock, p, size, MSG_NOSIGNAL);
+			if (ret <= 0)
+				return false;
+
+			p += ret;
+			size -= size_t(ret);
+		}
+		return true;
+	}
+
+	bool writeFrame(uint8_t opcode, const uint8_t *payload, size_t size) {
+		vector<uint8_t> frame;
+		frame.reserve(size + 10);
+		frame.push_back(0x80 | opcode);
+		if (size < 126) {
+			frame.push_back(uint8_t(size));
+		} else if (size < 65536) {
+			frame.push_back(126);
+			frame.push_back(uint8_t(size >> 8));
+			frame.push_back(uint8_t(size));
+		} else {
+			frame.push_back(127);
+			for (int i = 7; i >= 0; --i)
+				frame.push_back(uint8_t(uint64_t(size) >> (8 * i)));
+		}
+		frame.insert(frame.end(), payload, payload + size);
+		return write(frame.data(), frame.size());
+	}
+
+private:
+	const int mSock;
+	SSL *mSsl = nullptr;
+	vector<char> mEarlyData; // read before the handshake completed
+	size_t mEarlyDataPosition = 0;
+};
+
+TestServer::TestServer(Options options) : mOptions(std::move(options)) {
+	if (mOptions.tls) {
+		auto certificate =
+		    wsc::impl::Certificate::Generate(wsc::CertificateType::Ecdsa, "localhost");
+		auto [x509, pkey] = certificate.credentials();
+		auto ctx = shared_ptr<SSL_CTX>(SSL_CTX_new(TLS_server_method()), SSL_CTX_free);
+		if (!ctx || SSL_CTX_use_certificate(ctx.get(), x509) != 1 ||
+		    SSL_CTX_use_PrivateKey(ctx.get(), pkey) != 1)
+			throw runtime_error("Failed to set up the TLS context");
+
+		if (mOptions.allowEarlyData)
+			SSL_CTX_set_max_early_data(ctx.get(), 16384);
+
+		mTlsContext = ctx;
+
+		// OpenSSL writes to the socket without MSG_NOSIGNAL
+		::signal(SIGPIPE, SIG_IGN);
+	}
+
+	if (mOptions.unixPath) {
+		::unlink(mOptions.unixPath->c_str());
+		mSock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		struct sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		std::strncpy(addr.sun_path, mOptions.unixPath->c_str(), sizeof(addr.sun_path) - 1);
+		if (mSock < 0 ||
+		    ::bind(mSock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+			throw runtime_error("Failed to bind the Unix socket");
+
+	} else {
+		mSock = ::socket(AF_INET, SOCK_STREAM, 0);
+		int enabled = 1;
+		::setsockopt(mSock, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+#ifdef TCP_FASTOPEN
+		if (mOptions.fastOpen) {
+			int qlen = 128;
+			::setsockopt(mSock, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen));
+		}
+#endif
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		socklen_t addrlen = sizeof(addr);
+		if (mSock < 0 ||
+		    ::bind(mSock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+		    ::getsockname(mSock, reinterpret_cast<struct sockaddr *>(&addr), &addrlen) < 0)
+			throw runtime_error("Failed to bind the TCP socket");
+
+		mPort = ntohs(addr.sin_port);
+	}
+
+	if (::listen(mSock, SOMAXCONN) < 0)
+		throw runtime_error("Failed to listen");
+
+	mThread = std::thread(&TestServer::run, this);
+}
+
+TestServer::~TestServer() { stop(); }
+
+string TestServer::url(const string &path) const {
+	if (mOptions.unixPath) {
+		string socketPath; // percent-encoded, so it may contain ':'
+		for (char c : *mOptions.unixPath)
+			socketPath += c == ':' ? "%3A" : c == '%' ? "%25" : string(1, c);
+
+		return "ws+unix://" + socketPath + ':' + path;
+	}
+
+	return string(mOptions.tls ? "wss" : "ws") + "://127.0.0.1:" + to_string(mPort) + path;
+}
+
+void TestServer::stop() {
+	if (mStopped.exchange(true))
+		return;
+
+	::shutdown(mSock, SHUT_RDWR);
+	mThread.join();
+	::close(mSock);
+
+	{
+		std::lock_guard lock(mMutex);
+		for (int sock : mConnectionSocks)
+			::shutdown(sock, SHUT_RDWR);
+	}
+	for (auto &t : mConnectionThreads)
+		t.join();
+
+	if (mOptions.unixPath)
+		::unlink(mOptions.unixPath->c_str());
+}
+
+void TestServer::run() {
+	while (!mStopped) {
+		int sock = ::accept(mSock, nullptr, nullptr);
+		if (sock < 0)
+			break;
+
+		if (!mOptions.unixPath) {
+			int nodelay = 1;
+			::setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+		}
+
+		size_t index = ++mAccepted;
+		auto connection = make_shared<Connection>(
+		    sock, mTlsContext ? static_cast<SSL_CTX *>(mTlsContext.get()) : nullptr);
+
+		std::lock_guard lock(mMutex);
+		mConnectionSocks.insert(sock);
+		mConnectionThreads.emplace_back(&TestServer::serve, this, std::move(connection), index);
+	}
+}
+
+void TestServer::serve(shared_ptr<Connection> connection, size_t index) {
+	try {
+		if (!connection->accept(mOptions.allowEarlyData && !mOptions.rejectEarlyData))
+			throw runtime_error("TLS handshake failed");
+
+		if (connection->receivedEarlyData())
+			++mEarlyRequests;
+
+		// Opening handshake
+		string request;
+		char c;
+		while (request.size() < 4 || request.compare(request.size() - 4, 4, "\r\n\r\n") != 0) {
+			if (connection->read(&c, 1) == 0)
+				throw runtime_error("Connection closed during the handshake");
+
+			request.push_back(c);
+		}
+
+		string path = request.substr(request.find(' ') + 1);
+		path = path.substr(0, path.find(' '));
+
+		string key;
+		for (const auto &line : wsc::impl::utils::explode(request, '\n')) {
+			auto sep = line.find(':');
+			string name = line.substr(0, sep);
+			for (auto &ch : name)
+				ch = char(std::tolower(ch));
+
+			if (sep != string::npos && name == "sec-websocket-key") {
+				key = line.substr(sep + 1);
+				key.erase(0, key.find_first_not_of(' '));
+				key.erase(key.find_last_not_of("\r ") + 1);
+			}
+		}
+		if (key.empty())
+			throw runtime_error("Missing WebSocket key");
+
+		string accept = wsc::impl::utils::base64_encode(wsc::impl::Sha1(key + WebSocketGuid));
+		string response = "HTTP/1.1 101 Switching Protocols\r\n"
+		                  "Upgrade: websocket\r\n"
+		                  "Connection: Upgrade\r\n"
+		                  "Sec-WebSocket-Accept: " +
+		                  accept + "\r\n\r\n";
+		if (!connection->write(response.data(), response.size()))
+			throw runtime_error("Failed to send the handshake response");
+
+		if (mOptions.onUpgrade)
+			mOptions.onUpgrade(index);
+
+		if (path == "/flood") {
+			// Never read, writes fail once the client closes the connection
+			vector<uint8_t> payload(FloodMessageSize, 0xAA);
+			while (connection->writeFrame(0x2, payload.data(), payload.size()))
+				;
+
+			throw runtime_error("Flood interrupted");
+		}
+
+		// Frames
+		vector<uint8_t> message;
+		uint8_t messageOpcode = 0;
+		while (true) {
+			uint8_t header[2];
+			if (!connection->readExactly(header, 2))
+				break;
+
+			uint8_t opcode = header[0] & 0x0F;
+			bool fin = (header[0] & 0x80) != 0;
+			uint64_t length = header[1] & 0x7F;
+			if (length == 126 || length == 127) {
+				uint8_t ext[8];
+				size_t extlen = length == 126 ? 2 : 8;
+				if (!connection->readExactly(ext, extlen))
+					break;
+
+				length = 0;
+				for (size_t i = 0; i < extlen; ++i)
+					length = (length << 8) | ext[i];
+			}
+			uint8_t mask[4] = {0, 0, 0, 0};
+			if ((header[1] & 0x80) && !connection->readExactly(mask, 4))
+				break;
+
+			if (opcode == 0x1 || opcode == 0x2) {
+				messageOpcode = opcode;
+				if (mOptions.onMessageBegin)
+					mOptions.onMessageBegin();
+			}
+
+			vector<uint8_t> payload(static_cast<size_t>(length));
+			if (!connection->readExactly(payload.data(), payload.size()))
+				break;
+
+			for (size_t i = 0; i < payload.size(); ++i)
+				payload[i] ^= mask[i % 4];
+
+			if (opcode == 0x8) { // close
+				connection->writeFrame(0x8, payload.data(), std::min(payload.size(), size_t(2)));
+				break;
+			}
+			if (opcode == 0x9) { // ping
+				connection->writeFrame(0xA, payload.data(), payload.size());
+				continue;
+			}
+			if (opcode != 0x0 && opcode != 0x1 && opcode != 0x2)
+				continue;
+
+			message.insert(message.end(), payload.begin(), payload.end());
+			if (!fin)
+				continue;
+
+			if (mOptions.onMessage)
+				mOptions.onMessage(message.size());
+
+			if (!connection->writeFrame(messageOpcode, message.data(), message.size()))
+				break;
+
+			message.clear();
+		}
+
+	} catch (const std::exception &) {
+		// Drop the connection
+	}
+
+	std::lock_guard lock(mMutex);
+	mConnectionSocks.erase(connection->sock());
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef WEBSOCKET_CLIENT_TEST_SERVER_H
+#define WEBSOCKET_CLIENT_TEST_SERVER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+
+// Minimal blocking WebSocket server for tests and benchmarks, with one thread per connection.
+// The request path selects the behavior: "/flood" sends binary messages of 64 KiB until the
+// client closes, any other path echoes each message back once reassembled.
+class TestServer final {
+public:
+	struct Options {
+		bool tls = false;                    // self-signed certificate, disable verification
+		bool fastOpen = false;               // accept TCP Fast Open
+		bool allowEarlyData = false;         // issue TLS 1.3 tickets allowing early data
+		bool rejectEarlyData = false;        // don't read early data, so OpenSSL rejects it
+		std::optional<std::string> unixPath; // listen on a Unix socket instead of loopback TCP
+		std::function<void()> onMessageBegin;        // first frame header of a message received
+		std::function<void(size_t size)> onMessage; // message reassembled
+		std::function<void(size_t index)> onUpgrade; // handshake on the index-th connection
+	};
+
+	TestServer(Options options);
+	TestServer() : TestServer(Options{}) {}
+	~TestServer();
+
+	TestServer(const TestServer &) = delete;
+	TestServer &operator=(const TestServer &) = delete;
+
+	uint16_t port() const { return mPort; }
+	std::string url(const std::string &path = "/") const;
+	size_t accepted() const { return mAccepted; }
+	size_t earlyRequests() const { return mEarlyRequests; } // upgrades requested in early data
+
+	void stop();
+
+private:
+	class Connection;
+
+	void run();
+	void serve(std::shared_ptr<Connection> connection, size_t index);
+
+	const Options mOptions;
+	int mSock = -1;
+	uint16_t mPort = 0;
+	std::shared_ptr<void> mTlsContext;
+	std::atomic<size_t> mAccepted = 0;
+	std::atomic<size_t> mEarlyRequests = 0;
+	std::atomic<bool> mStopped = false;
+	std::thread mThread;
+	std::list<std::thread> mConnectionThreads;
+	std::set<int> mConnectionSocks;
+	std::mutex mMutex;
+};
+
+#endif
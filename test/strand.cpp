@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "impl/strand.hpp"
+#include "websocketclient.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace chrono_literals;
+
+using wsc::impl::Strand;
+
+namespace {
+
+const size_t ProducerCount = 4;
+const size_t TaskCount = 20000; // per producer
+const size_t Budget = 8;        // small so runs are rescheduled often
+
+template <class F> bool wait_until(F &&condition, chrono::milliseconds timeout = 10s) {
+	auto deadline = chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		if (chrono::steady_clock::now() >= deadline)
+			return false;
+
+		this_thread::sleep_for(10ms);
+	}
+	return true;
+}
+
+} // namespace
+
+// Tasks posted concurrently run one at a time and in order for each producer, including tasks
+// posted from a running task. The strand outlives its last owner until its tasks have run, then
+// is destroyed with everything they captured.
+void test_strand() {
+	wsc::Preload(); // spawns the workers
+
+	auto strand = std::make_shared<Strand>(Budget);
+	weak_ptr<Strand> weakStrand = strand;
+	auto token = std::make_shared<int>(0); // captured by every task
+
+	atomic<bool> running = false;
+	atomic<bool> overlapped = false;
+	atomic<size_t> done = 0;
+	vector<size_t> next(ProducerCount + 1, 0); // next expected index per producer
+	bool unordered = false;
+
+	auto task = [&, token](size_t producer, size_t index) {
+		if (running.exchange(true))
+			overlapped = true;
+
+		if (next[producer] != index)
+			unordered = true;
+
+		next[producer] = index + 1;
+		running = false;
+		done.fetch_add(1, memory_order_release);
+	};
+
+	vector<thread> producers;
+	for (size_t p = 0; p < ProducerCount; ++p)
+		producers.emplace_back([&, p]() {
+			for (size_t i = 0; i < TaskCount; ++i)
+				strand->post(task, p, i);
+		});
+
+	// The nested tasks are posted from the strand, behind those already queued
+	strand->post([&, s = strand.get()]() {
+		for (size_t i = 0; i < TaskCount; ++i)
+			s->post(task, ProducerCount, i);
+	});
+
+	for (auto &t : producers)
+		t.join();
+
+	strand.reset(); // pending runs keep the strand alive
+	const size_t total = (ProducerCount + 1) * TaskCount;
+	if (!wait_until([&]() { return done.load(memory_order_acquire) == total; }))
+		throw runtime_error("Strand tasks did not all run");
+
+	if (overlapped)
+		throw runtime_error("Strand tasks ran concurrently");
+
+	if (unordered)
+		throw runtime_error("Strand tasks ran out of order");
+
+	if (!wait_until([&]() { return weakStrand.expired(); }))
+		throw runtime_error("Strand not destroyed after its tasks ran");
+
+	if (token.use_count() != 2) // the other reference is held by task
+		throw runtime_error("Strand tasks not destroyed");
+}
@@ -0,0 +1,137 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "server.hpp"
+
+#include "websocketclient.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+// Loopback listener which never accepts, with its queue full so the SYNs to it are dropped and
+// connection attempts hang like towards an unreachable host
+class Blackhole final {
+public:
+	Blackhole(const string &address, uint16_t port) {
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		::inet_pton(AF_INET, address.c_str(), &addr.sin_addr);
+
+		mListener = ::socket(AF_INET, SOCK_STREAM, 0);
+		if (::bind(mListener, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+		    ::listen(mListener, 0) < 0)
+			throw runtime_error("Failed to listen on " + address);
+
+		for (int i = 0; i < 2; ++i) { // a backlog of 0 still queues one connection
+			int sock = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+			::connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+			mFillers.push_back(sock);
+		}
+		this_thread::sleep_for(100ms);
+	}
+
+	~Blackhole() {
+		for (int sock : mFillers)
+			::close(sock);
+
+		::close(mListener);
+	}
+
+	Blackhole(const Blackhole &) = delete;
+	Blackhole &operator=(const Blackhole &) = delete;
+
+private:
+	int mListener;
+	vector<int> mFillers;
+};
+
+} // namespace
+
+// RFC 8305 connection racing: the first addresses are blackholed so their attempts hang, and the
+// loopback listener must win without the delayed attempts failing the connected transport. TCP
+// Fast Open must not make the first attempt win, which happens if connect() is deferred to the
+// first send, with a cached cookie or with net.ipv4.tcp_fastopen allowing no cookie (0x4).
+void test_tcp_fallback() {
+	TestServer::Options options;
+	options.fastOpen = true;
+	TestServer server(std::move(options));
+	Blackhole first("127.0.0.2", server.port());
+	Blackhole second("127.0.0.3", server.port());
+	const string hostname = "fallback.test";
+	wsc::SetHostOverride(hostname, {"127.0.0.2", "127.0.0.3", "127.0.0.1"});
+
+	for (int i = 0; i < 4; ++i) {
+		wsc::WebSocket::Configuration config;
+		config.enableTcpFastOpen = i % 2 == 1;
+		wsc::WebSocket ws(config);
+		atomic<bool> failed = false;
+		atomic<int> received = 0;
+		ws.onError([&failed](string) { failed = true; });
+		ws.onMessage([&received](auto) { ++received; });
+		ws.open("ws://" + hostname + ':' + to_string(server.port()) + '/');
+
+		auto deadline = chrono::steady_clock::now() + 5s;
+		while (!ws.isOpen() && !failed && chrono::steady_clock::now() < deadline)
+			this_thread::sleep_for(10ms);
+
+		if (!ws.isOpen())
+			throw runtime_error("WebSocket did not open through the fallback address");
+
+		// Let the pending delayed attempts fire
+		this_thread::sleep_for(600ms);
+		if (!ws.isOpen() || failed)
+			throw runtime_error("WebSocket failed after the connection race was won");
+
+		ws.send("hello");
+		deadline = chrono::steady_clock::now() + 5s;
+		while (received == 0 && chrono::steady_clock::now() < deadline)
+			this_thread::sleep_for(10ms);
+
+		if (received == 0)
+			throw runtime_error("No echo received");
+
+		ws.close();
+	}
+
+	// The second address refuses the connection while the first attempt still hangs, so the third
+	// one must start at once instead of after another delay
+	wsc::SetHostOverride(hostname, {"127.0.0.2", "127.0.0.4", "127.0.0.1"});
+	for (int i = 0; i < 4; ++i) {
+		wsc::WebSocket ws;
+		auto start = chrono::steady_clock::now();
+		ws.open("ws://" + hostname + ':' + to_string(server.port()) + '/');
+
+		auto deadline = start + 5s;
+		while (!ws.isOpen() && chrono::steady_clock::now() < deadline)
+			this_thread::sleep_for(1ms);
+
+		if (!ws.isOpen())
+			throw runtime_error("WebSocket did not open through the fallback address");
+
+		if (chrono::steady_clock::now() - start >= 450ms) // 250ms expected, 500ms if delayed
+			throw runtime_error("Next attempt delayed after a failed attempt");
+
+		ws.close();
+	}
+
+	wsc::SetHostOverride(hostname, {});
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "impl/internals.hpp"
+#include "impl/tlssessioncache.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono_literals;
+
+using wsc::binary;
+using wsc::impl::TlsSessionCache;
+
+namespace {
+
+binary make_session(const string &content) {
+	binary data;
+	for (char c : content)
+		data.push_back(wsc::byte(c));
+
+	return data;
+}
+
+void expect_session(TlsSessionCache &cache, const string &key, optional<string> content) {
+	auto session = cache.take(key);
+	if (session != (content ? optional<binary>(make_session(*content)) : nullopt))
+		throw runtime_error("Unexpected session for " + key);
+}
+
+} // namespace
+
+// Sessions are taken most recent first and only once, expired ones are skipped, the least
+// recently used key is evicted when the cache is full, and sessions survive a save and a load
+void test_tls_session_cache() {
+	auto &cache = TlsSessionCache::Instance();
+	const auto lifetime = TlsSessionCache::clock::now() + 1h;
+
+	cache.store("take", make_session("first"), lifetime);
+	cache.store("take", make_session("second"), lifetime);
+	expect_session(cache, "take", "second");
+	expect_session(cache, "take", "first");
+	expect_session(cache, "take", nullopt);
+
+	cache.store("expiry", make_session("valid"), lifetime);
+	cache.store("expiry", make_session("expiring"), TlsSessionCache::clock::now() + 50ms);
+	cache.store("expiry", make_session("expired"), TlsSessionCache::clock::now() - 1s); // ignored
+	this_thread::sleep_for(100ms);
+	expect_session(cache, "expiry", "valid");
+	expect_session(cache, "expiry", nullopt);
+
+	// Fill the cache so the order of eviction is known, then use "used" after "unused"
+	const size_t maxKeys = wsc::TLS_SESSION_CACHE_MAX_KEYS;
+	for (size_t i = 0; i < maxKeys; ++i)
+		cache.store("fill-" + to_string(i), make_session("fill"), lifetime);
+
+	cache.store("used", make_session("used"), lifetime);
+	cache.store("unused", make_session("unused"), lifetime);
+	cache.store("used", make_session("used again"), lifetime);
+	for (size_t i = 0; i < maxKeys - 1; ++i) // evicts the remaining fillers, then "unused"
+		cache.store("more-" + to_string(i), make_session("more"), lifetime);
+
+	expect_session(cache, "unused", nullopt);
+	expect_session(cache, "used", "used again");
+	expect_session(cache, "used", "used");
+
+	const string path = "/tmp/wsc-test-sessions-" + to_string(::getpid());
+	std::remove(path.c_str());
+	cache.setFile(path);
+	cache.store("persist", make_session("older"), lifetime);
+	cache.store("persist", make_session("newer"), lifetime);
+	cache.flush();
+	cache.setFile(nullopt); // the scheduled save must not overwrite the file
+
+	struct stat st;
+	if (::stat(path.c_str(), &st) != 0 || (st.st_mode & 0777) != 0600)
+		throw runtime_error("Session file not saved with owner-only permissions");
+
+	expect_session(cache, "persist", "newer");
+	expect_session(cache, "persist", "older");
+	cache.setFile(path); // loads the file
+	cache.setFile(nullopt);
+	std::remove(path.c_str());
+	expect_session(cache, "persist", "newer");
+	expect_session(cache, "persist", "older");
+	expect_session(cache, "persist", nullopt);
+}
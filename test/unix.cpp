@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2024 sunze
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "server.hpp"
+
+#include "websocketclient.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace chrono_literals;
+
+namespace {
+
+const size_t FloodMessageSize = 64 * 1024;
+
+template <class F> bool wait_until(F &&condition, chrono::milliseconds timeout = 10s) {
+	auto deadline = chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		if (chrono::steady_clock::now() >= deadline)
+			return false;
+
+		this_thread::sleep_for(10ms);
+	}
+	return true;
+}
+
+// Opens url, sends a message and checks the reply: the echo on most paths, or a binary message of
+// the flood size on "/flood", which shows the WebSocket path was parsed correctly
+void expect_reply(const string &url, bool flood) {
+	wsc::WebSocket ws;
+	atomic<bool> opened = false;
+	atomic<bool> closed = false;
+	atomic<bool> replied = false;
+	ws.onOpen([&]() { opened = true; });
+	ws.onClosed([&]() { closed = true; });
+	ws.onMessage([&](wsc::binary data) { replied = flood && data.size() == FloodMessageSize; },
+	             [&](string data) { replied = !flood && data == "hello"; });
+
+	ws.open(url);
+	if (!wait_until([&]() { return opened || closed; }) || !opened)
+		throw runtime_error("WebSocket did not open for " + url);
+
+	if (ws.remoteAddress().value_or("").compare(0, 5, "unix:") != 0)
+		throw runtime_error("WebSocket not connected over a Unix socket for " + url);
+
+	ws.send("hello");
+	if (!wait_until([&]() { return replied || closed; }) || !replied)
+		throw runtime_error("Unexpected reply for " + url);
+
+	if (flood)
+		ws.forceClose(); // the flood never reads the closing handshake
+	else
+		ws.close();
+
+	if (!wait_until([&]() { return closed.load(); }))
+		throw runtime_error("WebSocket did not close for " + url);
+}
+
+} // namespace
+
+// ws+unix:// URLs connect to the socket path and request the WebSocket path after it. A ':' in
+// the socket path is kept unless followed by '/', and a percent-encoded one is always kept.
+void test_unix_socket() {
+	const string suffix = to_string(::getpid());
+	{
+		TestServer::Options options;
+		options.unixPath = "/tmp/wsc-test-" + suffix + ":colon.sock";
+		TestServer server(std::move(options));
+		const string base = "ws+unix:///tmp/wsc-test-" + suffix + ":colon.sock";
+
+		expect_reply(base, false);
+		expect_reply(base + ":", false);
+		expect_reply(base + ":/echo", false);
+		expect_reply(base + ":/flood", true);
+		expect_reply(server.url("/flood"), true); // percent-encoded
+	}
+
+	// The directory name ends with ':', so the socket path contains ":/"
+	const string dir = "/tmp/wsc-test-" + suffix + ":";
+	if (::mkdir(dir.c_str(), 0700) < 0)
+		throw runtime_error("Failed to create the temporary directory");
+
+	try {
+		TestServer::Options options;
+		options.unixPath = dir + "/server.sock";
+		TestServer server(std::move(options));
+
+		expect_reply(server.url("/"), false);
+		expect_reply(server.url("/flood"), true);
+
+	} catch (...) {
+		::rmdir(dir.c_str());
+		throw;
+	}
+
+	::rmdir(dir.c_str());
+}